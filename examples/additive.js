@@ -0,0 +1,15 @@
+// Additive synthesis example, demonstrating parallel workers
+// Renders 64 partials split between 4 workers running additive_worker.js.
+// Knob 1 sets the pitch, knob 2 the brightness.
+
+config.frameDivider = 1
+config.bufferSize = 128
+
+let workers = new Workers("additive_worker.js", 4)
+
+function process(block) {
+	workers.fork()
+	// The main script's own outputs must be written before join() adds the workers' outputs
+	block.outputs[0].fill(0)
+	workers.join()
+}
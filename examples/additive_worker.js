@@ -0,0 +1,27 @@
+// Worker script of additive.js
+// Each worker renders 16 of the 64 partials into its own block.outputs, which the main script sums.
+
+const PARTIALS = 16
+
+let phases = new Float32Array(PARTIALS)
+
+function process(block) {
+	let pitch = block.knobs[0] * 10 - 5 + block.inputs[0][0]
+	let freq = 261.6256 * Math.pow(2, pitch)
+	let brightness = 0.5 + block.knobs[1] * 2
+	for (let p = 0; p < PARTIALS; p++) {
+		let harmonic = workerIndex * PARTIALS + p + 1
+		let deltaPhase = block.sampleTime * freq * harmonic
+		// Skip partials above the Nyquist frequency
+		if (deltaPhase >= 0.5)
+			break
+		let amplitude = 5 / Math.pow(harmonic, brightness)
+		let phase = phases[p]
+		for (let i = 0; i < block.bufferSize; i++) {
+			phase += deltaPhase
+			phase -= Math.floor(phase)
+			block.outputs[0][i] += amplitude * Math.sin(2 * Math.PI * phase)
+		}
+		phases[p] = phase
+	}
+}
@@ -0,0 +1,29 @@
+// Batched voltage-controlled oscillator example
+// Every Prototype running this script shares one engine, which computes all of their oscillators in one call.
+
+config.frameDivider = 1
+config.bufferSize = 16
+config.batch = 1
+
+// One phase per instance
+let phases = new Float32Array(32)
+function process(block) {
+	let n = block.bufferSize
+	for (let k = 0; k < block.batchSize; k++) {
+		// Each instance has its own knob and input
+		let pitch = block.batchKnobs[0][k] * 10 - 5
+		pitch += block.inputs[0][k * n]
+		let freq = 261.6256 * Math.pow(2, pitch)
+
+		let deltaPhase = block.sampleTime * freq
+		let phase = phases[k]
+		for (let i = 0; i < n; i++) {
+			phase += deltaPhase
+			phase %= 1
+			block.outputs[0][k * n + i] = Math.sin(2 * Math.PI * phase) * 5
+		}
+		phases[k] = phase
+		block.batchLights[0][k * 3 + 1] = block.batchKnobs[0][k]
+	}
+	display("Instances: " + block.batchSize)
+}
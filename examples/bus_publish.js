@@ -0,0 +1,22 @@
+// Publishes a bank of 16 sine oscillators to a bus, for reading with bus_subscribe.js
+
+config.frameDivider = 1
+config.bufferSize = 32
+
+let bus = new Bus("oscillators", 16, true)
+let phases = new Float32Array(16)
+function process(block) {
+	let pitch = block.knobs[0] * 4 - 2 + block.inputs[0][0]
+	for (let c = 0; c < 16; c++) {
+		let freq = 261.6256 * Math.pow(2, pitch + c / 12)
+		let deltaPhase = block.sampleTime * freq
+		let offset = bus.offset(c)
+		let phase = phases[c]
+		for (let i = 0; i < bus.frames; i++) {
+			phase += deltaPhase
+			phase %= 1
+			bus.data[offset + i] = Math.sin(2 * Math.PI * phase) * 5
+		}
+		phases[c] = phase
+	}
+}
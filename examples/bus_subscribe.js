@@ -0,0 +1,16 @@
+// Mixes the 16 oscillators published by bus_publish.js, with the knobs choosing which groups to hear
+
+config.frameDivider = 1
+config.bufferSize = 32
+
+let bus = new Bus("oscillators", 16)
+function process(block) {
+	for (let i = 0; i < block.bufferSize; i++)
+		block.outputs[0][i] = 0
+	for (let c = 0; c < 16; c++) {
+		let gain = block.knobs[c % 6] / 4
+		let offset = bus.offset(c)
+		for (let i = 0; i < block.bufferSize; i++)
+			block.outputs[0][i] += bus.data[offset + i] * gain
+	}
+}
@@ -0,0 +1,46 @@
+// Clock divider example, demonstrating input and output events
+// Each output fires a trigger every `i + 1` clocks received at input 1.
+// Input 2 resets the count.
+
+config.frameDivider = 1
+config.bufferSize = 64
+
+let count = 0
+function process(block) {
+	// Reset on the first rising edge of input 2
+	let resetOffset = -1
+	for (let e = 0; e < block.inputEventCounts[1]; e++) {
+		if (block.inputEventTypes[1][e] == 1) {
+			resetOffset = block.inputEventOffsets[1][e]
+			break
+		}
+	}
+
+	for (let i = 0; i < 6; i++)
+		block.outputEventCounts[i] = 0
+
+	for (let e = 0; e < block.inputEventCounts[0]; e++) {
+		// Ignore falling edges
+		if (block.inputEventTypes[0][e] != 1)
+			continue
+		let offset = block.inputEventOffsets[0][e]
+		if (resetOffset >= 0 && offset >= resetOffset) {
+			count = 0
+			resetOffset = -1
+		}
+
+		for (let i = 0; i < 6; i++) {
+			if (count % (i + 1) == 0) {
+				let n = block.outputEventCounts[i]++
+				block.outputEventOffsets[i][n] = offset
+				block.outputEventTypes[i][n] = 2
+			}
+		}
+		count++
+	}
+	if (resetOffset >= 0)
+		count = 0
+
+	for (let i = 0; i < 6; i++)
+		block.lights[i][1] = (block.outputEventCounts[i] > 0) ? 1 : 0
+}
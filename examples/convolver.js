@@ -0,0 +1,14 @@
+// Convolution reverb example, demonstrating the convolver kernel
+// Place an impulse response named "ir.wav" next to this script.
+// Knob 1 sets the wet level, knob 2 the dry level.
+
+config.frameDivider = 1
+config.bufferSize = 64
+
+let reverb = new Kernel("convolver")
+reverb.load("ir.wav")
+
+function process(block) {
+	reverb.set(block.knobs[0], block.knobs[1])
+	reverb.process(block.inputs[0], block.outputs[0])
+}
@@ -0,0 +1,23 @@
+-- Feedback delay example, demonstrating pooled buffers
+-- The delay line is kept when the script is edited and reloaded, so echoes keep ringing.
+-- Knob 1 sets the delay time up to 2 seconds, knob 2 the feedback.
+
+config.frameDivider = 1
+config.bufferSize = 32
+
+SIZE = 131072
+line = getBuffer("delay", SIZE)
+writeIndex = 0
+
+function process(block)
+	local delay = math.max(math.floor(block.knobs[1] * 2 * block.sampleRate), 1)
+	delay = math.min(delay, SIZE - 1)
+	local feedback = block.knobs[2]
+	for i=1,block.bufferSize do
+		local readIndex = (writeIndex - delay) % SIZE
+		local y = line[readIndex + 1]
+		line[writeIndex + 1] = block.inputs[1][i] + y * feedback
+		writeIndex = (writeIndex + 1) % SIZE
+		block.outputs[1][i] = y
+	end
+end
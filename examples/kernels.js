@@ -0,0 +1,32 @@
+// Filtered sawtooth example, demonstrating native DSP kernels
+// Each kernel processes a whole buffer in C++, so only the control logic runs in JavaScript.
+
+config.frameDivider = 1
+config.bufferSize = 64
+
+let saw = new Kernel("saw")
+let filter = new Kernel("svf")
+let drive = new Kernel("tanh")
+let smoother = new Kernel("onepole")
+
+let cutoff = new Float32Array(1)
+
+function process(block) {
+	// Knob 1 sets the pitch from -5 to 5 octaves, plus 1V/oct at input 1
+	let pitch = block.knobs[0] * 10 - 5 + block.inputs[0][0]
+	saw.set(261.6256 * Math.pow(2, pitch) * block.sampleTime)
+
+	// Knob 2 sets the cutoff, smoothed once per block to avoid zipper noise
+	cutoff[0] = Math.pow(2, block.knobs[1] * 10 - 10)
+	smoother.set(100 * block.sampleTime * block.bufferSize)
+	smoother.process(cutoff, cutoff)
+	// Knob 3 sets the resonance
+	filter.set(cutoff[0] * 0.5, 0.5 + block.knobs[2] * 10, 0)
+
+	let out = block.outputs[0]
+	saw.process(null, out)
+	filter.process(out, out)
+	drive.process(out, out)
+	for (let i = 0; i < block.bufferSize; i++)
+		out[i] *= 5
+}
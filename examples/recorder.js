@@ -0,0 +1,39 @@
+// Disk recorder example, demonstrating Recorder and Player
+// Switch 1 records input 1 to "take.wav" next to this script.
+// Switch 2 plays the last take to output 1, looping.
+
+config.frameDivider = 1
+config.bufferSize = 64
+
+let recorder = null
+let player = null
+
+function process(block) {
+	if (block.switches[0] && !recorder) {
+		if (player) {
+			player.close()
+			player = null
+		}
+		recorder = new Recorder("take.wav")
+	}
+	else if (!block.switches[0] && recorder) {
+		recorder.close()
+		recorder = null
+	}
+	if (recorder)
+		recorder.write(block.inputs[0], block.bufferSize)
+
+	if (block.switches[1] && !player && !recorder)
+		player = new Player("take.wav", 1, true)
+	else if (!block.switches[1] && player) {
+		player.close()
+		player = null
+	}
+	if (player)
+		player.read(block.outputs[0], block.bufferSize)
+	else
+		block.outputs[0].fill(0)
+
+	block.switchLights[0][0] = recorder ? 1 : 0
+	block.switchLights[1][1] = player ? 1 : 0
+}
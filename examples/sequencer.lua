@@ -0,0 +1,33 @@
+-- Sequencer example, demonstrating scheduled callbacks and coroutines
+-- Output 1 plays a trigger pattern. Knob 1 sets the tempo.
+-- Lights blink on every beat without any process() function.
+
+config.frameDivider = 1
+config.bufferSize = 64
+
+pattern = {1, 0, 1, 1, 0, 1, 0, 0}
+
+-- A coroutine is resumed by the host after each wait(), so no samples are counted here
+spawn(function(block, offset)
+	local step = 1
+	while true do
+		if pattern[step] == 1 then
+			local n = block.outputEventCounts[1] + 1
+			block.outputEventOffsets[1][n] = offset
+			block.outputEventTypes[1][n] = 2
+			block.outputEventCounts[1] = n
+		end
+		step = step % #pattern + 1
+
+		-- 60 to 240 BPM in 16th notes
+		local bpm = 60 + 180 * block.knobs[1]
+		block, offset = wait(block.sampleRate * 15 / bpm)
+	end
+end)
+
+-- Blink light 1 every half second
+on = false
+scheduleEvery(22050, function(block, offset)
+	on = not on
+	block.lights[1][2] = on and 1 or 0
+end)
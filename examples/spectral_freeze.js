@@ -0,0 +1,36 @@
+// Spectral freeze example, demonstrating spectral mode
+// Input 1 is analyzed with a 2048-point FFT. Hold switch 1 to freeze its spectrum.
+// Knob 1 sets a spectral gate threshold.
+
+config.frameDivider = 1
+config.fftSize = 2048
+config.hopSize = 512
+config.spectral = 2 // magnitude/phase
+
+let frozen = new Float32Array(2050)
+let phases = new Float32Array(1025)
+
+function process(block) {
+	let input = block.inputs[0]
+	let output = block.outputs[0]
+	let bins = block.bufferSize / 2
+	let threshold = Math.pow(block.knobs[0], 4) * 100
+
+	if (!block.switches[0])
+		frozen.set(input)
+
+	for (let k = 0; k < bins; k++) {
+		let mag = frozen[2 * k]
+		output[2 * k] = (mag >= threshold) ? mag : 0
+		if (block.switches[0]) {
+			// Advance each bin's phase by its center frequency to keep the frozen sound moving
+			phases[k] += 2 * Math.PI * k * 512 / 2048
+			output[2 * k + 1] = phases[k]
+		}
+		else {
+			phases[k] = input[2 * k + 1]
+			output[2 * k + 1] = phases[k]
+		}
+	}
+	block.lights[0][2] = block.switches[0] ? 1 : 0
+}
@@ -0,0 +1,242 @@
+#include "Batch.hpp"
+
+
+using namespace rack;
+
+
+/** Groups by script, including those that are full, which are kept alive by their members */
+static std::mutex registryMutex;
+static std::multimap<std::string, std::weak_ptr<BatchGroup>> registry;
+
+
+BatchGroup::BatchGroup() {
+	pending = new ProcessBlock;
+	results = new ProcessBlock;
+}
+
+BatchGroup::~BatchGroup() {
+	delete engine;
+	delete pending;
+	delete results;
+}
+
+int BatchGroup::addMember(Prototype* module) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int slot = 0; slot < capacity; slot++) {
+		if (slot == (int) members.size()) {
+			members.push_back(NULL);
+			ready.push_back(false);
+		}
+		if (!members[slot]) {
+			members[slot] = module;
+			ready[slot] = false;
+			return slot;
+		}
+	}
+	return -1;
+}
+
+void BatchGroup::removeMember(int slot) {
+	std::unique_lock<std::mutex> lock(mutex);
+	// The engine may refer to the module while it runs
+	idle.wait(lock, [&]() {return !running;});
+	Prototype* module = members[slot];
+	members[slot] = NULL;
+	ready[slot] = false;
+	// Free slots are processed with silent inputs
+	int n = bufferSize;
+	for (int i = 0; i < NUM_ROWS; i++) {
+		std::memset(&pending->inputs[i][slot * n], 0, sizeof(float) * n);
+		std::memset(&pending->knobBuffers[i][slot * n], 0, sizeof(float) * n);
+		std::memset(&pending->switchBuffers[i][slot * n], 0, sizeof(bool) * n);
+		pending->batchKnobs[i][slot] = 0.f;
+		pending->batchSwitches[i][slot] = false;
+		pendingEventCounts[i][slot] = 0;
+		resultEventCounts[i][slot] = 0;
+	}
+	if (engine->module == module) {
+		for (Prototype* member : members) {
+			if (member) {
+				engine->module = member;
+				break;
+			}
+		}
+	}
+}
+
+void BatchGroup::process(int slot, ProcessBlock* block) {
+	std::unique_lock<std::mutex> lock(mutex);
+	int n = bufferSize;
+	// A module that reaches its next block before the others completes the batch without them.
+	// If the batch is already running, its previous block is replaced.
+	if (!failed && ready[slot] && !running)
+		run(lock, block);
+	if (failed) {
+		for (int i = 0; i < NUM_ROWS; i++) {
+			std::memset(block->outputs[i], 0, sizeof(float) * n);
+			std::memset(block->lights[i], 0, sizeof(block->lights[i]));
+			std::memset(block->switchLights[i], 0, sizeof(block->switchLights[i]));
+		}
+		return;
+	}
+
+	for (int i = 0; i < NUM_ROWS; i++) {
+		std::memcpy(block->outputs[i], &results->outputs[i][slot * n], sizeof(float) * n);
+		std::memcpy(block->lights[i], &results->batchLights[i][slot * 3], sizeof(float) * 3);
+		std::memcpy(block->switchLights[i], &results->batchSwitchLights[i][slot * 3], sizeof(float) * 3);
+		// Each event is rendered once, even if the module receives the same results again
+		int outputCount = resultEventCounts[i][slot];
+		resultEventCounts[i][slot] = 0;
+		block->outputEventCounts[i] = outputCount;
+		std::memcpy(block->outputEventOffsets[i], &results->outputEventOffsets[i][slot * n], sizeof(int) * outputCount);
+		std::memcpy(block->outputEventTypes[i], &results->outputEventTypes[i][slot * n], sizeof(uint8_t) * outputCount);
+
+		std::memcpy(&pending->inputs[i][slot * n], block->inputs[i], sizeof(float) * n);
+		std::memcpy(&pending->knobBuffers[i][slot * n], block->knobBuffers[i], sizeof(float) * n);
+		std::memcpy(&pending->switchBuffers[i][slot * n], block->switchBuffers[i], sizeof(bool) * n);
+		pending->batchKnobs[i][slot] = block->knobs[i];
+		pending->batchSwitches[i][slot] = block->switches[i];
+		pending->rowBufferSizes[i] = block->rowBufferSizes[i];
+		int inputCount = clamp(block->inputEventCounts[i], 0, n);
+		pendingEventCounts[i][slot] = inputCount;
+		std::memcpy(&pending->inputEventOffsets[i][slot * n], block->inputEventOffsets[i], sizeof(int) * inputCount);
+		std::memcpy(&pending->inputEventTypes[i][slot * n], block->inputEventTypes[i], sizeof(uint8_t) * inputCount);
+	}
+	ready[slot] = true;
+
+	// The module running the engine runs the batches completed in the meantime when it finishes
+	if (!running && isComplete())
+		run(lock, block);
+}
+
+void BatchGroup::run(std::unique_lock<std::mutex>& lock, const ProcessBlock* block) {
+	ProcessBlock* batch = engine->getProcessBlock();
+	int n = bufferSize;
+	do {
+		// Copy in
+		int batchSize = members.size();
+		int width = batchSize * n;
+		batch->sampleRate = block->sampleRate;
+		batch->sampleTime = block->sampleTime;
+		batch->frame = block->frame;
+		batch->batchSize = batchSize;
+		for (int i = 0; i < NUM_ROWS; i++) {
+			std::memcpy(batch->inputs[i], pending->inputs[i], sizeof(float) * width);
+			std::memcpy(batch->knobBuffers[i], pending->knobBuffers[i], sizeof(float) * width);
+			std::memcpy(batch->switchBuffers[i], pending->switchBuffers[i], sizeof(bool) * width);
+			batch->rowBufferSizes[i] = pending->rowBufferSizes[i];
+			// Instance k's events are offset by k * bufferSize, like its samples
+			int count = 0;
+			for (int k = 0; k < batchSize; k++) {
+				for (int e = 0; e < pendingEventCounts[i][k]; e++) {
+					batch->inputEventOffsets[i][count] = k * n + pending->inputEventOffsets[i][k * n + e];
+					batch->inputEventTypes[i][count] = pending->inputEventTypes[i][k * n + e];
+					count++;
+				}
+				pendingEventCounts[i][k] = 0;
+			}
+			batch->inputEventCounts[i] = count;
+			batch->outputEventCounts[i] = 0;
+		}
+		std::memcpy(batch->batchKnobs, pending->batchKnobs, sizeof(batch->batchKnobs));
+		std::memcpy(batch->batchSwitches, pending->batchSwitches, sizeof(batch->batchSwitches));
+		std::fill(ready.begin(), ready.end(), false);
+
+		running = true;
+		lock.unlock();
+		int err = engine->process();
+		lock.lock();
+		running = false;
+
+		// Copy out
+		for (int i = 0; i < NUM_ROWS; i++) {
+			std::memcpy(results->outputs[i], batch->outputs[i], sizeof(float) * width);
+			// Route each output event to the instance whose part of the row contains its offset
+			for (int k = 0; k < batchSize; k++)
+				resultEventCounts[i][k] = 0;
+			int count = clamp(batch->outputEventCounts[i], 0, width);
+			for (int e = 0; e < count; e++) {
+				int offset = clamp(batch->outputEventOffsets[i][e], 0, width - 1);
+				int k = offset / n;
+				int& c = resultEventCounts[i][k];
+				if (c >= n)
+					continue;
+				results->outputEventOffsets[i][k * n + c] = offset - k * n;
+				results->outputEventTypes[i][k * n + c] = batch->outputEventTypes[i][e];
+				c++;
+			}
+		}
+		std::memcpy(results->batchLights, batch->batchLights, sizeof(results->batchLights));
+		std::memcpy(results->batchSwitchLights, batch->batchSwitchLights, sizeof(results->batchSwitchLights));
+		idle.notify_all();
+
+		if (err) {
+			WARN("Batched script process() failed. Stopped %d instances.", batchSize);
+			failed = true;
+		}
+	} while (!failed && isComplete());
+}
+
+bool BatchGroup::isComplete() {
+	bool any = false;
+	for (int s = 0; s < (int) members.size(); s++) {
+		if (!members[s])
+			continue;
+		if (!ready[s])
+			return false;
+		any = true;
+	}
+	return any;
+}
+
+
+int getBatchCapacity(int bufferSize) {
+	return std::min(MAX_BATCH, MAX_BUFFER_SIZE / bufferSize);
+}
+
+std::shared_ptr<BatchGroup> findBatchGroup(Prototype* module, const std::string& key, int* slot) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	for (auto it = registry.lower_bound(key); it != registry.end() && it->first == key;) {
+		std::shared_ptr<BatchGroup> group = it->second.lock();
+		if (!group) {
+			it = registry.erase(it);
+			continue;
+		}
+		if (!group->failed) {
+			*slot = group->addMember(module);
+			if (*slot >= 0)
+				return group;
+		}
+		++it;
+	}
+	return NULL;
+}
+
+std::shared_ptr<BatchGroup> joinBatchGroup(Prototype* module, const std::string& key, int bufferSize, const std::vector<BatchConfig>& config, const std::function<ScriptEngine*()>& takeEngine, int* slot) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	for (auto it = registry.lower_bound(key); it != registry.end() && it->first == key;) {
+		std::shared_ptr<BatchGroup> group = it->second.lock();
+		if (!group) {
+			it = registry.erase(it);
+			continue;
+		}
+		if (!group->failed && group->bufferSize == bufferSize) {
+			*slot = group->addMember(module);
+			if (*slot >= 0)
+				return group;
+		}
+		++it;
+	}
+
+	std::shared_ptr<BatchGroup> group = std::make_shared<BatchGroup>();
+	group->key = key;
+	group->config = config;
+	group->bufferSize = bufferSize;
+	group->capacity = getBatchCapacity(bufferSize);
+	group->engine = takeEngine();
+	if (!group->engine)
+		return NULL;
+	*slot = group->addMember(module);
+	registry.insert(std::make_pair(key, group));
+	return group;
+}
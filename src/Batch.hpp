@@ -0,0 +1,76 @@
+#pragma once
+#include "ScriptEngine.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+/** A config property set by the script, applied to modules that join a group without running the script */
+struct BatchConfig {
+	std::string name;
+	double value;
+	int index;
+};
+
+
+/** Modules running the same script with config.batch enabled, processed by one shared engine.
+Each module exchanges its block with the group when it reaches the end of a block.
+It receives the outputs that the shared engine computed from its previous block, so batching adds one block of latency.
+The engine runs when every module has contributed a block, on the thread of the module that completes the batch.
+Modules only copy their blocks in and out with `mutex` locked. The engine runs on its own block without the lock, so other modules never wait for it.
+*/
+struct BatchGroup {
+	std::string key;
+	/** Runs on a block of its own, owned through ScriptEngine::workerBlock */
+	ScriptEngine* engine = NULL;
+	/** Config set by the script when the group was created */
+	std::vector<BatchConfig> config;
+	/** Module of each instance, or NULL for free slots */
+	std::vector<Prototype*> members;
+	/** Whether each instance has contributed its block to the next batch */
+	std::vector<bool> ready;
+	/** Number of instances whose rows fit in a ProcessBlock */
+	int capacity = 0;
+	/** Sample frames of each instance's block */
+	int bufferSize = 1;
+	/** Set if the engine's process() fails, after which every instance outputs silence */
+	bool failed = false;
+	/** Set while the engine processes a batch without the lock */
+	bool running = false;
+	/** Blocks contributed to the next batch, with each instance's events at the start of its part of each row */
+	ProcessBlock* pending = NULL;
+	/** Results of the last batch, with each instance's output events at the start of its part of each row */
+	ProcessBlock* results = NULL;
+	int pendingEventCounts[NUM_ROWS][MAX_BATCH] = {};
+	int resultEventCounts[NUM_ROWS][MAX_BATCH] = {};
+	std::mutex mutex;
+	/** Notified when the engine finishes a batch */
+	std::condition_variable idle;
+
+	BatchGroup();
+	~BatchGroup();
+	/** Returns a free slot for `module`, or -1 if the group is full. Call with the registry locked. */
+	int addMember(Prototype* module);
+	/** Frees a slot, waiting for a running batch to finish. If the engine refers to the module, it is handed to another member. */
+	void removeMember(int slot);
+	/** Replaces the outputs, lights, and output events of `block` with the instance's results of the last batch, and contributes its inputs, knobs, switches, knob buffers, and input events to the next one. */
+	void process(int slot, ProcessBlock* block);
+	/** Runs the engine on the contributed blocks until no batch is complete. Call with `lock` holding `mutex`, which is released while the engine runs. */
+	void run(std::unique_lock<std::mutex>& lock, const ProcessBlock* block);
+	/** Returns whether every member has contributed its block. Call with `mutex` locked. */
+	bool isComplete();
+};
+
+
+/** Returns the number of instances of `bufferSize` frames that fit in a ProcessBlock. */
+int getBatchCapacity(int bufferSize);
+/** Returns a group for the script identified by `key` with a free slot for `module`, and sets `slot`.
+If no group has room, a new one is created with the engine returned by `takeEngine`.
+That engine must have run the script on a block with a batchSize of getBatchCapacity(bufferSize), which it owns through ScriptEngine::workerBlock.
+The new group applies `config` to the modules that later join it with findBatchGroup().
+*/
+std::shared_ptr<BatchGroup> joinBatchGroup(Prototype* module, const std::string& key, int bufferSize, const std::vector<BatchConfig>& config, const std::function<ScriptEngine*()>& takeEngine, int* slot);
+/** Returns an existing group for the script identified by `key` with a free slot for `module`, and sets `slot`, or NULL.
+The module can then apply the group's config instead of running the script.
+*/
+std::shared_ptr<BatchGroup> findBatchGroup(Prototype* module, const std::string& key, int* slot);
@@ -0,0 +1,78 @@
+#include "Buffers.hpp"
+#if defined ARCH_WIN
+	#include <malloc.h>
+#endif
+
+
+using namespace rack;
+
+
+PooledBuffer::PooledBuffer(size_t size) {
+	this->size = size;
+	size_t bytes = sizeof(float) * size;
+	// Round up so neighbouring allocations never share a cache line
+	bytes = (bytes + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT;
+#if defined ARCH_WIN
+	data = (float*) _aligned_malloc(bytes, BUFFER_ALIGNMENT);
+#else
+	void* ptr = NULL;
+	if (posix_memalign(&ptr, BUFFER_ALIGNMENT, bytes) == 0)
+		data = (float*) ptr;
+#endif
+	if (data)
+		std::memset(data, 0, bytes);
+	else
+		this->size = 0;
+}
+
+PooledBuffer::~PooledBuffer() {
+#if defined ARCH_WIN
+	_aligned_free(data);
+#else
+	std::free(data);
+#endif
+}
+
+
+std::shared_ptr<PooledBuffer> BufferPool::get(const std::string& name, size_t size) {
+	if (size == 0)
+		return NULL;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = buffers.find(name);
+	if (it != buffers.end()) {
+		if (it->second->size == size) {
+			it->second->claimed = true;
+			return it->second;
+		}
+		totalSize -= it->second->size;
+		buffers.erase(it);
+	}
+	if (totalSize + size > MAX_POOL_SIZE)
+		return NULL;
+
+	std::shared_ptr<PooledBuffer> buffer = std::make_shared<PooledBuffer>(size);
+	if (buffer->size != size)
+		return NULL;
+	buffer->claimed = true;
+	buffers[name] = buffer;
+	totalSize += size;
+	return buffer;
+}
+
+void BufferPool::unclaim() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& pair : buffers)
+		pair.second->claimed = false;
+}
+
+void BufferPool::releaseUnclaimed() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto it = buffers.begin(); it != buffers.end();) {
+		if (it->second->claimed) {
+			++it;
+			continue;
+		}
+		totalSize -= it->second->size;
+		it = buffers.erase(it);
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <rack.hpp>
+#include <mutex>
+
+
+/** Alignment of pooled buffers, the cache line size of current x86 and ARM CPUs */
+static const size_t BUFFER_ALIGNMENT = 64;
+/** Limit on the total size of a module's pooled buffers, in floats (256 MB) */
+static const size_t MAX_POOL_SIZE = 1 << 26;
+
+
+/** A zeroed, cache-aligned float array owned by a BufferPool.
+Engines that expose it to objects which may outlive the script, such as numpy views, hold a shared_ptr to it.
+*/
+struct PooledBuffer {
+	float* data = NULL;
+	size_t size = 0;
+	/** Whether the running script has requested the buffer */
+	bool claimed = false;
+
+	PooledBuffer(size_t size);
+	~PooledBuffer();
+};
+
+
+/** Named buffers of a Prototype module, kept across script reloads.
+A reloaded script that requests a buffer with the same name and size gets the same memory, so delay lines and tables keep their contents.
+Buffers that the new script does not request are released once it has run.
+Worker engines may request buffers from their own threads, so the pool is locked.
+*/
+struct BufferPool {
+	std::map<std::string, std::shared_ptr<PooledBuffer>> buffers;
+	size_t totalSize = 0;
+	std::mutex mutex;
+
+	/** Returns the buffer named `name`, allocating it if it does not exist or has a different size.
+	Returns NULL if `size` is 0 or the pool would exceed MAX_POOL_SIZE.
+	*/
+	std::shared_ptr<PooledBuffer> get(const std::string& name, size_t size);
+	/** Marks every buffer as unclaimed before a script runs. */
+	void unclaim();
+	/** Releases buffers that were not requested since unclaim(). */
+	void releaseUnclaimed();
+};
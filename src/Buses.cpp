@@ -0,0 +1,81 @@
+#include "Buses.hpp"
+#include <mutex>
+
+
+using namespace rack;
+
+
+/** Buses are kept alive by their ports, so a bus and its contents are released once no script uses it */
+static std::mutex registryMutex;
+static std::map<std::string, std::weak_ptr<Bus>> registry;
+
+
+BusPort::~BusPort() {
+	if (publishing)
+		bus->hasPublisher = false;
+}
+
+void BusPort::start() {
+	int64_t published = bus->published.load(std::memory_order_acquire);
+	if (publishing) {
+		slot = published % BUS_SLOTS;
+		return;
+	}
+	// Before the publisher's first blocks, negative blocks map to slots that are still zeroed
+	int64_t block = published - 1 - delay;
+	slot = ((block % BUS_SLOTS) + BUS_SLOTS) % BUS_SLOTS;
+}
+
+void BusPort::publish() {
+	if (!publishing)
+		return;
+	// Only the publisher writes the counter, so a load and store are enough
+	int64_t published = bus->published.load(std::memory_order_relaxed);
+	bus->published.store(published + 1, std::memory_order_release);
+}
+
+int BusPort::getOffset(int channel) {
+	if (channel < 0 || channel >= bus->channels)
+		return -1;
+	return bus->getOffset(slot, channel);
+}
+
+
+BusPort* openBus(const std::string& name, int channels, int frames, bool publishing, int delay, std::string* error) {
+	if (channels < 1 || channels > MAX_BUS_CHANNELS) {
+		*error = string::f("Bus %s must have 1 to %d channels", name.c_str(), MAX_BUS_CHANNELS);
+		return NULL;
+	}
+
+	std::shared_ptr<Bus> bus;
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		auto it = registry.find(name);
+		if (it != registry.end())
+			bus = it->second.lock();
+		if (!bus) {
+			bus = std::make_shared<Bus>(name, channels, frames);
+			if (!bus->memory.data) {
+				*error = string::f("Could not allocate bus %s", name.c_str());
+				return NULL;
+			}
+			registry[name] = bus;
+		}
+	}
+
+	if (bus->channels != channels || bus->frames != frames) {
+		*error = string::f("Bus %s has %d channels of %d frames", name.c_str(), bus->channels, bus->frames);
+		return NULL;
+	}
+	if (publishing && bus->hasPublisher.exchange(true)) {
+		*error = string::f("Bus %s already has a publisher", name.c_str());
+		return NULL;
+	}
+
+	BusPort* port = new BusPort;
+	port->bus = bus;
+	port->publishing = publishing;
+	port->delay = clamp(delay, 0, MAX_BUS_DELAY);
+	port->start();
+	return port;
+}
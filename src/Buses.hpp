@@ -0,0 +1,56 @@
+#pragma once
+#include <rack.hpp>
+#include "Buffers.hpp"
+
+
+/** Number of blocks in a bus's ring.
+The publisher writes one slot while subscribers read one of the two before it, which leaves a spare slot for a publisher that runs one block ahead of a subscriber on another thread.
+*/
+static const int BUS_SLOTS = 4;
+static const int MAX_BUS_CHANNELS = 64;
+/** Largest `delay` a subscriber can request without reading the slot being written */
+static const int MAX_BUS_DELAY = 1;
+
+
+/** A named multi-channel signal shared by every module in the process, published one block at a time by a single module and read in place by any number of modules.
+*/
+struct Bus {
+	std::string name;
+	int channels = 0;
+	/** Sample frames per block */
+	int frames = 0;
+	/** BUS_SLOTS blocks of `channels * frames` samples. Channel `c` of slot `s` starts at `(s * channels + c) * frames`. */
+	PooledBuffer memory;
+	/** Number of blocks published. Block `n` is in slot `n % BUS_SLOTS`. */
+	std::atomic<int64_t> published{0};
+	std::atomic<bool> hasPublisher{false};
+
+	Bus(const std::string& name, int channels, int frames) : name(name), channels(channels), frames(frames), memory(BUS_SLOTS * channels * frames) {}
+	int getOffset(int slot, int channel) {
+		return (slot * channels + channel) * frames;
+	}
+};
+
+
+/** An engine's connection to a bus, either as its publisher or as a subscriber.
+The host calls start() before each block and publish() after it, so a script sees one fixed slot for the whole block.
+*/
+struct BusPort {
+	std::shared_ptr<Bus> bus;
+	bool publishing = false;
+	int delay = 0;
+	/** Slot that the script writes or reads during the current block */
+	int slot = 0;
+
+	~BusPort();
+	void start();
+	void publish();
+	/** Returns the index of the first sample of `channel` in the current slot, or -1 if `channel` is invalid. */
+	int getOffset(int channel);
+};
+
+
+/** Connects to the bus named `name`, creating it with `channels` channels of `frames` sample frames if it does not exist.
+Returns NULL with `error` set if the bus exists with a different shape or already has a publisher.
+*/
+BusPort* openBus(const std::string& name, int channels, int frames, bool publishing, int delay, std::string* error);
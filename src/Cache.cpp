@@ -0,0 +1,52 @@
+#include "Cache.hpp"
+#include <sys/stat.h>
+#include <utime.h>
+
+
+using namespace rack;
+
+
+std::string getCacheDir() {
+	return asset::user("VCV-Prototype-cache");
+}
+
+
+void touchCacheFile(const std::string& path) {
+	// Sets the modification time to now
+	utime(path.c_str(), NULL);
+}
+
+
+void trimCache() {
+	struct CacheFile {
+		std::string path;
+		int64_t size;
+		time_t time;
+	};
+	std::vector<CacheFile> files;
+	int64_t totalSize = 0;
+	for (const std::string& path : system::getEntries(getCacheDir())) {
+		// Files being written by another thread or process
+		if (string::endsWith(path, ".tmp"))
+			continue;
+		struct stat st;
+		if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+			continue;
+		files.push_back({path, (int64_t) st.st_size, st.st_mtime});
+		totalSize += st.st_size;
+	}
+	if (totalSize <= MAX_CACHE_SIZE)
+		return;
+
+	std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) {
+		return a.time < b.time;
+	});
+	for (const CacheFile& file : files) {
+		if (totalSize <= MAX_CACHE_SIZE)
+			break;
+		if (std::remove(file.path.c_str()) == 0) {
+			INFO("Removed %s from the cache", file.path.c_str());
+			totalSize -= file.size;
+		}
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <rack.hpp>
+
+
+/** Limit on the total size of the cache folder in bytes (2 GB) */
+static const int64_t MAX_CACHE_SIZE = (int64_t) 2 << 30;
+
+
+/** Returns the folder in the Rack user folder holding files cached between sessions, such as decoded samples and compiled Vult scripts. */
+std::string getCacheDir();
+/** Marks a cache file as used, so trimCache() removes it after files that have not been used for longer. */
+void touchCacheFile(const std::string& path);
+/** Removes the least recently used files from the cache folder until it is smaller than MAX_CACHE_SIZE.
+Call it after writing a cache file, from a background thread.
+On Linux and Mac, files mapped by running modules stay readable after they are removed.
+*/
+void trimCache();
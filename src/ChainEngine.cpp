@@ -0,0 +1,170 @@
+#include "ScriptEngine.hpp"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+
+ScriptEngine* createScriptEngine(std::string extension);
+
+
+/* The chain engine runs a list of scripts, possibly in different engines, back to back on the module's block.
+ *
+ * A .chain file lists one script path per line, relative to the chain file.
+ * Blank lines and lines starting with # are ignored.
+ * Each stage sees the knobs, lights, and outputs written by the stages before it.
+ * All stages share the module's block, so a chain is rejected if its stages set different frameDivider or bufferSize values.
+ */
+
+struct ChainEngine : ScriptEngine {
+	struct Stage {
+		std::string name;
+		ScriptEngine* engine = NULL;
+		/** Smoothed duration of process() in seconds, read by the UI thread */
+		float processTime = 0.f;
+	};
+	std::vector<Stage> stages;
+	/** The value of each block setting and the index of the stage that set it */
+	std::map<std::string, std::pair<int, int>> blockConfig;
+	/** Set by checkBlockConfig() when a stage disagrees with an earlier one */
+	std::string blockConfigError;
+
+	~ChainEngine() {
+		for (Stage& stage : stages)
+			delete stage.engine;
+	}
+
+	std::string getEngineName() override {
+		return "Chain";
+	}
+
+	int run(const std::string& path, const std::string& script) override {
+		if (workerBlock) {
+			display("Chains cannot run as workers or batches");
+			return -1;
+		}
+
+		std::istringstream lines(script);
+		std::string line;
+		while (std::getline(lines, line)) {
+			line = rack::string::trim(line);
+			if (line == "" || line[0] == '#')
+				continue;
+
+			std::string stagePath = resolvePath(line);
+			std::string stageScript;
+			try {
+				std::ifstream file;
+				file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+				file.open(stagePath);
+				std::stringstream buffer;
+				buffer << file.rdbuf();
+				stageScript = buffer.str();
+			}
+			catch (const std::runtime_error& err) {
+				display(rack::string::f("Could not read stage %s", line.c_str()));
+				return -1;
+			}
+
+			std::string extension = rack::string::filenameExtension(rack::string::filename(stagePath));
+			if (extension == "chain") {
+				display("Chains cannot contain chains");
+				return -1;
+			}
+			Stage stage;
+			stage.name = rack::string::filename(stagePath);
+			stage.engine = createScriptEngine(extension);
+			if (!stage.engine) {
+				display(rack::string::f("No engine for .%s extension", extension.c_str()));
+				return -1;
+			}
+			stage.engine->module = module;
+			stage.engine->parent = this;
+			// Added before running so the stage is deleted with the chain if it fails
+			stages.push_back(stage);
+			if (stage.engine->run(stagePath, stageScript))
+				return -1;
+			if (!blockConfigError.empty()) {
+				display(blockConfigError);
+				return -1;
+			}
+		}
+
+		if (stages.empty()) {
+			display("Chain has no stages");
+			return -1;
+		}
+		return 0;
+	}
+
+	int process() override {
+		for (Stage& stage : stages) {
+			auto start = std::chrono::steady_clock::now();
+			if (stage.engine->process())
+				return -1;
+			// Engines such as SuperCollider set their block size on their first block
+			if (!blockConfigError.empty()) {
+				display(blockConfigError);
+				return -1;
+			}
+			std::chrono::duration<float> duration = std::chrono::steady_clock::now() - start;
+			// Smooth over about 100 blocks
+			stage.processTime += (duration.count() - stage.processTime) * 0.01f;
+		}
+		return 0;
+	}
+
+	int processControl() override {
+		for (Stage& stage : stages) {
+			if (stage.engine->processControl())
+				return -1;
+		}
+		return 0;
+	}
+
+	int getBlockLatency() override {
+		// Each stage processes the delayed outputs of the stages before it
+		int latency = 0;
+		for (Stage& stage : stages)
+			latency += stage.engine->getBlockLatency();
+		return latency;
+	}
+
+	void startBuses() override {
+		for (Stage& stage : stages)
+			stage.engine->startBuses();
+	}
+
+	void publishBuses() override {
+		for (Stage& stage : stages)
+			stage.engine->publishBuses();
+	}
+
+	bool checkBlockConfig(ScriptEngine* engine, const std::string& name, int value) override {
+		int index = 0;
+		while (index < (int) stages.size() && stages[index].engine != engine)
+			index++;
+		auto it = blockConfig.find(name);
+		if (it != blockConfig.end() && it->second.second != index && it->second.first != value) {
+			const Stage& other = stages[it->second.second];
+			blockConfigError = rack::string::f("Stage %s sets %s %d, but stage %s sets %d", stages[index].name.c_str(), name.c_str(), value, other.name.c_str(), it->second.first);
+			return false;
+		}
+		blockConfig[name] = std::make_pair(value, index);
+		return true;
+	}
+
+	std::vector<std::string> getStats() override {
+		std::vector<std::string> stats;
+		for (size_t i = 0; i < stages.size(); i++) {
+			const Stage& stage = stages[i];
+			stats.push_back(rack::string::f("Stage %d: %s (%s), %.3f ms per block", (int) i + 1, stage.name.c_str(), stage.engine->getEngineName().c_str(), stage.processTime * 1e3f));
+		}
+		return stats;
+	}
+};
+
+
+__attribute__((constructor(1000)))
+static void constructor() {
+	addScriptEngine<ChainEngine>("chain");
+}
@@ -0,0 +1,328 @@
+#include "Convolver.hpp"
+#include "Samples.hpp"
+#include "Wav.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+using namespace rack;
+
+
+// Passed by reference to std::min(), so the helper executable needs their definitions
+const int ConvolverKernel::HEAD_PARTITIONS;
+const int ConvolverKernel::MAX_IR_LENGTH;
+
+
+/** An impulse response's partition spectra, with the input spectra and tail sums convolved with it */
+struct ConvolverState {
+	int numPartitions;
+	/** Spectra of the impulse response partitions, in pffft's unordered format */
+	float* irSpectra;
+	/** Ring buffer of input spectra.
+	Long enough that process() does not overwrite spectra the worker still reads while it is up to HEAD_PARTITIONS blocks behind.
+	*/
+	int fdlLength;
+	float* fdl;
+	/** Ring buffer of tail sums, indexed by the block they are added to */
+	float* tails;
+	/** Number of input spectra written to fdl */
+	std::atomic<int64_t> blocks{0};
+	/** Index of the last block whose tail sum is ready, plus one */
+	std::atomic<int64_t> tailBlocks{0};
+	/** Number of blocks processed without their tail sum because the worker was late */
+	std::atomic<int64_t> lateTails{0};
+
+	ConvolverState(int numPartitions) {
+		const int size = ConvolverKernel::FFT_SIZE;
+		this->numPartitions = numPartitions;
+		fdlLength = numPartitions + ConvolverKernel::HEAD_PARTITIONS;
+		irSpectra = (float*) pffft_aligned_malloc(sizeof(float) * size * numPartitions);
+		fdl = (float*) pffft_aligned_malloc(sizeof(float) * size * fdlLength);
+		tails = (float*) pffft_aligned_malloc(sizeof(float) * size * ConvolverKernel::HEAD_PARTITIONS);
+		std::memset(fdl, 0, sizeof(float) * size * fdlLength);
+		std::memset(tails, 0, sizeof(float) * size * ConvolverKernel::HEAD_PARTITIONS);
+		// Blocks before the first have no tail
+		tailBlocks = ConvolverKernel::HEAD_PARTITIONS;
+	}
+	~ConvolverState() {
+		pffft_aligned_free(irSpectra);
+		pffft_aligned_free(fdl);
+		pffft_aligned_free(tails);
+	}
+	float* getInput(int64_t block) {
+		return &fdl[(block % fdlLength) * ConvolverKernel::FFT_SIZE];
+	}
+	float* getTail(int64_t block) {
+		return &tails[(block % ConvolverKernel::HEAD_PARTITIONS) * ConvolverKernel::FFT_SIZE];
+	}
+};
+
+
+/** A kernel's impulse responses, handed between the loader thread, the audio thread, and the worker */
+struct ConvolverChannel {
+	std::atomic<ConvolverState*> active{NULL};
+	/** Prepared by the loader thread, waiting for process() to swap it in */
+	std::atomic<ConvolverState*> pending{NULL};
+	/** Swapped out by process(), waiting for the worker to delete it */
+	std::atomic<ConvolverState*> retired{NULL};
+	/** Total late tails reported in the log */
+	int64_t reportedLateTails = 0;
+
+	~ConvolverChannel() {
+		delete active.load();
+		delete pending.load();
+		delete retired.load();
+	}
+};
+
+
+/** Computes the tail sums of every convolver on one thread */
+struct ConvolverWorker {
+	std::mutex mutex;
+	std::condition_variable cv;
+	/** Incremented by each notification */
+	std::atomic<int64_t> requests{0};
+	bool running = true;
+	/** Channels of new kernels, guarded by mutex */
+	std::vector<std::shared_ptr<ConvolverChannel>> added;
+	/** Used only by the worker thread */
+	std::vector<std::shared_ptr<ConvolverChannel>> channels;
+	dsp::RealFFT fft;
+	std::thread thread;
+
+	ConvolverWorker() : fft(ConvolverKernel::FFT_SIZE) {
+		thread = std::thread([this]() {
+			system::setThreadName("Prototype Convolver");
+			run();
+		});
+	}
+
+	~ConvolverWorker() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		cv.notify_one();
+		thread.join();
+	}
+
+	void add(std::shared_ptr<ConvolverChannel> channel) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			added.push_back(channel);
+		}
+		cv.notify_one();
+	}
+
+	/** Wakes the worker without locking, so it can be called on the audio thread.
+	A wakeup sent while the worker is about to wait is missed, and the worker catches up at the next partition's notification, well within the HEAD_PARTITIONS deadline.
+	*/
+	void notify() {
+		requests.fetch_add(1, std::memory_order_release);
+		cv.notify_one();
+	}
+
+	void run() {
+		int64_t seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&]() {
+					return !running || requests.load(std::memory_order_acquire) != seen || !added.empty();
+				});
+				if (!running)
+					return;
+				seen = requests.load(std::memory_order_acquire);
+				channels.insert(channels.end(), added.begin(), added.end());
+				added.clear();
+			}
+
+			for (auto it = channels.begin(); it != channels.end();) {
+				// The kernel has been destroyed, so free its impulse responses here instead of on the audio thread
+				if (it->use_count() == 1) {
+					it = channels.erase(it);
+					continue;
+				}
+				processChannel(it->get());
+				++it;
+			}
+		}
+	}
+
+	void processChannel(ConvolverChannel* channel) {
+		// Free the state swapped out by process(), which this thread is no longer reading
+		delete channel->retired.exchange(NULL);
+
+		ConvolverState* state = channel->active.load();
+		if (!state || state->numPartitions <= ConvolverKernel::HEAD_PARTITIONS)
+			return;
+
+		// Compute tail sums as soon as their inputs are available
+		while (true) {
+			int64_t target = state->tailBlocks.load(std::memory_order_relaxed);
+			int64_t blocks = state->blocks.load(std::memory_order_acquire);
+			// Skip tail sums of blocks that process() has already output without them
+			if (blocks > target) {
+				state->tailBlocks.store(blocks, std::memory_order_release);
+				continue;
+			}
+			if (blocks <= target - ConvolverKernel::HEAD_PARTITIONS)
+				break;
+			computeTail(state, target);
+			state->tailBlocks.store(target + 1, std::memory_order_release);
+		}
+
+		int64_t lateTails = state->lateTails.load(std::memory_order_relaxed);
+		if (lateTails > channel->reportedLateTails) {
+			WARN("Convolver dropped %lld late tail sums", (long long) (lateTails - channel->reportedLateTails));
+			channel->reportedLateTails = lateTails;
+		}
+	}
+
+	void computeTail(ConvolverState* state, int64_t target) {
+		float* tail = state->getTail(target);
+		std::memset(tail, 0, sizeof(float) * ConvolverKernel::FFT_SIZE);
+		for (int p = ConvolverKernel::HEAD_PARTITIONS; p < state->numPartitions && p <= target; p++) {
+			pffft_zconvolve_accumulate(fft.setup, state->getInput(target - p), &state->irSpectra[p * ConvolverKernel::FFT_SIZE], tail, 1.f / ConvolverKernel::FFT_SIZE);
+		}
+	}
+};
+
+
+static ConvolverWorker& getConvolverWorker() {
+	static ConvolverWorker worker;
+	return worker;
+}
+
+
+/** Called on the loader thread. */
+static ConvolverState* prepareState(const std::vector<float>& ir) {
+	const int size = ConvolverKernel::FFT_SIZE;
+	int length = std::min((int) ir.size(), ConvolverKernel::MAX_IR_LENGTH);
+	int numPartitions = (length + ConvolverKernel::PARTITION_SIZE - 1) / ConvolverKernel::PARTITION_SIZE;
+	ConvolverState* state = new ConvolverState(numPartitions);
+	dsp::RealFFT fft(size);
+	alignas(16) float frame[size];
+	for (int p = 0; p < numPartitions; p++) {
+		// Zero-pad each partition to the FFT size
+		std::memset(frame, 0, sizeof(frame));
+		int start = p * ConvolverKernel::PARTITION_SIZE;
+		int partitionSize = std::min((int) ConvolverKernel::PARTITION_SIZE, length - start);
+		std::memcpy(frame, &ir[start], sizeof(float) * partitionSize);
+		fft.rfftUnordered(frame, &state->irSpectra[p * size]);
+	}
+	return state;
+}
+
+
+/** Called on the loader thread. */
+static void loadState(ConvolverChannel* channel, const std::vector<float>& ir) {
+	if (!ir.empty())
+		delete channel->pending.exchange(prepareState(ir));
+}
+
+
+ConvolverKernel::ConvolverKernel() : fft(FFT_SIZE) {
+	channel = std::make_shared<ConvolverChannel>();
+	getConvolverWorker().add(channel);
+}
+
+ConvolverKernel::~ConvolverKernel() {
+	channel = NULL;
+	getConvolverWorker().notify();
+}
+
+void ConvolverKernel::setParams(const float* params, int numParams) {
+	if (numParams >= 1)
+		wet = params[0];
+	if (numParams >= 2)
+		dry = params[1];
+}
+
+void ConvolverKernel::load(const float* data, int size) {
+	std::shared_ptr<ConvolverChannel> channel = this->channel;
+	std::vector<float> ir(data, data + std::max(size, 0));
+	runAfterSamples([channel, ir]() {
+		loadState(channel.get(), ir);
+	});
+}
+
+void ConvolverKernel::loadFile(const std::string& path, float sampleRate) {
+	std::shared_ptr<ConvolverChannel> channel = this->channel;
+	runAfterSamples([channel, path, sampleRate]() {
+		AudioData audio;
+		if (!loadWav(path, &audio) || audio.frames <= 0)
+			return;
+		// Mix to mono and resample linearly to the script's sample rate
+		float ratio = audio.sampleRate / sampleRate;
+		int length = std::min((int) (audio.frames / ratio), MAX_IR_LENGTH);
+		std::vector<float> ir(length);
+		for (int i = 0; i < length; i++) {
+			float index = i * ratio;
+			int i0 = std::min((int) index, audio.frames - 1);
+			int i1 = std::min(i0 + 1, audio.frames - 1);
+			float sum = 0.f;
+			for (int c = 0; c < audio.channels; c++) {
+				float* channel = audio.getChannel(c);
+				sum += crossfade(channel[i0], channel[i1], index - i0);
+			}
+			ir[i] = sum / audio.channels;
+		}
+		loadState(channel.get(), ir);
+	});
+}
+
+void ConvolverKernel::process(const float* in, float* out, int n) {
+	for (int i = 0; i < n; i++) {
+		float x = in ? in[i] : 0.f;
+		float y = output[PARTITION_SIZE + position];
+		input[PARTITION_SIZE + position] = x;
+		out[i] = dry * x + wet * y;
+		if (++position >= PARTITION_SIZE) {
+			position = 0;
+			processPartition();
+		}
+	}
+}
+
+void ConvolverKernel::processPartition() {
+	// Swap in a new impulse response once the worker has freed the last one swapped out
+	if (channel->pending.load() && !channel->retired.load()) {
+		channel->retired.store(channel->active.exchange(channel->pending.exchange(NULL)));
+		getConvolverWorker().notify();
+	}
+
+	ConvolverState* state = channel->active.load();
+	if (!state) {
+		std::memset(output, 0, sizeof(output));
+	}
+	else {
+		int64_t block = state->blocks.load(std::memory_order_relaxed);
+		float* x = state->getInput(block);
+		fft.rfftUnordered(input, x);
+
+		// Start from the tail sum if the worker made the deadline, and drop it otherwise
+		if (state->tailBlocks.load(std::memory_order_acquire) > block) {
+			std::memcpy(spectrum, state->getTail(block), sizeof(spectrum));
+		}
+		else {
+			std::memset(spectrum, 0, sizeof(spectrum));
+			if (state->numPartitions > HEAD_PARTITIONS)
+				state->lateTails.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		int headPartitions = std::min(state->numPartitions, HEAD_PARTITIONS);
+		for (int p = 0; p < headPartitions && p <= block; p++) {
+			pffft_zconvolve_accumulate(fft.setup, state->getInput(block - p), &state->irSpectra[p * FFT_SIZE], spectrum, 1.f / FFT_SIZE);
+		}
+		// Overlap-save: the second half of the circular convolution is the linear convolution
+		fft.irfftUnordered(spectrum, output);
+
+		state->blocks.store(block + 1, std::memory_order_release);
+		if (state->numPartitions > HEAD_PARTITIONS)
+			getConvolverWorker().notify();
+	}
+
+	std::memcpy(input, &input[PARTITION_SIZE], sizeof(float) * PARTITION_SIZE);
+}
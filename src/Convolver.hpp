@@ -0,0 +1,44 @@
+#pragma once
+#include "Kernels.hpp"
+#include <pffft.h>
+
+
+struct ConvolverChannel;
+
+
+/** Uniformly partitioned FFT convolution with an impulse response.
+The first HEAD_PARTITIONS partitions are convolved in process().
+The rest are convolved ahead of time by a worker thread shared by all convolvers, which process() notifies at every partition.
+The worker has HEAD_PARTITIONS partitions to finish each tail sum, and tail sums that miss the deadline are dropped.
+Impulse responses are prepared on the sample loader thread and swapped in at a partition boundary.
+Latency is PARTITION_SIZE samples.
+*/
+struct ConvolverKernel : Kernel {
+	static const int PARTITION_SIZE = 64;
+	static const int FFT_SIZE = 2 * PARTITION_SIZE;
+	static const int HEAD_PARTITIONS = 8;
+	static const int MAX_IR_LENGTH = 1 << 19;
+
+	rack::dsp::RealFFT fft;
+	float wet = 1.f;
+	float dry = 0.f;
+
+	// Audio thread
+	/** The previous and current input partitions */
+	alignas(16) float input[FFT_SIZE] = {};
+	alignas(16) float spectrum[FFT_SIZE];
+	alignas(16) float output[FFT_SIZE] = {};
+	int position = 0;
+
+	/** Impulse responses and tail sums shared with the worker, which frees them after the kernel is destroyed */
+	std::shared_ptr<ConvolverChannel> channel;
+
+	ConvolverKernel();
+	/** Only releases the channel, so it can be called on the audio thread. */
+	~ConvolverKernel();
+	void setParams(const float* params, int numParams) override;
+	void load(const float* data, int size) override;
+	void loadFile(const std::string& path, float sampleRate) override;
+	void process(const float* in, float* out, int n) override;
+	void processPartition();
+};
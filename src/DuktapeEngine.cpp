@@ -1,4 +1,9 @@
 #include "ScriptEngine.hpp"
+#include "Kernels.hpp"
+#include "Samples.hpp"
+#include "Streams.hpp"
+#include "Buffers.hpp"
+#include "Buses.hpp"
 #include <duktape.h>
 
 
@@ -43,15 +48,160 @@ struct DuktapeEngine : ScriptEngine {
 		duk_push_c_function(ctx, native_display, 1);
 		duk_put_global_string(ctx, "display");
 
+		// scheduler
+		duk_push_c_function(ctx, native_schedule, 2);
+		duk_put_global_string(ctx, "__schedule");
+		duk_push_c_function(ctx, native_cancel, 1);
+		duk_put_global_string(ctx, "__cancel");
+		duk_push_c_function(ctx, native_now, 0);
+		duk_put_global_string(ctx, "now");
+
+		// kernels
+		duk_push_c_function(ctx, native_kernel_create, 1);
+		duk_put_global_string(ctx, "__kernelCreate");
+		duk_push_c_function(ctx, native_kernel_set, DUK_VARARGS);
+		duk_put_global_string(ctx, "__kernelSet");
+		duk_push_c_function(ctx, native_kernel_load, 1);
+		duk_put_global_string(ctx, "__kernelLoad");
+		duk_push_c_function(ctx, native_kernel_process, 3);
+		duk_put_global_string(ctx, "__kernelProcess");
+
+		// samples
+		duk_push_c_function(ctx, native_sample_load, 1);
+		duk_put_global_string(ctx, "__sampleLoad");
+		duk_push_c_function(ctx, native_sample_info, 1);
+		duk_put_global_string(ctx, "__sampleInfo");
+
+		// streams
+		duk_push_c_function(ctx, native_stream_open, 5);
+		duk_put_global_string(ctx, "__streamOpen");
+		duk_push_c_function(ctx, native_stream_write, 2);
+		duk_put_global_string(ctx, "__streamWrite");
+		duk_push_c_function(ctx, native_stream_read, 2);
+		duk_put_global_string(ctx, "__streamRead");
+		duk_push_c_function(ctx, native_stream_ended, 0);
+		duk_put_global_string(ctx, "__streamEnded");
+		duk_push_c_function(ctx, native_stream_close, 0);
+		duk_put_global_string(ctx, "__streamClose");
+
+		// buffers
+		duk_push_c_function(ctx, native_buffer_get, 2);
+		duk_put_global_string(ctx, "getBuffer");
+
+		// workers
+		duk_push_c_function(ctx, native_workers_create, 2);
+		duk_put_global_string(ctx, "__workersCreate");
+		duk_push_c_function(ctx, native_workers_fork, 0);
+		duk_put_global_string(ctx, "__workersFork");
+		duk_push_c_function(ctx, native_workers_join, 1);
+		duk_put_global_string(ctx, "__workersJoin");
+		duk_push_int(ctx, workerIndex);
+		duk_put_global_string(ctx, "workerIndex");
+
+		// buses
+		duk_push_c_function(ctx, native_bus_open, 4);
+		duk_put_global_string(ctx, "__busOpen");
+		duk_push_c_function(ctx, native_bus_data, 1);
+		duk_put_global_string(ctx, "__busData");
+		duk_push_c_function(ctx, native_bus_offset, 1);
+		duk_put_global_string(ctx, "__busOffset");
+
+		// Scheduled callbacks are kept in __callbacks by id so the host can call them with processScheduled().
+		static const std::string prelude = R"(
+		var __callbacks = {};
+		function schedule(frame, callback) {
+			var id = __schedule(frame, 0);
+			__callbacks[id] = callback;
+			return id;
+		}
+		function scheduleEvery(period, callback, frame) {
+			period = Math.max(period, 1);
+			if (frame === undefined)
+				frame = now() + period;
+			var id = __schedule(frame, period);
+			__callbacks[id] = callback;
+			return id;
+		}
+		function cancel(id) {
+			__cancel(id);
+			delete __callbacks[id];
+		}
+		function Kernel(name) {
+			this.id = __kernelCreate(name);
+			if (this.id < 0)
+				throw new Error("Unknown kernel " + name);
+		}
+		Kernel.prototype.set = __kernelSet;
+		Kernel.prototype.load = __kernelLoad;
+		Kernel.prototype.process = __kernelProcess;
+		function Sample(path) {
+			this.id = __sampleLoad(path);
+			this.channels = [];
+			this.frames = 0;
+			this.sampleRate = 0;
+		}
+		Sample.prototype.ready = function() {
+			if (this.channels.length > 0)
+				return true;
+			var info = __sampleInfo(this.id);
+			if (!info)
+				return false;
+			this.frames = info.frames;
+			this.sampleRate = info.sampleRate;
+			this.channels = info.channels;
+			return true;
+		};
+		function Recorder(path, channels, sampleRate) {
+			this.id = __streamOpen(path, true, channels || 1, sampleRate || 0, false);
+		}
+		Recorder.prototype.write = __streamWrite;
+		Recorder.prototype.close = __streamClose;
+		function Player(path, channels, loop) {
+			this.id = __streamOpen(path, false, channels || 1, 0, !!loop);
+		}
+		Player.prototype.read = __streamRead;
+		Player.prototype.ended = __streamEnded;
+		Player.prototype.close = __streamClose;
+		function Workers(path, count) {
+			this.id = __workersCreate(path, count || 1);
+			if (this.id < 0)
+				throw new Error("Could not create workers " + path);
+		}
+		Workers.prototype.fork = __workersFork;
+		Workers.prototype.join = __workersJoin;
+		function Bus(name, channels, publish, delay) {
+			this.id = __busOpen(String(name), channels || 1, !!publish, delay || 0);
+			if (this.id < 0)
+				throw new Error("Could not open bus " + name);
+			this.data = __busData(this.id);
+			this.channels = channels || 1;
+			this.frames = this.data.length / (4 * this.channels);
+		}
+		Bus.prototype.offset = __busOffset;
+		)";
+		if (duk_peval_lstring(ctx, prelude.c_str(), prelude.size()) != 0) {
+			const char* s = duk_safe_to_string(ctx, -1);
+			WARN("duktape: %s", s);
+			display(s);
+			duk_pop(ctx);
+			return -1;
+		}
+		duk_pop(ctx);
+
 		// config: Set defaults
 		duk_idx_t configIdx = duk_push_object(ctx);
-		{
-			// frameDivider
-			duk_push_int(ctx, 32);
-			duk_put_prop_string(ctx, configIdx, "frameDivider");
-			// bufferSize
-			duk_push_int(ctx, 1);
-			duk_put_prop_string(ctx, configIdx, "bufferSize");
+		for (const ConfigKey& key : CONFIG_KEYS) {
+			if (key.size > 0) {
+				duk_idx_t arrIdx = duk_push_array(ctx);
+				for (int i = 0; i < key.size; i++) {
+					duk_push_number(ctx, key.defaultValue);
+					duk_put_prop_index(ctx, arrIdx, i);
+				}
+			}
+			else {
+				duk_push_number(ctx, key.defaultValue);
+			}
+			duk_put_prop_string(ctx, configIdx, key.name);
 		}
 		duk_put_global_string(ctx, "config");
 
@@ -77,24 +227,26 @@ struct DuktapeEngine : ScriptEngine {
 
 		// config: Read values
 		duk_get_global_string(ctx, "config");
-		{
-			// frameDivider
-			duk_get_prop_string(ctx, -1, "frameDivider");
-			setFrameDivider(duk_get_int(ctx, -1));
-			duk_pop(ctx);
-			// bufferSize
-			duk_get_prop_string(ctx, -1, "bufferSize");
-			setBufferSize(duk_get_int(ctx, -1));
+		for (const ConfigKey& key : CONFIG_KEYS) {
+			duk_get_prop_string(ctx, -1, key.name);
+			if (key.size > 0) {
+				for (int i = 0; i < key.size; i++) {
+					duk_get_prop_index(ctx, -1, i);
+					if (duk_is_number(ctx, -1))
+						setConfigIfChanged(key.name, duk_get_number(ctx, -1), i);
+					duk_pop(ctx);
+				}
+			}
+			else if (duk_is_number(ctx, -1)) {
+				setConfigIfChanged(key.name, duk_get_number(ctx, -1));
+			}
 			duk_pop(ctx);
 		}
 		duk_pop(ctx);
 
 		// Keep process function on stack for faster calling
+		// This is optional when the script only uses scheduled callbacks.
 		duk_get_global_string(ctx, "process");
-		if (!duk_is_function(ctx, -1)) {
-			display("No process() function");
-			return -1;
-		}
 
 		// block (keep on stack)
 		duk_idx_t blockIdx = duk_push_object(ctx);
@@ -103,8 +255,8 @@ struct DuktapeEngine : ScriptEngine {
 			duk_idx_t inputsIdx = duk_push_array(ctx);
 			for (int i = 0; i < NUM_ROWS; i++) {
 				duk_push_external_buffer(ctx);
-				duk_config_buffer(ctx, -1, block->inputs[i], sizeof(float) * block->bufferSize);
-				duk_push_buffer_object(ctx, -1, 0, sizeof(float) * block->bufferSize, DUK_BUFOBJ_FLOAT32ARRAY);
+				duk_config_buffer(ctx, -1, block->inputs[i], sizeof(float) * block->bufferSize * block->batchSize);
+				duk_push_buffer_object(ctx, -1, 0, sizeof(float) * block->bufferSize * block->batchSize, DUK_BUFOBJ_FLOAT32ARRAY);
 				duk_put_prop_index(ctx, inputsIdx, i);
 				duk_pop(ctx);
 			}
@@ -114,8 +266,8 @@ struct DuktapeEngine : ScriptEngine {
 			duk_idx_t outputsIdx = duk_push_array(ctx);
 			for (int i = 0; i < NUM_ROWS; i++) {
 				duk_push_external_buffer(ctx);
-				duk_config_buffer(ctx, -1, block->outputs[i], sizeof(float) * block->bufferSize);
-				duk_push_buffer_object(ctx, -1, 0, sizeof(float) * block->bufferSize, DUK_BUFOBJ_FLOAT32ARRAY);
+				duk_config_buffer(ctx, -1, block->outputs[i], sizeof(float) * block->bufferSize * block->batchSize);
+				duk_push_buffer_object(ctx, -1, 0, sizeof(float) * block->bufferSize * block->batchSize, DUK_BUFOBJ_FLOAT32ARRAY);
 				duk_put_prop_index(ctx, outputsIdx, i);
 				duk_pop(ctx);
 			}
@@ -128,6 +280,13 @@ struct DuktapeEngine : ScriptEngine {
 			duk_put_prop_string(ctx, blockIdx, "knobs");
 			duk_pop(ctx);
 
+			// rowBufferSizes
+			duk_push_external_buffer(ctx);
+			duk_config_buffer(ctx, -1, block->rowBufferSizes, sizeof(int) * NUM_ROWS);
+			duk_push_buffer_object(ctx, -1, 0, sizeof(int) * NUM_ROWS, DUK_BUFOBJ_INT32ARRAY);
+			duk_put_prop_string(ctx, blockIdx, "rowBufferSizes");
+			duk_pop(ctx);
+
 			// switches
 			duk_push_external_buffer(ctx);
 			duk_config_buffer(ctx, -1, block->switches, sizeof(bool) * NUM_ROWS);
@@ -156,29 +315,125 @@ struct DuktapeEngine : ScriptEngine {
 				duk_pop(ctx);
 			}
 			duk_put_prop_string(ctx, blockIdx, "switchLights");
+
+			// knobBuffers
+			duk_idx_t knobBuffersIdx = duk_push_array(ctx);
+			for (int i = 0; i < NUM_ROWS; i++) {
+				duk_push_external_buffer(ctx);
+				duk_config_buffer(ctx, -1, block->knobBuffers[i], sizeof(float) * block->bufferSize * block->batchSize);
+				duk_push_buffer_object(ctx, -1, 0, sizeof(float) * block->bufferSize * block->batchSize, DUK_BUFOBJ_FLOAT32ARRAY);
+				duk_put_prop_index(ctx, knobBuffersIdx, i);
+				duk_pop(ctx);
+			}
+			duk_put_prop_string(ctx, blockIdx, "knobBuffers");
+
+			// switchBuffers
+			duk_idx_t switchBuffersIdx = duk_push_array(ctx);
+			for (int i = 0; i < NUM_ROWS; i++) {
+				duk_push_external_buffer(ctx);
+				duk_config_buffer(ctx, -1, block->switchBuffers[i], sizeof(bool) * block->bufferSize * block->batchSize);
+				duk_push_buffer_object(ctx, -1, 0, sizeof(bool) * block->bufferSize * block->batchSize, DUK_BUFOBJ_UINT8ARRAY);
+				duk_put_prop_index(ctx, switchBuffersIdx, i);
+				duk_pop(ctx);
+			}
+			duk_put_prop_string(ctx, blockIdx, "switchBuffers");
+
+			// events
+			pushEventArrays(block->inputEventCounts, block->inputEventOffsets, block->inputEventTypes, block->bufferSize * block->batchSize);
+			duk_put_prop_string(ctx, blockIdx, "inputEventTypes");
+			duk_put_prop_string(ctx, blockIdx, "inputEventOffsets");
+			duk_put_prop_string(ctx, blockIdx, "inputEventCounts");
+			pushEventArrays(block->outputEventCounts, block->outputEventOffsets, block->outputEventTypes, block->bufferSize * block->batchSize);
+			duk_put_prop_string(ctx, blockIdx, "outputEventTypes");
+			duk_put_prop_string(ctx, blockIdx, "outputEventOffsets");
+			duk_put_prop_string(ctx, blockIdx, "outputEventCounts");
+
+			// batch
+			pushRows(block->batchKnobs, sizeof(block->batchKnobs[0]), DUK_BUFOBJ_FLOAT32ARRAY);
+			duk_put_prop_string(ctx, blockIdx, "batchKnobs");
+			pushRows(block->batchSwitches, sizeof(block->batchSwitches[0]), DUK_BUFOBJ_UINT8ARRAY);
+			duk_put_prop_string(ctx, blockIdx, "batchSwitches");
+			pushRows(block->batchLights, sizeof(block->batchLights[0]), DUK_BUFOBJ_FLOAT32ARRAY);
+			duk_put_prop_string(ctx, blockIdx, "batchLights");
+			pushRows(block->batchSwitchLights, sizeof(block->batchSwitchLights[0]), DUK_BUFOBJ_FLOAT32ARRAY);
+			duk_put_prop_string(ctx, blockIdx, "batchSwitchLights");
 		}
 
 		return 0;
 	}
 
-	int process() override {
-		// block
-		ProcessBlock* block = getProcessBlock();
-		duk_idx_t blockIdx = duk_get_top(ctx) - 1;
-		{
-			// sampleRate
-			duk_push_number(ctx, block->sampleRate);
-			duk_put_prop_string(ctx, blockIdx, "sampleRate");
+	/** Pushes an array of typed arrays over the NUM_ROWS rows of a 2D array, each `rowBytes` long.
+	*/
+	void pushRows(void* data, size_t rowBytes, duk_uint_t type) {
+		duk_idx_t rowsIdx = duk_push_array(ctx);
+		for (int i = 0; i < NUM_ROWS; i++) {
+			duk_push_external_buffer(ctx);
+			duk_config_buffer(ctx, -1, (uint8_t*) data + i * rowBytes, rowBytes);
+			duk_push_buffer_object(ctx, -1, 0, rowBytes, type);
+			duk_put_prop_index(ctx, rowsIdx, i);
+			duk_pop(ctx);
+		}
+	}
 
-			// sampleTime
-			duk_push_number(ctx, block->sampleTime);
-			duk_put_prop_string(ctx, blockIdx, "sampleTime");
+	/** Pushes the counts, offsets, and types arrays of an event list.
+	*/
+	void pushEventArrays(int* counts, int (*offsets)[MAX_BUFFER_SIZE], uint8_t (*types)[MAX_BUFFER_SIZE], int bufferSize) {
+		duk_push_external_buffer(ctx);
+		duk_config_buffer(ctx, -1, counts, sizeof(int) * NUM_ROWS);
+		duk_push_buffer_object(ctx, -1, 0, sizeof(int) * NUM_ROWS, DUK_BUFOBJ_INT32ARRAY);
+		duk_remove(ctx, -2);
 
-			// bufferSize
-			duk_push_int(ctx, block->bufferSize);
-			duk_put_prop_string(ctx, blockIdx, "bufferSize");
+		duk_idx_t offsetsIdx = duk_push_array(ctx);
+		for (int i = 0; i < NUM_ROWS; i++) {
+			duk_push_external_buffer(ctx);
+			duk_config_buffer(ctx, -1, offsets[i], sizeof(int) * bufferSize);
+			duk_push_buffer_object(ctx, -1, 0, sizeof(int) * bufferSize, DUK_BUFOBJ_INT32ARRAY);
+			duk_put_prop_index(ctx, offsetsIdx, i);
+			duk_pop(ctx);
 		}
 
+		duk_idx_t typesIdx = duk_push_array(ctx);
+		for (int i = 0; i < NUM_ROWS; i++) {
+			duk_push_external_buffer(ctx);
+			duk_config_buffer(ctx, -1, types[i], bufferSize);
+			duk_push_buffer_object(ctx, -1, 0, bufferSize, DUK_BUFOBJ_UINT8ARRAY);
+			duk_put_prop_index(ctx, typesIdx, i);
+			duk_pop(ctx);
+		}
+	}
+
+	void updateBlock(duk_idx_t blockIdx) {
+		ProcessBlock* block = getProcessBlock();
+
+		// sampleRate
+		duk_push_number(ctx, block->sampleRate);
+		duk_put_prop_string(ctx, blockIdx, "sampleRate");
+
+		// sampleTime
+		duk_push_number(ctx, block->sampleTime);
+		duk_put_prop_string(ctx, blockIdx, "sampleTime");
+
+		// bufferSize
+		duk_push_int(ctx, block->bufferSize);
+		duk_put_prop_string(ctx, blockIdx, "bufferSize");
+
+		// frame
+		duk_push_number(ctx, (double) block->frame);
+		duk_put_prop_string(ctx, blockIdx, "frame");
+
+		// batchSize
+		duk_push_int(ctx, block->batchSize);
+		duk_put_prop_string(ctx, blockIdx, "batchSize");
+	}
+
+	int process() override {
+		if (!duk_is_function(ctx, -2))
+			return 0;
+
+		// block
+		duk_idx_t blockIdx = duk_get_top(ctx) - 1;
+		updateBlock(blockIdx);
+
 		// Duplicate process function
 		duk_dup(ctx, -2);
 		// Duplicate block object
@@ -197,6 +452,53 @@ struct DuktapeEngine : ScriptEngine {
 		return 0;
 	}
 
+	int processControl() override {
+		duk_get_global_string(ctx, "processControl");
+		if (!duk_is_function(ctx, -1)) {
+			duk_pop(ctx);
+			return 0;
+		}
+		// Duplicate block object
+		duk_dup(ctx, -2);
+		if (duk_pcall(ctx, 1)) {
+			const char* s = duk_safe_to_string(ctx, -1);
+			WARN("duktape: %s", s);
+			display(s);
+			duk_pop(ctx);
+			return -1;
+		}
+		// return value
+		duk_pop(ctx);
+		return 0;
+	}
+
+	int processScheduled(int id, int offset, bool last) override {
+		duk_idx_t blockIdx = duk_get_top(ctx) - 1;
+		updateBlock(blockIdx);
+
+		duk_get_global_string(ctx, "__callbacks");
+		duk_get_prop_index(ctx, -1, id);
+		if (last)
+			duk_del_prop_index(ctx, -2, id);
+		if (!duk_is_function(ctx, -1)) {
+			duk_pop_n(ctx, 2);
+			return 0;
+		}
+		// Duplicate block object
+		duk_dup(ctx, blockIdx);
+		duk_push_int(ctx, offset);
+		if (duk_pcall(ctx, 2)) {
+			const char* s = duk_safe_to_string(ctx, -1);
+			WARN("duktape: %s", s);
+			display(s);
+			duk_pop_n(ctx, 2);
+			return -1;
+		}
+		// return value and __callbacks
+		duk_pop_n(ctx, 2);
+		return 0;
+	}
+
 	static DuktapeEngine* getDuktapeEngine(duk_context* ctx) {
 		duk_get_global_string(ctx, DUK_HIDDEN_SYMBOL("engine"));
 		DuktapeEngine* engine = (DuktapeEngine*) duk_get_pointer(ctx, -1);
@@ -209,6 +511,240 @@ struct DuktapeEngine : ScriptEngine {
 		INFO("Duktape: %s", s);
 		return 0;
 	}
+	static duk_ret_t native_schedule(duk_context* ctx) {
+		double frame = duk_require_number(ctx, 0);
+		double period = duk_get_number_default(ctx, 1, 0.0);
+		int id = getDuktapeEngine(ctx)->schedule((int64_t) frame, (int64_t) period);
+		duk_push_int(ctx, id);
+		return 1;
+	}
+	static duk_ret_t native_cancel(duk_context* ctx) {
+		getDuktapeEngine(ctx)->cancel(duk_get_int(ctx, 0));
+		return 0;
+	}
+	static duk_ret_t native_now(duk_context* ctx) {
+		duk_push_number(ctx, (double) getDuktapeEngine(ctx)->getFrame());
+		return 1;
+	}
+	/** Returns the kernel of the `this` Kernel object, or NULL. */
+	static Kernel* getThisKernel(duk_context* ctx) {
+		duk_push_this(ctx);
+		duk_get_prop_string(ctx, -1, "id");
+		int id = duk_get_int_default(ctx, -1, -1);
+		duk_pop_n(ctx, 2);
+		return getDuktapeEngine(ctx)->getKernel(id);
+	}
+	static duk_ret_t native_kernel_create(duk_context* ctx) {
+		const char* name = duk_require_string(ctx, 0);
+		duk_push_int(ctx, getDuktapeEngine(ctx)->addKernel(name));
+		return 1;
+	}
+	static duk_ret_t native_kernel_set(duk_context* ctx) {
+		Kernel* kernel = getThisKernel(ctx);
+		if (!kernel)
+			return duk_type_error(ctx, "not a Kernel");
+		float params[16];
+		int numParams = std::min((int) duk_get_top(ctx), (int) LENGTHOF(params));
+		for (int i = 0; i < numParams; i++)
+			params[i] = duk_require_number(ctx, i);
+		kernel->setParams(params, numParams);
+		return 0;
+	}
+	static duk_ret_t native_kernel_load(duk_context* ctx) {
+		Kernel* kernel = getThisKernel(ctx);
+		if (!kernel)
+			return duk_type_error(ctx, "not a Kernel");
+		if (duk_is_string(ctx, 0)) {
+			// Audio file path
+			DuktapeEngine* engine = getDuktapeEngine(ctx);
+			kernel->loadFile(engine->resolvePath(duk_get_string(ctx, 0)), engine->getSampleRate());
+		}
+		else if (duk_is_array(ctx, 0)) {
+			std::vector<float> values(duk_get_length(ctx, 0));
+			for (size_t i = 0; i < values.size(); i++) {
+				duk_get_prop_index(ctx, 0, i);
+				values[i] = duk_get_number_default(ctx, -1, 0.0);
+				duk_pop(ctx);
+			}
+			kernel->load(values.data(), values.size());
+		}
+		else {
+			duk_size_t size;
+			float* data = (float*) duk_require_buffer_data(ctx, 0, &size);
+			kernel->load(data, size / sizeof(float));
+		}
+		return 0;
+	}
+	static duk_ret_t native_kernel_process(duk_context* ctx) {
+		Kernel* kernel = getThisKernel(ctx);
+		if (!kernel)
+			return duk_type_error(ctx, "not a Kernel");
+		duk_size_t outSize;
+		float* out = (float*) duk_require_buffer_data(ctx, 1, &outSize);
+		size_t n = outSize / sizeof(float);
+		// input may be null for generators
+		float* in = NULL;
+		if (!duk_is_null_or_undefined(ctx, 0)) {
+			duk_size_t inSize;
+			in = (float*) duk_require_buffer_data(ctx, 0, &inSize);
+			n = std::min(n, (size_t) (inSize / sizeof(float)));
+		}
+		if (!duk_is_null_or_undefined(ctx, 2))
+			n = std::min(n, (size_t) std::max(duk_get_int(ctx, 2), 0));
+		kernel->process(in, out, n);
+		return 0;
+	}
+	static duk_ret_t native_sample_load(duk_context* ctx) {
+		const char* path = duk_require_string(ctx, 0);
+		duk_push_int(ctx, getDuktapeEngine(ctx)->addSample(path));
+		return 1;
+	}
+	/** Returns {frames, sampleRate, channels} with a Float32Array over each channel, or undefined if the sample is not loaded yet. */
+	static duk_ret_t native_sample_info(duk_context* ctx) {
+		Sample* sample = getDuktapeEngine(ctx)->getSample(duk_require_int(ctx, 0));
+		if (!sample)
+			return 0;
+		duk_idx_t infoIdx = duk_push_object(ctx);
+		duk_push_int(ctx, sample->frames);
+		duk_put_prop_string(ctx, infoIdx, "frames");
+		duk_push_number(ctx, sample->sampleRate);
+		duk_put_prop_string(ctx, infoIdx, "sampleRate");
+		duk_idx_t channelsIdx = duk_push_array(ctx);
+		for (int c = 0; c < sample->channels; c++) {
+			duk_push_external_buffer(ctx);
+			duk_config_buffer(ctx, -1, const_cast<float*>(sample->getChannel(c)), sizeof(float) * sample->frames);
+			duk_push_buffer_object(ctx, -1, 0, sizeof(float) * sample->frames, DUK_BUFOBJ_FLOAT32ARRAY);
+			duk_put_prop_index(ctx, channelsIdx, c);
+			duk_pop(ctx);
+		}
+		duk_put_prop_string(ctx, infoIdx, "channels");
+		return 1;
+	}
+	/** Returns the stream of the `this` Recorder or Player object, or NULL. */
+	static Stream* getThisStream(duk_context* ctx) {
+		duk_push_this(ctx);
+		duk_get_prop_string(ctx, -1, "id");
+		int id = duk_get_int_default(ctx, -1, -1);
+		duk_pop_n(ctx, 2);
+		return getDuktapeEngine(ctx)->getStream(id);
+	}
+	static duk_ret_t native_stream_open(duk_context* ctx) {
+		const char* path = duk_require_string(ctx, 0);
+		int id = getDuktapeEngine(ctx)->addStream(path, duk_to_boolean(ctx, 1), duk_get_int_default(ctx, 2, 1), duk_get_number_default(ctx, 3, 0.0), duk_to_boolean(ctx, 4));
+		duk_push_int(ctx, id);
+		return 1;
+	}
+	/** Returns the data of the array argument and the number of samples to write or read, limited by its length. */
+	static float* getStreamData(duk_context* ctx, int* n) {
+		duk_size_t size;
+		float* data = (float*) duk_require_buffer_data(ctx, 0, &size);
+		*n = size / sizeof(float);
+		if (!duk_is_null_or_undefined(ctx, 1))
+			*n = std::min(*n, std::max(duk_get_int(ctx, 1), 0));
+		return data;
+	}
+	static duk_ret_t native_stream_write(duk_context* ctx) {
+		Stream* stream = getThisStream(ctx);
+		if (!stream)
+			return duk_type_error(ctx, "not a Recorder");
+		int n;
+		float* data = getStreamData(ctx, &n);
+		duk_push_int(ctx, stream->write(data, n));
+		return 1;
+	}
+	static duk_ret_t native_stream_read(duk_context* ctx) {
+		Stream* stream = getThisStream(ctx);
+		if (!stream)
+			return duk_type_error(ctx, "not a Player");
+		int n;
+		float* data = getStreamData(ctx, &n);
+		duk_push_int(ctx, stream->read(data, n));
+		return 1;
+	}
+	static duk_ret_t native_stream_ended(duk_context* ctx) {
+		Stream* stream = getThisStream(ctx);
+		if (!stream)
+			return duk_type_error(ctx, "not a Player");
+		duk_push_boolean(ctx, stream->isEnded());
+		return 1;
+	}
+	/** Returns a Float32Array over the pooled buffer. */
+	static duk_ret_t native_buffer_get(duk_context* ctx) {
+		const char* name = duk_require_string(ctx, 0);
+		std::shared_ptr<PooledBuffer> buffer = getDuktapeEngine(ctx)->getBuffer(name, duk_require_int(ctx, 1));
+		if (!buffer)
+			return duk_error(ctx, DUK_ERR_RANGE_ERROR, "Could not allocate buffer %s", name);
+		// The engine keeps the buffer alive, so it can be exposed as an external buffer
+		size_t bytes = sizeof(float) * buffer->size;
+		duk_push_external_buffer(ctx);
+		duk_config_buffer(ctx, -1, buffer->data, bytes);
+		duk_push_buffer_object(ctx, -1, 0, bytes, DUK_BUFOBJ_FLOAT32ARRAY);
+		return 1;
+	}
+	static duk_ret_t native_workers_create(duk_context* ctx) {
+		const char* path = duk_require_string(ctx, 0);
+		duk_push_int(ctx, getDuktapeEngine(ctx)->addWorkers(path, duk_get_int_default(ctx, 1, 1)));
+		return 1;
+	}
+	/** Returns the id of the `this` Workers object. */
+	static int getThisWorkers(duk_context* ctx) {
+		duk_push_this(ctx);
+		duk_get_prop_string(ctx, -1, "id");
+		int id = duk_get_int_default(ctx, -1, -1);
+		duk_pop_n(ctx, 2);
+		return id;
+	}
+	static duk_ret_t native_workers_fork(duk_context* ctx) {
+		int started = getDuktapeEngine(ctx)->forkWorkers(getThisWorkers(ctx));
+		if (started < 0)
+			return duk_type_error(ctx, "not a Workers");
+		duk_push_int(ctx, started);
+		return 1;
+	}
+	static duk_ret_t native_workers_join(duk_context* ctx) {
+		int joined = getDuktapeEngine(ctx)->joinWorkers(getThisWorkers(ctx), duk_get_number_default(ctx, 0, -1.0));
+		if (joined < 0)
+			return duk_type_error(ctx, "not a Workers");
+		duk_push_int(ctx, joined);
+		return 1;
+	}
+	static duk_ret_t native_bus_open(duk_context* ctx) {
+		const char* name = duk_require_string(ctx, 0);
+		duk_push_int(ctx, getDuktapeEngine(ctx)->addBus(name, duk_require_int(ctx, 1), duk_to_boolean(ctx, 2), duk_get_int_default(ctx, 3, 0)));
+		return 1;
+	}
+	/** Returns a Float32Array over every slot of the bus. */
+	static duk_ret_t native_bus_data(duk_context* ctx) {
+		BusPort* port = getDuktapeEngine(ctx)->getBus(duk_require_int(ctx, 0));
+		if (!port)
+			return duk_type_error(ctx, "invalid bus");
+		// The engine keeps the bus alive, so it can be exposed as an external buffer
+		size_t bytes = sizeof(float) * port->bus->memory.size;
+		duk_push_external_buffer(ctx);
+		duk_config_buffer(ctx, -1, port->bus->memory.data, bytes);
+		duk_push_buffer_object(ctx, -1, 0, bytes, DUK_BUFOBJ_FLOAT32ARRAY);
+		return 1;
+	}
+	static duk_ret_t native_bus_offset(duk_context* ctx) {
+		duk_push_this(ctx);
+		duk_get_prop_string(ctx, -1, "id");
+		BusPort* port = getDuktapeEngine(ctx)->getBus(duk_get_int_default(ctx, -1, -1));
+		duk_pop_n(ctx, 2);
+		if (!port)
+			return duk_type_error(ctx, "not a Bus");
+		int offset = port->getOffset(duk_get_int_default(ctx, 0, 0));
+		if (offset < 0)
+			return duk_error(ctx, DUK_ERR_RANGE_ERROR, "invalid bus channel");
+		duk_push_int(ctx, offset);
+		return 1;
+	}
+	static duk_ret_t native_stream_close(duk_context* ctx) {
+		Stream* stream = getThisStream(ctx);
+		if (stream)
+			stream->close();
+		return 0;
+	}
+
 	static duk_ret_t native_display(duk_context* ctx) {
 		const char* s = duk_safe_to_string(ctx, -1);
 		getDuktapeEngine(ctx)->display(s);
@@ -22,6 +22,7 @@
  ************************************************************************/
 
 #include "ScriptEngine.hpp"
+#include "Samples.hpp"
 
 #include <iostream>
 #include <memory>
@@ -29,6 +30,7 @@
 #include <vector>
 #include <algorithm>
 #include <functional>
+#include <atomic>
 
 #pragma GCC diagnostic push
 #ifndef __clang__
@@ -37,6 +39,7 @@
 #include <faust/dsp/libfaust.h>
 #include <faust/gui/DecoratorUI.h>
 #include <faust/gui/ValueConverter.h>
+#include <faust/gui/Soundfile.h>
 
 #define kBufferSize 64
 
@@ -65,6 +68,31 @@ struct PrototypeUI : public GenericUI {
 
 	std::string fKey, fValue, fScale;
 
+	// Soundfiles point into shared samples or into fChannels, so Soundfile::fChannels is left at 0 to keep ~Soundfile() from freeing the channels.
+	static_assert(sizeof(FAUSTFLOAT) == sizeof(float), "soundfiles share float samples");
+	/** A soundfile built on the sample loader thread once its files have loaded. Shared with the loader, which may finish after the engine is deleted. */
+	struct SoundfileLoad {
+		std::vector<std::shared_ptr<Sample>> fSamples;
+		/** Parts of several files concatenated by channel */
+		std::vector<std::vector<float>> fChannels;
+		Soundfile* fSoundfile = nullptr;
+		std::string fError;
+		std::atomic<bool> fReady{false};
+
+		~SoundfileLoad() {
+			delete fSoundfile;
+		}
+	};
+	struct SoundfileZone {
+		Soundfile** fZone;
+		std::shared_ptr<SoundfileLoad> fLoad;
+		bool fInstalled = false;
+	};
+	std::vector<SoundfileZone> fSoundfileZones;
+	// Used by every zone until its sample is loaded
+	Soundfile* fSilence = nullptr;
+	ScriptEngine* fEngine = nullptr;
+
 	int getIndex(const std::string& value) {
 		try {
 			int index = stoi(value);
@@ -87,6 +115,94 @@ struct PrototypeUI : public GenericUI {
 	virtual ~PrototypeUI() {
 		for (auto& it : fConverters)
 			delete it;
+		delete fSilence;
+	}
+
+	/** Returns a soundfile with every channel and part reading `length` frames from `channels`. */
+	static Soundfile* createSoundfile(float** channels, int numChannels, int length, int sampleRate) {
+		Soundfile* soundfile = new Soundfile();
+		soundfile->fBuffers = new FAUSTFLOAT*[MAX_CHAN];
+		for (int chan = 0; chan < MAX_CHAN; chan++)
+			soundfile->fBuffers[chan] = channels[chan % numChannels];
+		for (int part = 0; part < MAX_SOUNDFILE_PARTS; part++) {
+			soundfile->fLength[part] = length;
+			soundfile->fSR[part] = sampleRate;
+			soundfile->fOffset[part] = 0;
+		}
+		soundfile->fChannels = 0;
+		return soundfile;
+	}
+
+	/** Builds the soundfile of `load` from its samples. Called from the sample loader thread once they have loaded or failed. */
+	static void buildSoundfile(SoundfileLoad* load) {
+		std::vector<Sample*> parts;
+		for (auto& sample : load->fSamples) {
+			if (sample->isLoaded() && sample->frames > 0) {
+				parts.push_back(sample.get());
+			}
+			else {
+				// Missing files play silence, like in other Faust architectures
+				parts.push_back(nullptr);
+				load->fError = "Could not load soundfile " + sample->path;
+			}
+		}
+
+		// A single file is played from the shared sample without copying
+		if (parts.size() == 1 && parts[0]) {
+			Sample* sample = parts[0];
+			float* channels[MAX_CHAN];
+			for (int chan = 0; chan < std::min(sample->channels, MAX_CHAN); chan++)
+				// Soundfiles are only read
+				channels[chan] = const_cast<float*>(sample->getChannel(chan));
+			load->fSoundfile = createSoundfile(channels, std::min(sample->channels, MAX_CHAN), sample->frames, sample->sampleRate);
+			return;
+		}
+
+		// Otherwise each channel holds every part in order, followed by the silence played by unused parts
+		int numChannels = 1;
+		size_t length = BUFFER_SIZE;
+		for (Sample* sample : parts) {
+			if (sample)
+				numChannels = std::max(numChannels, std::min(sample->channels, MAX_CHAN));
+			length += sample ? sample->frames : BUFFER_SIZE;
+		}
+		load->fChannels.resize(numChannels);
+		float* channels[MAX_CHAN];
+		for (int chan = 0; chan < numChannels; chan++) {
+			load->fChannels[chan].resize(length);
+			channels[chan] = load->fChannels[chan].data();
+		}
+		Soundfile* soundfile = createSoundfile(channels, numChannels, BUFFER_SIZE, SAMPLE_RATE);
+		int offset = 0;
+		for (int part = 0; part < (int) parts.size(); part++) {
+			Sample* sample = parts[part];
+			int frames = sample ? sample->frames : BUFFER_SIZE;
+			if (sample) {
+				// Files with fewer channels repeat theirs
+				for (int chan = 0; chan < numChannels; chan++)
+					std::copy_n(sample->getChannel(chan % sample->channels), frames, &load->fChannels[chan][offset]);
+				soundfile->fSR[part] = sample->sampleRate;
+			}
+			soundfile->fLength[part] = frames;
+			soundfile->fOffset[part] = offset;
+			offset += frames;
+		}
+		for (int part = parts.size(); part < MAX_SOUNDFILE_PARTS; part++)
+			soundfile->fOffset[part] = offset;
+		load->fSoundfile = soundfile;
+	}
+
+	/** Swaps in the soundfiles that have been built, and displays their errors. Called from the audio thread, so it does not allocate. */
+	void updateSoundfiles() {
+		for (auto& it : fSoundfileZones) {
+			if (it.fInstalled || !it.fLoad->fReady.load(std::memory_order_acquire))
+				continue;
+			it.fInstalled = true;
+			if (!it.fLoad->fError.empty())
+				fEngine->display(it.fLoad->fError);
+			if (it.fLoad->fSoundfile)
+				*it.fZone = it.fLoad->fSoundfile;
+		}
 	}
 
 	void addButton(const char* label, FAUSTFLOAT* zone) override {
@@ -200,7 +316,42 @@ struct PrototypeUI : public GenericUI {
 	}
 
 	void addSoundfile(const char* label, const char* soundpath, Soundfile** sf_zone) override {
-		WARN("Faust Prototype : 'soundfile' primitive not yet supported");
+		if (!fSilence) {
+			static float silence[BUFFER_SIZE] = {};
+			float* channels[] = {silence};
+			fSilence = createSoundfile(channels, 1, BUFFER_SIZE, SAMPLE_RATE);
+		}
+		*sf_zone = fSilence;
+
+		// soundpath is a list such as {'a.wav';'b.wav'}, with one part per file
+		std::shared_ptr<SoundfileLoad> load = std::make_shared<SoundfileLoad>();
+		std::string paths = soundpath;
+		size_t begin = paths.find('\'');
+		while (begin != std::string::npos) {
+			size_t end = paths.find('\'', begin + 1);
+			if (end == std::string::npos)
+				break;
+			std::string path = paths.substr(begin + 1, end - begin - 1);
+			load->fSamples.push_back(loadSample(fEngine->resolvePath(path)));
+			begin = paths.find('\'', end + 1);
+		}
+		if (load->fSamples.empty()) {
+			fEngine->display(std::string("No file in soundfile ") + label);
+			return;
+		}
+		if ((int) load->fSamples.size() > MAX_SOUNDFILE_PARTS) {
+			fEngine->display(rack::string::f("Soundfile %s has more than %d files", label, MAX_SOUNDFILE_PARTS));
+			load->fSamples.resize(MAX_SOUNDFILE_PARTS);
+		}
+
+		SoundfileZone zone;
+		zone.fZone = sf_zone;
+		zone.fLoad = load;
+		fSoundfileZones.push_back(zone);
+		runAfterSamples([load]() {
+			buildSoundfile(load.get());
+			load->fReady.store(true, std::memory_order_release);
+		});
 	}
 
 	void declare(FAUSTFLOAT* zone, const char* key, const char* val) override {
@@ -326,6 +477,7 @@ public:
 		}
 
 		// Setup UI
+		fPrototypeUI.fEngine = this;
 		fDSP->buildUserInterface(&fPrototypeUI);
 
 		setFrameDivider(1);
@@ -344,6 +496,9 @@ public:
 			fDSP->init(block->sampleRate);
 		}
 
+		// Soundfiles load in the background
+		fPrototypeUI.updateSoundfiles();
+
 		// Update inputs controllers
 		for (auto& it : fPrototypeUI.fUpdateFunIn)
 			it(block);
@@ -0,0 +1,382 @@
+#include "Kernels.hpp"
+#include "Convolver.hpp"
+
+
+using namespace rack;
+
+
+// Stateless kernels are written as branch-free loops so the compiler can vectorize them.
+// On Linux, GCC also compiles an AVX2 copy and selects it at load time based on the CPU.
+#if defined ARCH_LIN
+	#define KERNEL_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+	#define KERNEL_CLONES
+#endif
+
+
+/** Padé approximant of tanh, clamped to +-1 beyond +-3. Error is below 0.025. */
+KERNEL_CLONES
+static void tanhApprox(const float* in, float* out, int n) {
+	for (int i = 0; i < n; i++) {
+		float x = std::fmin(std::fmax(in[i], -3.f), 3.f);
+		float x2 = x * x;
+		out[i] = x * (27.f + x2) / (27.f + 9.f * x2);
+	}
+}
+
+/** sin(2 pi x) using a corrected parabola. Error is about 0.001. */
+KERNEL_CLONES
+static void sinApprox(const float* in, float* out, int n) {
+	for (int i = 0; i < n; i++) {
+		float x = in[i] - std::round(in[i]);
+		float y = 8.f * x - 16.f * x * std::fabs(x);
+		out[i] = 0.225f * (y * std::fabs(y) - y) + y;
+	}
+}
+
+/** 2^x with a cubic fit of the fractional part. Relative error is below 0.0002. */
+KERNEL_CLONES
+static void exp2Approx(const float* in, float* out, int n) {
+	for (int i = 0; i < n; i++) {
+		float x = std::fmin(std::fmax(in[i], -126.f), 126.f);
+		float xi = std::floor(x);
+		float f = x - xi;
+		float p = 1.f + f * (0.6959285f + f * (0.2249463f + f * 0.0791252f));
+		int32_t bits = ((int32_t) xi + 127) << 23;
+		float scale;
+		std::memcpy(&scale, &bits, sizeof(scale));
+		out[i] = p * scale;
+	}
+}
+
+
+struct TanhKernel : Kernel {
+	void process(const float* in, float* out, int n) override {
+		if (in)
+			tanhApprox(in, out, n);
+	}
+};
+
+struct SinKernel : Kernel {
+	void process(const float* in, float* out, int n) override {
+		if (in)
+			sinApprox(in, out, n);
+	}
+};
+
+struct Exp2Kernel : Kernel {
+	void process(const float* in, float* out, int n) override {
+		if (in)
+			exp2Approx(in, out, n);
+	}
+};
+
+
+struct BiquadKernel : Kernel {
+	dsp::BiquadFilter filter;
+	float type = dsp::BiquadFilter::LOWPASS;
+	float frequency = 0.25f;
+	float Q = M_SQRT1_2;
+	float gain = 1.f;
+
+	BiquadKernel() {
+		update();
+	}
+	void setParams(const float* params, int numParams) override {
+		float* values[] = {&type, &frequency, &Q, &gain};
+		for (int i = 0; i < std::min(numParams, 4); i++)
+			*values[i] = params[i];
+		update();
+	}
+	void update() {
+		int t = clamp((int) type, 0, (int) dsp::BiquadFilter::NUM_TYPES - 1);
+		filter.setParameters((dsp::BiquadFilter::Type) t, clamp(frequency, 1e-6f, 0.499f), std::max(Q, 1e-3f), gain);
+	}
+	void process(const float* in, float* out, int n) override {
+		if (!in)
+			return;
+		for (int i = 0; i < n; i++)
+			out[i] = filter.process(in[i]);
+	}
+};
+
+
+/** Trapezoidal state variable filter, which is stable under fast modulation. */
+struct SVFKernel : Kernel {
+	float frequency = 0.25f;
+	float Q = M_SQRT1_2;
+	float mode = 0.f;
+	float a1, a2, a3, k;
+	float ic1 = 0.f;
+	float ic2 = 0.f;
+
+	SVFKernel() {
+		update();
+	}
+	void setParams(const float* params, int numParams) override {
+		float* values[] = {&frequency, &Q, &mode};
+		for (int i = 0; i < std::min(numParams, 3); i++)
+			*values[i] = params[i];
+		update();
+	}
+	void update() {
+		float g = std::tan(M_PI * clamp(frequency, 1e-6f, 0.499f));
+		k = 1.f / std::max(Q, 1e-3f);
+		a1 = 1.f / (1.f + g * (g + k));
+		a2 = g * a1;
+		a3 = g * a2;
+	}
+	void process(const float* in, float* out, int n) override {
+		if (!in)
+			return;
+		int m = (int) mode;
+		for (int i = 0; i < n; i++) {
+			float v0 = in[i];
+			float v3 = v0 - ic2;
+			float v1 = a1 * ic1 + a2 * v3;
+			float v2 = ic2 + a2 * ic1 + a3 * v3;
+			ic1 = 2.f * v1 - ic1;
+			ic2 = 2.f * v2 - ic2;
+			if (m == 1)
+				out[i] = v1;
+			else if (m == 2)
+				out[i] = v0 - k * v1 - v2;
+			else
+				out[i] = v2;
+		}
+	}
+};
+
+
+struct OnePoleKernel : Kernel {
+	float a = 1.f;
+	float y = 0.f;
+
+	void setParams(const float* params, int numParams) override {
+		if (numParams >= 1)
+			a = 1.f - std::exp(-2.f * M_PI * std::max(params[0], 0.f));
+	}
+	void process(const float* in, float* out, int n) override {
+		if (!in)
+			return;
+		for (int i = 0; i < n; i++) {
+			y += (in[i] - y) * a;
+			out[i] = y;
+		}
+	}
+};
+
+
+struct FollowerKernel : Kernel {
+	float attack = 0.f;
+	float release = 0.f;
+	float env = 0.f;
+
+	void setParams(const float* params, int numParams) override {
+		if (numParams >= 1)
+			attack = std::exp(-1.f / std::max(params[0], 1e-3f));
+		if (numParams >= 2)
+			release = std::exp(-1.f / std::max(params[1], 1e-3f));
+	}
+	void process(const float* in, float* out, int n) override {
+		if (!in)
+			return;
+		for (int i = 0; i < n; i++) {
+			float x = std::fabs(in[i]);
+			float c = (x > env) ? attack : release;
+			env = x + (env - x) * c;
+			out[i] = env;
+		}
+	}
+};
+
+
+struct DelayKernel : Kernel {
+	static const int SIZE = 1 << 17;
+	std::vector<float> buffer;
+	int writeIndex = 0;
+	float time = 2.f;
+	float feedback = 0.f;
+
+	DelayKernel() {
+		buffer.resize(SIZE);
+	}
+	void setParams(const float* params, int numParams) override {
+		if (numParams >= 1)
+			time = clamp(params[0], 2.f, (float) (SIZE - 4));
+		if (numParams >= 2)
+			feedback = clamp(params[1], -1.f, 1.f);
+	}
+	float read(int index) {
+		return buffer[index & (SIZE - 1)];
+	}
+	void process(const float* in, float* out, int n) override {
+		int delayInt = (int) time;
+		float f = time - delayInt;
+		for (int i = 0; i < n; i++) {
+			// 4-point Hermite interpolation around the delayed position
+			int index = writeIndex - delayInt;
+			float y0 = read(index + 1);
+			float y1 = read(index);
+			float y2 = read(index - 1);
+			float y3 = read(index - 2);
+			float c1 = 0.5f * (y2 - y0);
+			float c2 = y0 - 2.5f * y1 + 2.f * y2 - 0.5f * y3;
+			float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+			float y = ((c3 * f + c2) * f + c1) * f + y1;
+
+			float x = in ? in[i] : 0.f;
+			buffer[writeIndex] = x + y * feedback;
+			writeIndex = (writeIndex + 1) & (SIZE - 1);
+			out[i] = y;
+		}
+	}
+};
+
+
+/** Base of phase-accumulating oscillators */
+struct OscillatorKernel : Kernel {
+	float frequency = 0.01f;
+	float phase = 0.f;
+
+	void setParams(const float* params, int numParams) override {
+		if (numParams >= 1)
+			frequency = params[0];
+	}
+	float step(const float* in, int i) {
+		float f = in ? in[i] : frequency;
+		phase += f;
+		phase -= std::floor(phase);
+		return f;
+	}
+};
+
+struct SineKernel : OscillatorKernel {
+	void process(const float* in, float* out, int n) override {
+		for (int i = 0; i < n; i++) {
+			step(in, i);
+			out[i] = phase;
+		}
+		sinApprox(out, out, n);
+	}
+};
+
+/** Polynomial band-limited step correction for a discontinuity at phase 0, with phase increment `dt` */
+static float polyBlep(float t, float dt) {
+	dt = std::fabs(dt);
+	if (t < dt) {
+		t /= dt;
+		return t + t - t * t - 1.f;
+	}
+	if (t > 1.f - dt) {
+		t = (t - 1.f) / dt;
+		return t * t + t + t + 1.f;
+	}
+	return 0.f;
+}
+
+struct SawKernel : OscillatorKernel {
+	void process(const float* in, float* out, int n) override {
+		for (int i = 0; i < n; i++) {
+			float f = step(in, i);
+			out[i] = 2.f * phase - 1.f - polyBlep(phase, f);
+		}
+	}
+};
+
+struct SquareKernel : OscillatorKernel {
+	float width = 0.5f;
+
+	void setParams(const float* params, int numParams) override {
+		OscillatorKernel::setParams(params, numParams);
+		if (numParams >= 2)
+			width = clamp(params[1], 0.01f, 0.99f);
+	}
+	void process(const float* in, float* out, int n) override {
+		for (int i = 0; i < n; i++) {
+			float f = step(in, i);
+			float y = (phase < width) ? 1.f : -1.f;
+			float fallPhase = phase - width;
+			fallPhase -= std::floor(fallPhase);
+			out[i] = y + polyBlep(phase, f) - polyBlep(fallPhase, f);
+		}
+	}
+};
+
+struct WavetableKernel : OscillatorKernel {
+	std::vector<float> table;
+
+	void load(const float* data, int size) override {
+		table.assign(data, data + std::max(size, 0));
+	}
+	void process(const float* in, float* out, int n) override {
+		int size = table.size();
+		if (size == 0) {
+			std::fill(out, out + n, 0.f);
+			return;
+		}
+		for (int i = 0; i < n; i++) {
+			step(in, i);
+			float index = phase * size;
+			int i0 = std::min((int) index, size - 1);
+			int i1 = (i0 + 1 < size) ? i0 + 1 : 0;
+			float f = index - i0;
+			out[i] = crossfade(table[i0], table[i1], f);
+		}
+	}
+};
+
+
+struct NoiseKernel : Kernel {
+	uint32_t state;
+
+	NoiseKernel() {
+		state = random::u32() | 1;
+	}
+	void process(const float* in, float* out, int n) override {
+		for (int i = 0; i < n; i++) {
+			// xorshift32
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			out[i] = (int32_t) state * (1.f / 2147483648.f);
+		}
+	}
+};
+
+
+Kernel* createKernel(const std::string& name) {
+	if (name == "biquad")
+		return new BiquadKernel;
+	if (name == "svf")
+		return new SVFKernel;
+	if (name == "onepole")
+		return new OnePoleKernel;
+	if (name == "follower")
+		return new FollowerKernel;
+	if (name == "delay")
+		return new DelayKernel;
+	if (name == "wavetable")
+		return new WavetableKernel;
+	if (name == "sine")
+		return new SineKernel;
+	if (name == "saw")
+		return new SawKernel;
+	if (name == "square")
+		return new SquareKernel;
+	if (name == "noise")
+		return new NoiseKernel;
+	if (name == "convolver")
+		return new ConvolverKernel;
+	if (name == "tanh")
+		return new TanhKernel;
+	if (name == "sin")
+		return new SinKernel;
+	if (name == "exp2")
+		return new Exp2Kernel;
+	return NULL;
+}
+
+void processKernel(Kernel* kernel, const float* in, float* out, int n) {
+	kernel->process(in, out, n);
+}
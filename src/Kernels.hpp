@@ -0,0 +1,41 @@
+#pragma once
+#include <rack.hpp>
+
+
+/** A native DSP routine that scripts run over a whole buffer in one call.
+Frequencies are in cycles per sample, i.e. `hz * block.sampleTime`.
+Times are in samples.
+*/
+struct Kernel {
+	virtual ~Kernel() {}
+	/** Sets the kernel's parameters in order. Missing parameters keep their previous values. */
+	virtual void setParams(const float* params, int numParams) {}
+	/** Copies an array such as a wavetable into the kernel. */
+	virtual void load(const float* data, int size) {}
+	/** Loads an audio file such as an impulse response in the background, resampled to `sampleRate`. */
+	virtual void loadFile(const std::string& path, float sampleRate) {}
+	/** Processes `n` samples.
+	`in` may be NULL for generators, in which case their frequency parameter is used for every sample.
+	`in` may equal `out`.
+	*/
+	virtual void process(const float* in, float* out, int n) = 0;
+};
+
+
+/** Returns a new kernel, or NULL if the name is unknown.
+Names and parameters:
+- biquad: type (0-8, see rack::dsp::BiquadFilter::Type), frequency, Q, gain
+- svf: frequency, Q, mode (0 lowpass, 1 bandpass, 2 highpass)
+- onepole: frequency
+- follower: attack time, release time
+- delay: delay time (fractional, 2 to 131068 samples), feedback
+- wavetable: frequency (load() the table)
+- sine, saw: frequency
+- square: frequency, pulse width
+- noise: (none)
+- convolver: wet gain, dry gain. load() an impulse response or loadFile() a WAV file. Latency is 64 samples.
+- tanh, sin, exp2: (none) Stateless approximations. `sin` takes its input in cycles.
+*/
+Kernel* createKernel(const std::string& name);
+/** Calls `kernel->process()` without a virtual call at the call site, for binding as a C function pointer. */
+void processKernel(Kernel* kernel, const float* in, float* out, int n);
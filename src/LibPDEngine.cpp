@@ -1,58 +1,79 @@
 #include "ScriptEngine.hpp"
 #include "z_libpd.h"
-#include "util/z_print_util.h"
+#include <cstring>
 using namespace rack;
 
-static const int BUFFERSIZE = MAX_BUFFER_SIZE * NUM_ROWS;
+/** Longest line of [print toRack] output, and longest display text */
+static const int MAX_PRINT_LENGTH = 1024;
+/** Most atoms parsed from a line of [print toRack] output */
+static const int MAX_PRINT_ATOMS = 64;
 
+static const char* const KNOB_NAMES[NUM_ROWS] = {"K1", "K2", "K3", "K4", "K5", "K6"};
+static const char* const SWITCH_NAMES[NUM_ROWS] = {"S1", "S2", "S3", "S4", "S5", "S6"};
 
-// there is no multi-instance support for receiving messages from libpd
-// for now, received values for the prototype gui will be stored in global variables
 
-static float g_lights[NUM_ROWS][3] = {};
-static float g_switchLights[NUM_ROWS][3] = {};
-static std::string g_utility[2] = {};
-static bool g_display_is_valid = false;
+struct LibPDEngine;
 
-static std::vector<std::string> split(const std::string& s, char delim) {
-	std::vector<std::string> result;
-	std::stringstream ss(s);
-	std::string item;
+// libpd's receive hooks are global, but an instance is only processed by the thread that selected it.
+// So the hooks pass messages to the engine that the calling thread selected last.
+static thread_local LibPDEngine* g_current = NULL;
 
-	while (getline(ss, item, delim)) {
-		result.push_back(item);
-	}
 
-	return result;
+/** Returns the row of a name like "L1" to "L6" with the given prefix, or -1. */
+static int parseRowName(const char* name, char prefix) {
+	if (name[0] != prefix || name[1] < '1' || name[1] >= '1' + NUM_ROWS || name[2] != '\0')
+		return -1;
+	return name[1] - '1';
 }
 
 
 struct LibPDEngine : ScriptEngine {
 	t_pdinstance* _lpd = NULL;
+	/** Binding of the "toRack" receiver in this engine's instance */
+	void* _to_rack = NULL;
 	int _pd_block_size = 64;
 	int _sampleRate = 0;
 	int _ticks = 0;
+	/** Whether the patch is being loaded, when it can set config properties */
 	bool _init = true;
 
 	float _old_knobs[NUM_ROWS] = {};
 	bool  _old_switches[NUM_ROWS] = {};
-	float _output[BUFFERSIZE] = {};
-	float _input[BUFFERSIZE] = {};//  = (float*)malloc(1024*2*sizeof(float));
-	const static std::map<std::string, int> _light_map;
-	const static std::map<std::string, int> _switchLight_map;
-	const static std::map<std::string, int> _utility_map;
+	/** Non-interleaved staging for one Pd block, since ProcessBlock rows are MAX_BUFFER_SIZE apart */
+	float* _input = NULL;
+	float* _output = NULL;
+	/** Print output received so far, up to the end of the current line */
+	char _print_buffer[MAX_PRINT_LENGTH] = {};
+	int _print_length = 0;
+	/** Text to display after the current libpd call, if `_display_is_valid` */
+	char _display_text[MAX_PRINT_LENGTH] = {};
+	bool _display_is_valid = false;
 
 	~LibPDEngine() {
-		if (_lpd)
+		delete[] _input;
+		delete[] _output;
+		if (_lpd) {
+			select();
+			if (_to_rack)
+				libpd_unbind(_to_rack);
 			libpd_free_instance(_lpd);
+		}
+		if (g_current == this)
+			g_current = NULL;
 	}
 
+	void select();
 	void sendInitialStates(const ProcessBlock* block);
-	static void receiveLights(const char* s);
+	void receive(const char* selector, int argc, t_atom* argv);
+	void receivePrintLine(char* line);
+	static void receivePrint(const char* s);
+	static void receiveMessage(const char* recv, const char* msg, int argc, t_atom* argv);
+	static void receiveList(const char* recv, int argc, t_atom* argv);
 	bool knobChanged(const float* knobs, int idx);
 	bool switchChanged(const bool* knobs, int idx);
 	void sendKnob(const int idx, const float value);
 	void sendSwitch(const int idx, const bool value);
+	void updateDisplay();
 
 	std::string getEngineName() override {
 		return "Pure Data";
@@ -61,21 +82,21 @@ struct LibPDEngine : ScriptEngine {
 	int run(const std::string& path, const std::string& script) override {
 		ProcessBlock* block = getProcessBlock();
 		_sampleRate = block->sampleRate;
-		setBufferSize(_pd_block_size);
 		setFrameDivider(1);
 		libpd_init();
 		_lpd = libpd_new_instance();
+		select();
+		_pd_block_size = libpd_blocksize();
+		setBufferSize(_pd_block_size);
+		_input = new float[NUM_ROWS * _pd_block_size]();
+		_output = new float[NUM_ROWS * _pd_block_size]();
 
-		libpd_set_printhook((t_libpd_printhook)libpd_print_concatenator);
-		libpd_set_concatenated_printhook(receiveLights);
-
-		if (libpd_num_instances() > 2) {
-			display("Multiple simultaneous libpd (Pure Data) instances not yet supported.");
-			return -1;
-		}
+		libpd_set_printhook(receivePrint);
+		libpd_set_messagehook(receiveMessage);
+		libpd_set_listhook(receiveList);
 
-		//display(std::to_string(libpd_num_instances()));
 		libpd_init_audio(NUM_ROWS, NUM_ROWS, _sampleRate);
+		_to_rack = libpd_bind("toRack");
 
 		// compute audio    [; pd dsp 1(
 		libpd_start_message(1); // one enstry in list
@@ -91,8 +112,15 @@ struct LibPDEngine : ScriptEngine {
 		std::string name = string::filename(path);
 		std::string dir  = string::directory(path);
 		libpd_openfile(name.c_str(), dir.c_str());
+		_init = false;
+
+		// Process whole Pd blocks, several per call if the patch set a larger bufferSize
+		_ticks = clamp(block->bufferSize / _pd_block_size, 1, MAX_BUFFER_SIZE / _pd_block_size);
+		setBufferSize(_ticks * _pd_block_size);
 
 		sendInitialStates(block);
+		// Display text sent by the patch on load
+		updateDisplay();
 
 		return 0;
 	}
@@ -101,34 +129,15 @@ struct LibPDEngine : ScriptEngine {
 		// block
 		ProcessBlock* block = getProcessBlock();
 
-		// get samples prototype
-		int rows = NUM_ROWS;
-		for (int s = 0; s < _pd_block_size; s++) {
-			for (int r = 0; r < rows; r++) {
-				_input[s * rows + r] = block->inputs[r][s];
-			}
-		}
-
-		libpd_set_instance(_lpd);
+		select();
 
+		// Knob and switch changes are sent once for all ticks
 		// knobs
 		for (int i = 0; i < NUM_ROWS; i++) {
 			if (knobChanged(block->knobs, i)) {
 				sendKnob(i, block->knobs[i]);
 			}
 		}
-		// lights
-		for (int i = 0; i < NUM_ROWS; i++) {
-			block->lights[i][0] = g_lights[i][0];
-			block->lights[i][1] = g_lights[i][1];
-			block->lights[i][2] = g_lights[i][2];
-		}
-		// switch lights
-		for (int i = 0; i < NUM_ROWS; i++) {
-			block->switchLights[i][0] = g_switchLights[i][0];
-			block->switchLights[i][1] = g_switchLights[i][1];
-			block->switchLights[i][2] = g_switchLights[i][2];
-		}
 		// switches
 		for (int i = 0; i < NUM_ROWS; i++) {
 			if (switchChanged(block->switches, i)) {
@@ -136,120 +145,142 @@ struct LibPDEngine : ScriptEngine {
 			}
 		}
 
-		// display
-		if (g_display_is_valid) {
-			display(g_utility[1]);
-			g_display_is_valid = false;
-		}
 		// process samples in libpd
-		_ticks = 1;
-		libpd_process_float(_ticks, _input, _output);
-
-		// return samples to prototype
-		for (int s = 0; s < _pd_block_size; s++) {
-			for (int r = 0; r < rows; r++) {
-				block->outputs[r][s] = _output[s * rows + r]; // scale up again to +-5V signal
-				// there is a correction multiplier, because libpd's output is too quiet(?)
-			}
+		// Lights and display messages from the patch are received during these calls
+		for (int t = 0; t < _ticks; t++) {
+			int offset = t * _pd_block_size;
+			for (int r = 0; r < NUM_ROWS; r++)
+				std::memcpy(&_input[r * _pd_block_size], &block->inputs[r][offset], sizeof(float) * _pd_block_size);
+			libpd_process_raw(_input, _output);
+			for (int r = 0; r < NUM_ROWS; r++)
+				std::memcpy(&block->outputs[r][offset], &_output[r * _pd_block_size], sizeof(float) * _pd_block_size);
 		}
 
+		// display
+		updateDisplay();
+
 		return 0;
 	}
 };
 
 
-void LibPDEngine::receiveLights(const char* s) {
-	std::string str = std::string(s);
-	std::vector<std::string> atoms = split(str, ' ');
+/** Makes this engine's instance current on the calling thread, for libpd calls and the receive hooks. */
+void LibPDEngine::select() {
+	libpd_set_instance(_lpd);
+	g_current = this;
+}
 
-	if (atoms[0] == "toRack:") {
-		// parse lights list
-		bool light_is_valid = true;
-		int light_idx = -1;
-		try {
-			light_idx = _light_map.at(atoms[1]);      // map::at throws an out-of-range
-		}
-		catch (const std::out_of_range& oor) {
-			light_is_valid = false;
-			//display("Warning:"+atoms[1]+" not found!");
-		}
-		//std::cout << v[1] << ", " << g_led_map[v[1]] << std::endl;
-		if (light_is_valid && atoms.size() == 5) {
-			g_lights[light_idx][0] = stof(atoms[2]); // red
-			g_lights[light_idx][1] = stof(atoms[3]); // green
-			g_lights[light_idx][2] = stof(atoms[4]); // blue
-		}
-		else {
-			// error
-		}
-		// parse switch lights list
-		bool switchLight_is_valid = true;
-		int switchLight_idx = -1;
-		try {
-			switchLight_idx = _switchLight_map.at(atoms[1]);      // map::at throws an out-of-range
-		}
-		catch (const std::out_of_range& oor) {
-			switchLight_is_valid = false;
-			//display("Warning:"+atoms[1]+" not found!");
-		}
-		//std::cout << v[1] << ", " << g_led_map[v[1]] << std::endl;
-		if (switchLight_is_valid && atoms.size() == 5) {
-			g_switchLights[switchLight_idx][0] = stof(atoms[2]); // red
-			g_switchLights[switchLight_idx][1] = stof(atoms[3]); // green
-			g_switchLights[switchLight_idx][2] = stof(atoms[4]); // blue
+/** Handles a message to "toRack", like [L1 r g b(, [S1 r g b(, [display text(, or [config bufferSize 256( while the patch is loading.
+Does not allocate, since it is called on the audio thread.
+*/
+void LibPDEngine::receive(const char* selector, int argc, t_atom* argv) {
+	ProcessBlock* block = getProcessBlock();
+	int idx = parseRowName(selector, 'L');
+	if (idx >= 0) {
+		for (int c = 0; c < 3 && c < argc; c++)
+			block->lights[idx][c] = libpd_is_float(&argv[c]) ? libpd_get_float(&argv[c]) : 0.f;
+		return;
+	}
+	idx = parseRowName(selector, 'S');
+	if (idx >= 0) {
+		for (int c = 0; c < 3 && c < argc; c++)
+			block->switchLights[idx][c] = libpd_is_float(&argv[c]) ? libpd_get_float(&argv[c]) : 0.f;
+		return;
+	}
+	if (std::strcmp(selector, "config") == 0) {
+		if (_init && argc >= 2 && libpd_is_symbol(&argv[0]) && libpd_is_float(&argv[1])) {
+			int index = (argc >= 3 && libpd_is_float(&argv[2])) ? (int) libpd_get_float(&argv[2]) : 0;
+			setConfig(libpd_get_symbol(&argv[0]), libpd_get_float(&argv[1]), index);
 		}
-		else {
-			// error
+		return;
+	}
+	if (std::strcmp(selector, "display") == 0) {
+		// Join the atoms with spaces
+		int length = 0;
+		_display_text[0] = '\0';
+		for (int i = 0; i < argc && length < MAX_PRINT_LENGTH - 1; i++) {
+			const char* separator = (i > 0) ? " " : "";
+			int n;
+			if (libpd_is_float(&argv[i]))
+				n = std::snprintf(_display_text + length, MAX_PRINT_LENGTH - length, "%s%g", separator, libpd_get_float(&argv[i]));
+			else if (libpd_is_symbol(&argv[i]))
+				n = std::snprintf(_display_text + length, MAX_PRINT_LENGTH - length, "%s%s", separator, libpd_get_symbol(&argv[i]));
+			else
+				continue;
+			length = std::min(length + std::max(n, 0), MAX_PRINT_LENGTH - 1);
 		}
+		_display_is_valid = true;
+	}
+}
 
-		// parse switch lights list
-		bool utility_is_valid = true;
-		try {
-			_utility_map.at(atoms[1]);      // map::at throws an out-of-range
-		}
-		catch (const std::out_of_range& oor) {
-			utility_is_valid = false;
-			//g_display_is_valid = true;
-			//display("Warning:"+atoms[1]+" not found!");
-		}
-		//std::cout << v[1] << ", " << g_led_map[v[1]] << std::endl;
-		if (utility_is_valid && atoms.size() >= 3) {
-			g_utility[0] = atoms[1]; // display
-			g_utility[1] = "";
-			for (unsigned i = 0; i < atoms.size() - 2; i++) {
-				g_utility[1] += " " + atoms[i + 2]; // concatenate message
-			}
-			g_display_is_valid = true;
-		}
-		else {
-			// error
-		}
+/** Handles a line of print output. Lines from [print toRack] are treated like messages to [s toRack], for patches written before it was supported. */
+void LibPDEngine::receivePrintLine(char* line) {
+	const char* prefix = "toRack:";
+	size_t prefixLength = std::strlen(prefix);
+	if (std::strncmp(line, prefix, prefixLength) != 0) {
+		WARN("Prototype libpd: %s", line);
+		return;
 	}
-	else {
-		bool utility_is_valid = true;
-		int utility_idx = -1;
-		try {
-			utility_idx = _utility_map.at(atoms[0]);      // map::at throws an out-of-range
+
+	// Split into words in place
+	char* words[MAX_PRINT_ATOMS + 1];
+	int count = 0;
+	for (char* p = line + prefixLength; *p && count < MAX_PRINT_ATOMS + 1;) {
+		if (*p == ' ') {
+			*p++ = '\0';
+			continue;
 		}
-		catch (const std::out_of_range& oor) {
-			WARN("Prototype libpd: %s", s);
-			utility_is_valid = false;
-			//display("Warning:"+atoms[1]+" not found!");
-			// print out on command line
+		words[count++] = p;
+		while (*p && *p != ' ')
+			p++;
+	}
+	if (count < 1)
+		return;
+
+	t_atom atoms[MAX_PRINT_ATOMS];
+	for (int i = 1; i < count; i++) {
+		char* end;
+		float f = std::strtof(words[i], &end);
+		if (*end == '\0')
+			libpd_set_float(&atoms[i - 1], f);
+		else
+			libpd_set_symbol(&atoms[i - 1], words[i]);
+	}
+	receive(words[0], count - 1, atoms);
+}
+
+void LibPDEngine::receivePrint(const char* s) {
+	LibPDEngine* that = g_current;
+	if (!that)
+		return;
+	// Pd prints a line in several pieces
+	for (; *s; s++) {
+		if (*s == '\n') {
+			that->_print_buffer[that->_print_length] = '\0';
+			that->_print_length = 0;
+			that->receivePrintLine(that->_print_buffer);
 		}
-		if (utility_is_valid) {
-			switch (utility_idx) {
-				case 1:
-					WARN("Prototype libpd: %s", s);
-					break;
-
-				default:
-					break;
-			}
+		else if (that->_print_length < MAX_PRINT_LENGTH - 1) {
+			that->_print_buffer[that->_print_length++] = *s;
 		}
 	}
 }
 
+void LibPDEngine::receiveMessage(const char* recv, const char* msg, int argc, t_atom* argv) {
+	if (!g_current || std::strcmp(recv, "toRack") != 0)
+		return;
+	g_current->receive(msg, argc, argv);
+}
+
+void LibPDEngine::receiveList(const char* recv, int argc, t_atom* argv) {
+	if (!g_current || std::strcmp(recv, "toRack") != 0)
+		return;
+	// A list starting with a symbol, like [list L1 1 0 0(, is handled like a message
+	if (argc < 1 || !libpd_is_symbol(&argv[0]))
+		return;
+	g_current->receive(libpd_get_symbol(&argv[0]), argc - 1, argv + 1);
+}
+
 bool LibPDEngine::knobChanged(const float* knobs, int i) {
 	bool knob_changed = false;
 	if (_old_knobs[i] != knobs[i]) {
@@ -268,64 +299,32 @@ bool LibPDEngine::switchChanged(const bool* switches, int i) {
 	return switch_changed;
 }
 
-const std::map<std::string, int> LibPDEngine::_light_map{
-	{ "L1", 0 },
-	{ "L2", 1 },
-	{ "L3", 2 },
-	{ "L4", 3 },
-	{ "L5", 4 },
-	{ "L6", 5 }
-};
-
-const std::map<std::string, int> LibPDEngine::_switchLight_map{
-	{ "S1", 0 },
-	{ "S2", 1 },
-	{ "S3", 2 },
-	{ "S4", 3 },
-	{ "S5", 4 },
-	{ "S6", 5 }
-};
-
-const std::map<std::string, int> LibPDEngine::_utility_map{
-	{ "display", 0 },
-	{ "error:", 1 }
-};
-
 
 void LibPDEngine::sendKnob(const int idx, const float value) {
-	std::string knob = "K" + std::to_string(idx + 1);
 	libpd_start_message(1);
 	libpd_add_float(value);
-	libpd_finish_message("fromRack", knob.c_str());
+	libpd_finish_message("fromRack", KNOB_NAMES[idx]);
 }
 
 void LibPDEngine::sendSwitch(const int idx, const bool value) {
-	std::string sw = "S" + std::to_string(idx + 1);
 	libpd_start_message(1);
 	libpd_add_float(value);
-	libpd_finish_message("fromRack", sw.c_str());
+	libpd_finish_message("fromRack", SWITCH_NAMES[idx]);
+}
+
+void LibPDEngine::updateDisplay() {
+	if (_display_is_valid) {
+		display(_display_text);
+		_display_is_valid = false;
+	}
 }
 
 void LibPDEngine::sendInitialStates(const ProcessBlock* block) {
 	// knobs
 	for (int i = 0; i < NUM_ROWS; i++) {
 		sendKnob(i, block->knobs[i]);
-		sendSwitch(i, block->knobs[i]);
+		sendSwitch(i, block->switches[i]);
 	}
-
-	for (int i = 0; i < NUM_ROWS; i++) {
-		g_lights[i][0] = 0;
-		g_lights[i][1] = 0;
-		g_lights[i][2] = 0;
-		g_switchLights[i][0] = 0;
-		g_switchLights[i][1] = 0;
-		g_switchLights[i][2] = 0;
-	}
-
-	//g_utility[0] = "";
-	//g_utility[1] = "";
-
-	//g_display_is_valid = false;
 }
 
 
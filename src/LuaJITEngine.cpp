@@ -1,4 +1,9 @@
 #include "ScriptEngine.hpp"
+#include "Kernels.hpp"
+#include "Samples.hpp"
+#include "Streams.hpp"
+#include "Buffers.hpp"
+#include "Buses.hpp"
 #include <luajit-2.0/lua.hpp>
 
 
@@ -11,15 +16,171 @@ struct LuaJITEngine : ScriptEngine {
 		float sampleRate;
 		float sampleTime;
 		int bufferSize;
+		double frame;
 		float* inputs[NUM_ROWS + 1];
 		float* outputs[NUM_ROWS + 1];
 		float* knobs;
 		bool* switches;
+		int* rowBufferSizes;
 		float* lights[NUM_ROWS + 1];
 		float* switchLights[NUM_ROWS + 1];
+		float* knobBuffers[NUM_ROWS + 1];
+		bool* switchBuffers[NUM_ROWS + 1];
+		int* inputEventCounts;
+		int* inputEventOffsets[NUM_ROWS + 1];
+		uint8_t* inputEventTypes[NUM_ROWS + 1];
+		int* outputEventCounts;
+		int* outputEventOffsets[NUM_ROWS + 1];
+		uint8_t* outputEventTypes[NUM_ROWS + 1];
+		int batchSize;
+		float* batchKnobs[NUM_ROWS + 1];
+		bool* batchSwitches[NUM_ROWS + 1];
+		float* batchLights[NUM_ROWS + 1];
+		float* batchSwitchLights[NUM_ROWS + 1];
 	};
 
 	LuaProcessBlock luaBlock;
+	/** 1-based copies of the block's input event offsets, since the block is shared with the host and other chain stages */
+	std::vector<int> inputEventOffsets;
+	/** Whether the input event offsets of the current block have been copied */
+	bool blockPrepared = false;
+	/** Output event counts before the current Lua call, since earlier chain stages write 0-based offsets to the same block */
+	int outputEventStarts[NUM_ROWS] = {};
+
+	// Lua side of the scheduler and kernel APIs.
+	// Scheduled callbacks are kept in __callbacks by id so the host can call them with processScheduled().
+	// Coroutines started with spawn() are resumed after the number of frames passed to wait().
+	const std::string preludeScript = R"(
+__callbacks = {}
+function schedule(frame, callback)
+	local id = __schedule(frame, 0)
+	__callbacks[id] = callback
+	return id
+end
+function scheduleEvery(period, callback, frame)
+	period = math.max(period, 1)
+	frame = frame or now() + period
+	local id = __schedule(frame, period)
+	__callbacks[id] = callback
+	return id
+end
+function cancel(id)
+	__cancel(id)
+	__callbacks[id] = nil
+end
+function spawn(f)
+	local co = coroutine.create(f)
+	local function resume(frame)
+		schedule(frame, function(block, offset)
+			local ok, frames = coroutine.resume(co, block, offset)
+			if not ok then error(frames, 0) end
+			if coroutine.status(co) ~= "dead" then
+				resume(frame + math.max(math.floor(tonumber(frames) or 1), 1))
+			end
+		end)
+	end
+	resume(now())
+end
+wait = coroutine.yield
+
+-- Buffers in block are pointers offset by -1, so they are shifted back before calling native kernels.
+local KernelMeta = {}
+KernelMeta.__index = KernelMeta
+function Kernel(name)
+	local ptr = __kernelCreate(name)
+	if not ptr then error("Unknown kernel " .. tostring(name), 2) end
+	return setmetatable({ptr = ptr}, KernelMeta)
+end
+function KernelMeta:set(...)
+	__kernelSet(self.ptr, ...)
+end
+function KernelMeta:load(t)
+	__kernelLoad(self.ptr, t)
+end
+function KernelMeta:process(input, output, n)
+	_processKernel(self.ptr, input and input + 1, output + 1, n)
+end
+
+-- Sample channels are const FFI pointers into the read-only shared sample data, offset by -1 like block buffers.
+local SampleMeta = {}
+SampleMeta.__index = SampleMeta
+function Sample(path)
+	return setmetatable({id = __sampleLoad(path), channels = {}, frames = 0, sampleRate = 0}, SampleMeta)
+end
+function SampleMeta:ready()
+	if #self.channels > 0 then return true end
+	local data, channels, frames, sampleRate = __sampleInfo(self.id)
+	if not data then return false end
+	local p = ffi.cast("const float*", data)
+	for c = 1, channels do
+		self.channels[c] = p + (c - 1) * frames - 1
+	end
+	self.frames = frames
+	self.sampleRate = sampleRate
+	return true
+end
+
+-- Recorder and Player take buffers offset by -1 like block buffers, and a number of interleaved samples.
+local RecorderMeta = {}
+RecorderMeta.__index = RecorderMeta
+function Recorder(path, channels, sampleRate)
+	return setmetatable({ptr = __streamOpen(path, true, channels or 1, sampleRate or 0, false)}, RecorderMeta)
+end
+function RecorderMeta:write(data, n)
+	return _writeStream(self.ptr, data + 1, n)
+end
+function RecorderMeta:close()
+	__streamClose(self.ptr)
+end
+local PlayerMeta = {}
+PlayerMeta.__index = PlayerMeta
+function Player(path, channels, loop)
+	return setmetatable({ptr = __streamOpen(path, false, channels or 1, 0, loop or false)}, PlayerMeta)
+end
+function PlayerMeta:read(data, n)
+	return _readStream(self.ptr, data + 1, n)
+end
+function PlayerMeta:ended()
+	return __streamEnded(self.ptr)
+end
+function PlayerMeta:close()
+	__streamClose(self.ptr)
+end
+
+-- Pooled buffers are FFI pointers offset by -1 like block buffers, so they are indexed from 1 to size.
+function getBuffer(name, size)
+	local data = __bufferGet(tostring(name), size)
+	if not data then error("Could not allocate buffer " .. tostring(name), 2) end
+	return ffi.cast("float*", data) - 1
+end
+
+local WorkersMeta = {}
+WorkersMeta.__index = WorkersMeta
+function Workers(path, count)
+	local id = __workersCreate(path, count or 1)
+	if id < 0 then error("Could not create workers " .. tostring(path), 2) end
+	return setmetatable({id = id}, WorkersMeta)
+end
+function WorkersMeta:fork()
+	return __workersFork(self.id)
+end
+function WorkersMeta:join(timeout)
+	return __workersJoin(self.id, timeout)
+end
+
+-- Bus data is an FFI pointer offset by -1, so channel c of the current block is data[offset(c) + 1] to data[offset(c) + frames].
+local BusMeta = {}
+BusMeta.__index = BusMeta
+function Bus(name, channels, publish, delay)
+	channels = channels or 1
+	local id, data, frames = __busOpen(tostring(name), channels, publish or false, delay or 0)
+	if id < 0 then error("Could not open bus " .. tostring(name), 2) end
+	return setmetatable({id = id, data = ffi.cast("float*", data) - 1, channels = channels, frames = frames}, BusMeta)
+end
+function BusMeta:offset(c)
+	return __busOffset(self.id, c - 1)
+end
+)";
 
 	~LuaJITEngine() {
 		if (L)
@@ -32,18 +193,32 @@ struct LuaJITEngine : ScriptEngine {
 
 	int run(const std::string& path, const std::string& script) override {
 		ProcessBlock* block = getProcessBlock();
+		inputEventOffsets.resize(NUM_ROWS * MAX_BUFFER_SIZE);
 
 		// Initialize all the pointers with an offset of -1
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Warray-bounds"
 		luaBlock.knobs = &block->knobs[-1];
 		luaBlock.switches = &block->switches[-1];
+		luaBlock.rowBufferSizes = &block->rowBufferSizes[-1];
+		luaBlock.inputEventCounts = &block->inputEventCounts[-1];
+		luaBlock.outputEventCounts = &block->outputEventCounts[-1];
 
 		for (int i = 0; i < NUM_ROWS; i++) {
 			luaBlock.inputs[i + 1] = &block->inputs[i][-1];
 			luaBlock.outputs[i + 1] = &block->outputs[i][-1];
 			luaBlock.lights[i + 1] = &block->lights[i][-1];
 			luaBlock.switchLights[i + 1] = &block->switchLights[i][-1];
+			luaBlock.knobBuffers[i + 1] = &block->knobBuffers[i][-1];
+			luaBlock.switchBuffers[i + 1] = &block->switchBuffers[i][-1];
+			luaBlock.inputEventOffsets[i + 1] = &inputEventOffsets[i * MAX_BUFFER_SIZE] - 1;
+			luaBlock.inputEventTypes[i + 1] = &block->inputEventTypes[i][-1];
+			luaBlock.outputEventOffsets[i + 1] = &block->outputEventOffsets[i][-1];
+			luaBlock.outputEventTypes[i + 1] = &block->outputEventTypes[i][-1];
+			luaBlock.batchKnobs[i + 1] = &block->batchKnobs[i][-1];
+			luaBlock.batchSwitches[i + 1] = &block->batchSwitches[i][-1];
+			luaBlock.batchLights[i + 1] = &block->batchLights[i][-1];
+			luaBlock.batchSwitchLights[i + 1] = &block->batchSwitchLights[i][-1];
 		}
 #pragma GCC diagnostic pop
 
@@ -82,15 +257,71 @@ struct LuaJITEngine : ScriptEngine {
 		lua_pushcfunction(L, native_display);
 		lua_setglobal(L, "display");
 
+		lua_pushcfunction(L, native_schedule);
+		lua_setglobal(L, "__schedule");
+		lua_pushcfunction(L, native_cancel);
+		lua_setglobal(L, "__cancel");
+		lua_pushcfunction(L, native_now);
+		lua_setglobal(L, "now");
+
+		lua_pushcfunction(L, native_kernel_create);
+		lua_setglobal(L, "__kernelCreate");
+		lua_pushcfunction(L, native_kernel_set);
+		lua_setglobal(L, "__kernelSet");
+		lua_pushcfunction(L, native_kernel_load);
+		lua_setglobal(L, "__kernelLoad");
+		// Kernel:process() calls this directly through the FFI to avoid the Lua C API in the inner loop
+		lua_pushlightuserdata(L, (void*) processKernel);
+		lua_setglobal(L, "__processKernel");
+
+		lua_pushcfunction(L, native_sample_load);
+		lua_setglobal(L, "__sampleLoad");
+		lua_pushcfunction(L, native_sample_info);
+		lua_setglobal(L, "__sampleInfo");
+
+		lua_pushcfunction(L, native_stream_open);
+		lua_setglobal(L, "__streamOpen");
+		lua_pushcfunction(L, native_stream_ended);
+		lua_setglobal(L, "__streamEnded");
+		lua_pushcfunction(L, native_stream_close);
+		lua_setglobal(L, "__streamClose");
+
+		lua_pushcfunction(L, native_buffer_get);
+		lua_setglobal(L, "__bufferGet");
+
+		lua_pushcfunction(L, native_workers_create);
+		lua_setglobal(L, "__workersCreate");
+		lua_pushcfunction(L, native_workers_fork);
+		lua_setglobal(L, "__workersFork");
+		lua_pushcfunction(L, native_workers_join);
+		lua_setglobal(L, "__workersJoin");
+		lua_pushinteger(L, workerIndex);
+		lua_setglobal(L, "workerIndex");
+
+		lua_pushcfunction(L, native_bus_open);
+		lua_setglobal(L, "__busOpen");
+		lua_pushcfunction(L, native_bus_offset);
+		lua_setglobal(L, "__busOffset");
+		// Recorder:write() and Player:read() are called every block, so they go through the FFI like Kernel:process()
+		lua_pushlightuserdata(L, (void*) writeStream);
+		lua_setglobal(L, "__writeStream");
+		lua_pushlightuserdata(L, (void*) readStream);
+		lua_setglobal(L, "__readStream");
+
 		// Set config
 		lua_newtable(L);
-		{
-			// frameDivider
-			lua_pushinteger(L, 32);
-			lua_setfield(L, -2, "frameDivider");
-			// bufferSize
-			lua_pushinteger(L, 1);
-			lua_setfield(L, -2, "bufferSize");
+		for (const ConfigKey& key : CONFIG_KEYS) {
+			if (key.size > 0) {
+				lua_createtable(L, key.size, 0);
+				for (int i = 0; i < key.size; i++) {
+					lua_pushnumber(L, key.defaultValue);
+					lua_rawseti(L, -2, i + 1);
+				}
+			}
+			else {
+				lua_pushnumber(L, key.defaultValue);
+			}
+			lua_setfield(L, -2, key.name);
 		}
 		lua_setglobal(L, "config");
 
@@ -104,18 +335,39 @@ struct LuaJITEngine : ScriptEngine {
 		<< "float sampleRate;" << std::endl
 		<< "float sampleTime;" << std::endl
 		<< "int bufferSize;" << std::endl
+		<< "double frame;" << std::endl
 		<< "float *inputs[" << NUM_ROWS + 1 << "];" << std::endl
 		<< "float *outputs[" << NUM_ROWS + 1 << "];" << std::endl
 		<< "float *knobs;" << std::endl
 		<< "bool *switches;" << std::endl
+		<< "int *rowBufferSizes;" << std::endl
 		<< "float *lights[" << NUM_ROWS + 1 << "];" << std::endl
 		<< "float *switchLights[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "float *knobBuffers[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "bool *switchBuffers[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "int *inputEventCounts;" << std::endl
+		<< "int *inputEventOffsets[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "uint8_t *inputEventTypes[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "int *outputEventCounts;" << std::endl
+		<< "int *outputEventOffsets[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "uint8_t *outputEventTypes[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "int batchSize;" << std::endl
+		<< "float *batchKnobs[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "bool *batchSwitches[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "float *batchLights[" << NUM_ROWS + 1 << "];" << std::endl
+		<< "float *batchSwitchLights[" << NUM_ROWS + 1 << "];" << std::endl
 		<< "};]]" << std::endl
 		// Declare the function `_castBlock` used to transform `luaBlock` pointer into a LuaJIT cdata
 		<< "_ffi_cast = ffi.cast" << std::endl
 		<< "function _castBlock(b) return _ffi_cast('struct LuaProcessBlock*', b) end" << std::endl
+		<< "_processKernel = ffi.cast('void (*)(void*, const float*, float*, int)', __processKernel)" << std::endl
+		<< "__processKernel = nil" << std::endl
+		<< "_writeStream = ffi.cast('int (*)(void*, const float*, int)', __writeStream)" << std::endl
+		<< "_readStream = ffi.cast('int (*)(void*, float*, int)', __readStream)" << std::endl
+		<< "__writeStream = nil; __readStream = nil" << std::endl
 		// Remove global functions that could be abused
-		<< "jit = nil; require = nil; ffi = nil; load = nil; loadfile = nil; loadstring = nil; dofile = nil;" << std::endl;
+		<< "jit = nil; require = nil; ffi = nil; load = nil; loadfile = nil; loadstring = nil; dofile = nil;" << std::endl
+		<< preludeScript;
 		std::string ffi_script = ffi_stream.str();
 
 		// Compile the ffi script
@@ -156,26 +408,26 @@ struct LuaJITEngine : ScriptEngine {
 
 		// Get config
 		lua_getglobal(L, "config");
-		{
-			// frameDivider
-			lua_getfield(L, -1, "frameDivider");
-			int frameDivider = lua_tointeger(L, -1);
-			setFrameDivider(frameDivider);
-			lua_pop(L, 1);
-			// bufferSize
-			lua_getfield(L, -1, "bufferSize");
-			int bufferSize = lua_tointeger(L, -1);
-			setBufferSize(bufferSize);
+		for (const ConfigKey& key : CONFIG_KEYS) {
+			lua_getfield(L, -1, key.name);
+			if (key.size > 0 && lua_istable(L, -1)) {
+				for (int i = 0; i < key.size; i++) {
+					lua_rawgeti(L, -1, i + 1);
+					if (lua_isnumber(L, -1))
+						setConfigIfChanged(key.name, lua_tonumber(L, -1), i);
+					lua_pop(L, 1);
+				}
+			}
+			else if (lua_isnumber(L, -1)) {
+				setConfigIfChanged(key.name, lua_tonumber(L, -1));
+			}
 			lua_pop(L, 1);
 		}
 		lua_pop(L, 1);
 
 		// Get process function
+		// This is optional when the script only uses scheduled callbacks, in which case nil is kept on the stack.
 		lua_getglobal(L, "process");
-		if (!lua_isfunction(L, -1)) {
-			display("No process() function");
-			return -1;
-		}
 
 		// Create block object
 		lua_getglobal(L, "_castBlock");
@@ -191,27 +443,120 @@ struct LuaJITEngine : ScriptEngine {
 		return 0;
 	}
 
-	int process() override {
+	/** Updates the values of the block.
+	The pointer values do not change.
+	*/
+	void updateBlock() {
 		ProcessBlock* block = getProcessBlock();
-
-		// Update the values of the block.
-		// The pointer values do not change.
 		luaBlock.sampleRate = block->sampleRate;
 		luaBlock.sampleTime = block->sampleTime;
 		luaBlock.bufferSize = block->bufferSize;
+		luaBlock.frame = block->frame;
+		luaBlock.batchSize = block->batchSize;
+
+		// Event offsets are 1-based in Lua, like buffer indices.
+		// process() is called last in each block and converts the output offsets written by the script back.
+		if (!blockPrepared) {
+			for (int i = 0; i < NUM_ROWS; i++) {
+				int count = rack::clamp(block->inputEventCounts[i], 0, MAX_BUFFER_SIZE);
+				for (int e = 0; e < count; e++)
+					inputEventOffsets[i * MAX_BUFFER_SIZE + e] = block->inputEventOffsets[i][e] + 1;
+			}
+			blockPrepared = true;
+		}
+	}
 
-		// Duplicate process function
-		lua_pushvalue(L, -2);
+	/** Records the output event counts before a Lua call. */
+	void beginOutputEvents() {
+		ProcessBlock* block = getProcessBlock();
+		for (int i = 0; i < NUM_ROWS; i++)
+			outputEventStarts[i] = rack::clamp(block->outputEventCounts[i], 0, MAX_BUFFER_SIZE);
+	}
+
+	/** Converts the 1-based offsets of the output events appended by a Lua call to 0-based. */
+	void endOutputEvents() {
+		ProcessBlock* block = getProcessBlock();
+		for (int i = 0; i < NUM_ROWS; i++) {
+			int count = rack::clamp(block->outputEventCounts[i], 0, MAX_BUFFER_SIZE);
+			for (int e = outputEventStarts[i]; e < count; e++)
+				block->outputEventOffsets[i][e]--;
+		}
+	}
+
+	int process() override {
+		updateBlock();
+		blockPrepared = false;
+
+		if (lua_isfunction(L, -2)) {
+			// Duplicate process function
+			lua_pushvalue(L, -2);
+			// Duplicate block
+			lua_pushvalue(L, -2);
+			// Call process function
+			beginOutputEvents();
+			int status = lua_pcall(L, 1, 0, 0);
+			endOutputEvents();
+			if (status) {
+				const char* err = lua_tostring(L, -1);
+				WARN("LuaJIT: %s", err);
+				display(err);
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	int processControl() override {
+		updateBlock();
+
+		lua_getglobal(L, "processControl");
+		if (!lua_isfunction(L, -1)) {
+			lua_pop(L, 1);
+			return 0;
+		}
 		// Duplicate block
 		lua_pushvalue(L, -2);
-		// Call process function
-		if (lua_pcall(L, 1, 0, 0)) {
+		beginOutputEvents();
+		int status = lua_pcall(L, 1, 0, 0);
+		endOutputEvents();
+		if (status) {
 			const char* err = lua_tostring(L, -1);
 			WARN("LuaJIT: %s", err);
 			display(err);
 			return -1;
 		}
+		return 0;
+	}
 
+	int processScheduled(int id, int offset, bool last) override {
+		updateBlock();
+
+		lua_getglobal(L, "__callbacks");
+		lua_rawgeti(L, -1, id);
+		if (last) {
+			lua_pushnil(L);
+			lua_rawseti(L, -3, id);
+		}
+		if (!lua_isfunction(L, -1)) {
+			lua_pop(L, 2);
+			return 0;
+		}
+		// Duplicate block
+		lua_pushvalue(L, -3);
+		// Buffer indices are 1-based
+		lua_pushinteger(L, offset + 1);
+		beginOutputEvents();
+		int status = lua_pcall(L, 2, 0, 0);
+		endOutputEvents();
+		if (status) {
+			const char* err = lua_tostring(L, -1);
+			WARN("LuaJIT: %s", err);
+			display(err);
+			lua_pop(L, 2);
+			return -1;
+		}
+		// __callbacks
+		lua_pop(L, 1);
 		return 0;
 	}
 
@@ -231,6 +576,160 @@ struct LuaJITEngine : ScriptEngine {
 	// 	return 0;
 	// }
 
+	static int native_schedule(lua_State* L) {
+		lua_Number frame = luaL_checknumber(L, 1);
+		lua_Number period = luaL_optnumber(L, 2, 0);
+		int id = getEngine(L)->schedule((int64_t) frame, (int64_t) period);
+		lua_pushinteger(L, id);
+		return 1;
+	}
+
+	static int native_cancel(lua_State* L) {
+		getEngine(L)->cancel(luaL_checkinteger(L, 1));
+		return 0;
+	}
+
+	static int native_now(lua_State* L) {
+		lua_pushnumber(L, (lua_Number) getEngine(L)->getFrame());
+		return 1;
+	}
+
+	static int native_kernel_create(lua_State* L) {
+		LuaJITEngine* engine = getEngine(L);
+		int id = engine->addKernel(luaL_checkstring(L, 1));
+		Kernel* kernel = engine->getKernel(id);
+		if (!kernel)
+			return 0;
+		lua_pushlightuserdata(L, kernel);
+		return 1;
+	}
+
+	static int native_kernel_set(lua_State* L) {
+		Kernel* kernel = (Kernel*) lua_touserdata(L, 1);
+		if (!kernel)
+			return luaL_error(L, "not a Kernel");
+		float params[16];
+		int numParams = std::min(lua_gettop(L) - 1, (int) LENGTHOF(params));
+		for (int i = 0; i < numParams; i++)
+			params[i] = luaL_checknumber(L, i + 2);
+		kernel->setParams(params, numParams);
+		return 0;
+	}
+
+	static int native_kernel_load(lua_State* L) {
+		Kernel* kernel = (Kernel*) lua_touserdata(L, 1);
+		if (!kernel)
+			return luaL_error(L, "not a Kernel");
+		// Audio file path
+		if (lua_type(L, 2) == LUA_TSTRING) {
+			LuaJITEngine* engine = getEngine(L);
+			kernel->loadFile(engine->resolvePath(lua_tostring(L, 2)), engine->getSampleRate());
+			return 0;
+		}
+		luaL_checktype(L, 2, LUA_TTABLE);
+		std::vector<float> values(lua_objlen(L, 2));
+		for (size_t i = 0; i < values.size(); i++) {
+			lua_rawgeti(L, 2, i + 1);
+			values[i] = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+		kernel->load(values.data(), values.size());
+		return 0;
+	}
+
+	static int native_sample_load(lua_State* L) {
+		lua_pushinteger(L, getEngine(L)->addSample(luaL_checkstring(L, 1)));
+		return 1;
+	}
+
+	/** Returns the data pointer, channels, frames, and sample rate, or nothing if the sample is not loaded yet. */
+	static int native_sample_info(lua_State* L) {
+		Sample* sample = getEngine(L)->getSample(luaL_checkinteger(L, 1));
+		if (!sample)
+			return 0;
+		lua_pushlightuserdata(L, const_cast<float*>(sample->data));
+		lua_pushinteger(L, sample->channels);
+		lua_pushinteger(L, sample->frames);
+		lua_pushnumber(L, sample->sampleRate);
+		return 4;
+	}
+
+	static int native_stream_open(lua_State* L) {
+		LuaJITEngine* engine = getEngine(L);
+		int id = engine->addStream(luaL_checkstring(L, 1), lua_toboolean(L, 2), luaL_optinteger(L, 3, 1), luaL_optnumber(L, 4, 0.0), lua_toboolean(L, 5));
+		lua_pushlightuserdata(L, engine->getStream(id));
+		return 1;
+	}
+
+	/** Returns the data pointer of a pooled buffer, or nothing if it could not be allocated. */
+	static int native_buffer_get(lua_State* L) {
+		std::shared_ptr<PooledBuffer> buffer = getEngine(L)->getBuffer(luaL_checkstring(L, 1), luaL_checkinteger(L, 2));
+		if (!buffer)
+			return 0;
+		lua_pushlightuserdata(L, buffer->data);
+		return 1;
+	}
+
+	static int native_workers_create(lua_State* L) {
+		lua_pushinteger(L, getEngine(L)->addWorkers(luaL_checkstring(L, 1), luaL_optinteger(L, 2, 1)));
+		return 1;
+	}
+
+	static int native_workers_fork(lua_State* L) {
+		int started = getEngine(L)->forkWorkers(luaL_checkinteger(L, 1));
+		if (started < 0)
+			return luaL_error(L, "not a Workers");
+		lua_pushinteger(L, started);
+		return 1;
+	}
+
+	static int native_workers_join(lua_State* L) {
+		int joined = getEngine(L)->joinWorkers(luaL_checkinteger(L, 1), luaL_optnumber(L, 2, -1.0));
+		if (joined < 0)
+			return luaL_error(L, "not a Workers");
+		lua_pushinteger(L, joined);
+		return 1;
+	}
+
+	/** Returns the id, data pointer, and frames of the bus, or -1 on failure. */
+	static int native_bus_open(lua_State* L) {
+		LuaJITEngine* engine = getEngine(L);
+		int id = engine->addBus(luaL_checkstring(L, 1), luaL_checkinteger(L, 2), lua_toboolean(L, 3), luaL_optinteger(L, 4, 0));
+		lua_pushinteger(L, id);
+		BusPort* port = engine->getBus(id);
+		if (!port)
+			return 1;
+		lua_pushlightuserdata(L, port->bus->memory.data);
+		lua_pushinteger(L, port->bus->frames);
+		return 3;
+	}
+
+	static int native_bus_offset(lua_State* L) {
+		BusPort* port = getEngine(L)->getBus(luaL_checkinteger(L, 1));
+		if (!port)
+			return luaL_error(L, "not a Bus");
+		int offset = port->getOffset(luaL_checkinteger(L, 2));
+		if (offset < 0)
+			return luaL_error(L, "invalid bus channel");
+		lua_pushinteger(L, offset);
+		return 1;
+	}
+
+	static int native_stream_ended(lua_State* L) {
+		Stream* stream = (Stream*) lua_touserdata(L, 1);
+		if (!stream)
+			return luaL_error(L, "not a Player");
+		lua_pushboolean(L, stream->isEnded());
+		return 1;
+	}
+
+	static int native_stream_close(lua_State* L) {
+		Stream* stream = (Stream*) lua_touserdata(L, 1);
+		if (stream)
+			stream->close();
+		return 0;
+	}
+
 	static int native_display(lua_State* L) {
 		lua_getglobal(L, "tostring");
 		lua_pushvalue(L, 1);
@@ -6,6 +6,16 @@
 #include <thread>
 #include <mutex>
 #include "ScriptEngine.hpp"
+#include "Kernels.hpp"
+#include "Spectral.hpp"
+#include "Resampler.hpp"
+#include "Samples.hpp"
+#include "Streams.hpp"
+#include "Buffers.hpp"
+#include "Workers.hpp"
+#include "Batch.hpp"
+#include "Buses.hpp"
+#include "Remote.hpp"
 #include <efsw/efsw.h>
 #if defined ARCH_WIN
 	#include <windows.h>
@@ -158,6 +168,61 @@ struct Prototype : Module {
 	ProcessBlock* block;
 	int bufferIndex = 0;
 
+	// Input events
+	float triggerLow;
+	float triggerHigh;
+	bool inputHigh[NUM_ROWS] = {};
+	// Output events
+	bool outputHigh[NUM_ROWS] = {};
+	int outputPulseFrames[NUM_ROWS] = {};
+	// Per-sample knobs
+	int knobSmoothing;
+	float knobSmoothingTime;
+	float smoothedKnobs[NUM_ROWS] = {};
+	bool smoothedKnobsInitialized = false;
+	// Control rate
+	int controlDivider;
+	int controlFrame = 0;
+	int rowDividers[NUM_ROWS];
+	// Scheduler
+	struct ScheduledEvent {
+		int id;
+		int64_t frame;
+		int64_t period;
+		/** Engine that scheduled the callback, which is a stage of the module's engine in a chain */
+		ScriptEngine* engine;
+	};
+	/** Sorted by frame */
+	std::vector<ScheduledEvent> scheduledEvents;
+	int nextScheduledId = 1;
+	/** Frame of the running scheduled callback, or -1 */
+	int64_t scheduledFrame = -1;
+	// Spectral mode
+	int fftSize;
+	int hopSize;
+	int spectralWindow;
+	/** STFT stage that replaces the time-domain block when config.spectral is enabled */
+	Spectral* spectral = NULL;
+	// Resampling
+	int oversample;
+	int antiAliasing;
+	/** Interpolates inputs when oversampling, or outputs when decimating with anti-aliasing */
+	Upsampler* upsampler = NULL;
+	/** Decimates outputs when oversampling, or inputs when decimating with anti-aliasing */
+	Downsampler* downsampler = NULL;
+	/** Named buffers requested by scripts, kept across reloads */
+	BufferPool bufferPool;
+	// Batch mode
+	int batch;
+	/** Group whose engine replaces `scriptEngine` when config.batch is enabled */
+	std::shared_ptr<BatchGroup> batchGroup;
+	int batchSlot = -1;
+	/** Config set by the script while it runs, applied to the modules that join its batch group */
+	std::vector<BatchConfig> scriptConfig;
+	bool recordingConfig = false;
+	/** Runs the script in a helper process, set from the context menu */
+	bool remote = false;
+
 	efsw_watcher efsw = NULL;
 
 	/** Script that has not yet been approved to load */
@@ -177,11 +242,16 @@ struct Prototype : Module {
 		// 	configOutput(OUT_OUTPUTS + i, string::f("#%d", i + 1));
 
 		block = new ProcessBlock;
+		// Avoid allocating on the audio thread for typical numbers of scheduled callbacks
+		scheduledEvents.reserve(256);
 		setPath("");
 	}
 
 	~Prototype() {
 		setPath("");
+		delete spectral;
+		delete upsampler;
+		delete downsampler;
 		delete block;
 	}
 
@@ -196,13 +266,11 @@ struct Prototype : Module {
 			unsecureScript = "";
 		}
 
-		// Frame divider for reducing sample rate
-		if (++frame < frameDivider)
-			return;
-		frame = 0;
+		// Hold the script for the whole frame. If it is being replaced, output silence.
+		std::unique_lock<std::mutex> lock(scriptMutex, std::try_to_lock);
 
 		// Clear outputs if no script is running
-		if (!scriptEngine) {
+		if (!lock.owns_lock() || (!scriptEngine && !batchGroup)) {
 			for (int i = 0; i < NUM_ROWS; i++)
 				for (int c = 0; c < 3; c++)
 					lights[LIGHT_LIGHTS + i * 3 + c].setBrightness(0.f);
@@ -214,18 +282,123 @@ struct Prototype : Module {
 			return;
 		}
 
-		// Inputs
+		float in[NUM_ROWS];
+		float out[NUM_ROWS] = {};
+		for (int i = 0; i < NUM_ROWS; i++)
+			in[i] = inputs[IN_INPUTS + i].getVoltage();
+
+		if (upsampler && oversample > 1) {
+			// Run the script `oversample` times per frame between the interpolating and decimating filters
+			ProcessArgs scriptArgs = args;
+			scriptArgs.sampleRate *= oversample;
+			scriptArgs.sampleTime /= oversample;
+			upsampler->push(in);
+			for (int p = 0; p < oversample; p++) {
+				float upsampled[NUM_ROWS];
+				for (int i = 0; i < NUM_ROWS; i++)
+					upsampled[i] = upsampler->output(i, p);
+				processFrame(scriptArgs, upsampled, out);
+				downsampler->push(out);
+			}
+			for (int i = 0; i < NUM_ROWS; i++)
+				out[i] = downsampler->output(i);
+		}
+		else if (upsampler) {
+			// Band-limit inputs before decimating, and interpolate outputs instead of holding them
+			downsampler->push(in);
+			if (++frame >= frameDivider) {
+				frame = 0;
+				float downsampled[NUM_ROWS];
+				for (int i = 0; i < NUM_ROWS; i++)
+					downsampled[i] = downsampler->output(i);
+				processFrame(args, downsampled, out);
+				upsampler->push(out);
+			}
+			for (int i = 0; i < NUM_ROWS; i++)
+				out[i] = upsampler->output(i, frame);
+		}
+		else {
+			// Frame divider for reducing sample rate
+			if (++frame < frameDivider)
+				return;
+			frame = 0;
+			processFrame(args, in, out);
+		}
+
 		for (int i = 0; i < NUM_ROWS; i++)
-			block->inputs[i][bufferIndex] = inputs[IN_INPUTS + i].getVoltage();
+			outputs[OUT_OUTPUTS + i].setVoltage(out[i]);
+	}
+
+	/** Processes one sample frame at the script's rate. */
+	void processFrame(const ProcessArgs& args, const float* in, float* out) {
+		// The script may have stopped earlier in this frame
+		if (!scriptEngine && !batchGroup)
+			return;
+
+		// Per-sample params
+		if (knobSmoothing != KNOB_SMOOTHING_OFF) {
+			if (!smoothedKnobsInitialized) {
+				for (int i = 0; i < NUM_ROWS; i++)
+					smoothedKnobs[i] = params[KNOB_PARAMS + i].getValue();
+				smoothedKnobsInitialized = true;
+			}
+			if (knobSmoothing == KNOB_SMOOTHING_ONE_POLE) {
+				float lambda = args.sampleTime * frameDivider / std::max(knobSmoothingTime, 1e-6f);
+				float coeff = 1.f - std::exp(-lambda);
+				for (int i = 0; i < NUM_ROWS; i++) {
+					smoothedKnobs[i] += (params[KNOB_PARAMS + i].getValue() - smoothedKnobs[i]) * coeff;
+					block->knobBuffers[i][bufferIndex] = smoothedKnobs[i];
+				}
+			}
+			for (int i = 0; i < NUM_ROWS; i++)
+				block->switchBuffers[i][bufferIndex] = params[SWITCH_PARAMS + i].getValue() > 0.f;
+		}
+
+		// Inputs
+		float spectralOutputs[NUM_ROWS];
+		for (int i = 0; i < NUM_ROWS; i++) {
+			float v = in[i];
+			if (spectral) {
+				spectralOutputs[i] = spectral->step(i, v);
+			}
+			else {
+				// Decimated rows only store every rowDividers[i]th sample
+				int d = rowDividers[i];
+				if (d == 1)
+					block->inputs[i][bufferIndex] = v;
+				else if (bufferIndex % d == 0)
+					block->inputs[i][bufferIndex / d] = v;
+			}
+
+			// Detect edges with a Schmitt trigger so scripts don't have to scan every sample
+			if (inputHigh[i] ? (v <= triggerLow) : (v >= triggerHigh)) {
+				inputHigh[i] = !inputHigh[i];
+				int& count = block->inputEventCounts[i];
+				block->inputEventOffsets[i][count] = bufferIndex;
+				block->inputEventTypes[i][count] = inputHigh[i] ? EVENT_RISE : EVENT_FALL;
+				count++;
+			}
+		}
+
+		if (spectral)
+			spectral->advance();
 
 		// Process block
-		if (++bufferIndex >= block->bufferSize) {
-			std::lock_guard<std::mutex> lock(scriptMutex);
+		int blockLength = getBlockLength();
+		if (++bufferIndex >= blockLength) {
 			bufferIndex = 0;
 
 			// Block settings
 			block->sampleRate = args.sampleRate;
 			block->sampleTime = args.sampleTime;
+			for (int i = 0; i < NUM_ROWS; i++)
+				block->rowBufferSizes[i] = spectral ? block->bufferSize : (block->bufferSize + rowDividers[i] - 1) / rowDividers[i];
+
+			// Replace inputs with the spectra of the last fftSize samples
+			if (spectral) {
+				for (int i = 0; i < NUM_ROWS; i++)
+					spectral->analyze(i, block->inputs[i]);
+			}
 
 			// Params
 			for (int i = 0; i < NUM_ROWS; i++)
@@ -235,8 +408,50 @@ struct Prototype : Module {
 			float oldKnobs[NUM_ROWS];
 			std::memcpy(oldKnobs, block->knobs, sizeof(oldKnobs));
 
+			// Ramp from the previous block's knob values to the current ones
+			if (knobSmoothing == KNOB_SMOOTHING_LINEAR) {
+				float deltaIndex = 1.f / blockLength;
+				for (int i = 0; i < NUM_ROWS; i++) {
+					float delta = (block->knobs[i] - smoothedKnobs[i]) * deltaIndex;
+					for (int j = 0; j < blockLength; j++)
+						block->knobBuffers[i][j] = smoothedKnobs[i] + delta * (j + 1);
+					smoothedKnobs[i] = block->knobs[i];
+				}
+			}
+
+			// Exchange the block with the batch group's shared engine
+			if (batchGroup) {
+				batchGroup->process(batchSlot, block);
+			}
 			// Run ScriptEngine's process function
-			{
+			else {
+				// Control-rate, scheduled, and block processing see the same bus slots
+				scriptEngine->startBuses();
+
+				// Control-rate processing
+				if (controlDivider > 0) {
+					controlFrame += blockLength;
+					if (controlFrame >= controlDivider) {
+						controlFrame = 0;
+						if (scriptEngine->processControl()) {
+							WARN("Script %s processControl() failed. Stopped script.", path.c_str());
+							delete scriptEngine;
+							scriptEngine = NULL;
+							return;
+						}
+					}
+				}
+
+				// Scheduled callbacks
+				if (scriptEngine) {
+					if (processScheduled()) {
+						WARN("Script %s scheduled callback failed. Stopped script.", path.c_str());
+						delete scriptEngine;
+						scriptEngine = NULL;
+						return;
+					}
+				}
+
 				// Process buffer
 				if (scriptEngine) {
 					if (scriptEngine->process()) {
@@ -245,9 +460,25 @@ struct Prototype : Module {
 						scriptEngine = NULL;
 						return;
 					}
+					scriptEngine->publishBuses();
 				}
 			}
 
+			block->frame += (int64_t) blockLength * frameDivider;
+
+			// Overlap-add the spectra written by the script
+			if (spectral) {
+				for (int i = 0; i < NUM_ROWS; i++)
+					spectral->synthesize(i, block->outputs[i]);
+			}
+
+			// Events
+			for (int i = 0; i < NUM_ROWS; i++)
+				block->inputEventCounts[i] = 0;
+			// Output events are not rendered in spectral mode since outputs hold spectra
+			if (!spectral)
+				renderOutputEvents(args.sampleRate);
+
 			// Params
 			// Only set params if values were changed by the script. This avoids issues when the user is manipulating them from the UI thread.
 			for (int i = 0; i < NUM_ROWS; i++) {
@@ -265,7 +496,142 @@ struct Prototype : Module {
 
 		// Outputs
 		for (int i = 0; i < NUM_ROWS; i++)
-			outputs[OUT_OUTPUTS + i].setVoltage(block->outputs[i][bufferIndex]);
+			out[i] = spectral ? spectralOutputs[i] : block->outputs[i][bufferIndex / rowDividers[i]];
+	}
+
+	/** Returns the number of sample frames stored between calls to process(), before frameDivider. */
+	int getBlockLength() {
+		if (spectral)
+			return spectral->hop;
+		return block->bufferSize;
+	}
+
+	/** Returns the real-time duration of one script block in seconds. */
+	double getBlockDuration() {
+		return (double) getBlockLength() * frameDivider * block->sampleTime;
+	}
+
+	/** Returns the delay from inputs to outputs in engine sample frames. */
+	int getLatency() {
+		int latency = spectral ? spectral->size : block->bufferSize;
+		// Outputs of a batch are returned at the end of the next block
+		if (batchGroup)
+			latency += block->bufferSize;
+		else if (scriptEngine)
+			latency += scriptEngine->getBlockLatency() * block->bufferSize;
+		// Each linear-phase filter delays by half its length at the high rate
+		if (upsampler && oversample > 1)
+			return (latency + oversample - 1) / oversample + RESAMPLER_TAPS - 1;
+		if (upsampler)
+			return latency * frameDivider + frameDivider * RESAMPLER_TAPS - 1;
+		return latency * frameDivider;
+	}
+
+	/** Creates the resampling filters after the script has set its config. */
+	void setResampling() {
+		delete upsampler;
+		upsampler = NULL;
+		delete downsampler;
+		downsampler = NULL;
+		if (oversample > 1) {
+			// Oversampling replaces frame division
+			frameDivider = 1;
+			upsampler = new Upsampler(oversample);
+			downsampler = new Downsampler(oversample);
+		}
+		else if (antiAliasing && frameDivider > 1) {
+			upsampler = new Upsampler(frameDivider);
+			downsampler = new Downsampler(frameDivider);
+		}
+	}
+
+	/** Returns the multiply-adds per engine sample frame of the resampling filters. */
+	int getResamplingCost() {
+		if (!upsampler)
+			return 0;
+		// Each filter costs RESAMPLER_TAPS per high-rate sample per row
+		int rate = (oversample > 1) ? oversample : 1;
+		return 2 * RESAMPLER_TAPS * NUM_ROWS * rate;
+	}
+
+	void setSpectral(int format) {
+		delete spectral;
+		spectral = NULL;
+		if (format != SPECTRAL_COMPLEX && format != SPECTRAL_POLAR)
+			return;
+		// pffft requires a multiple of 32, so use a power of 2 from 32 to MAX_FFT_SIZE
+		int size = 32;
+		while (size < fftSize && size < MAX_FFT_SIZE)
+			size *= 2;
+		int hop = clamp(hopSize, 1, size);
+		spectral = new Spectral(size, hop, clamp(spectralWindow, 0, (int) SPECTRAL_WINDOW_RECTANGULAR), format);
+		// Each row holds the interleaved bins 0 to size/2
+		block->bufferSize = size + 2;
+	}
+
+	/** Calls the scheduled callbacks that are due before the end of the current block, in order of frame.
+	*/
+	int processScheduled() {
+		int blockLength = getBlockLength();
+		int64_t endFrame = block->frame + (int64_t) blockLength * frameDivider;
+		// Limit the number of callbacks per block in case a script keeps rescheduling itself in the past
+		for (int n = 0; n < MAX_BUFFER_SIZE && !scheduledEvents.empty(); n++) {
+			ScheduledEvent event = scheduledEvents.front();
+			if (event.frame >= endFrame)
+				break;
+			scheduledEvents.erase(scheduledEvents.begin());
+			bool last = (event.period <= 0);
+			if (!last)
+				insertScheduledEvent({event.id, event.frame + event.period, event.period, event.engine});
+
+			// Overdue events are called at the start of the block
+			int64_t frame = std::max(event.frame, block->frame);
+			int offset = clamp((int) ((frame - block->frame) / frameDivider), 0, blockLength - 1);
+			scheduledFrame = frame;
+			int err = event.engine->processScheduled(event.id, offset, last);
+			scheduledFrame = -1;
+			if (err)
+				return err;
+		}
+		return 0;
+	}
+
+	void insertScheduledEvent(const ScheduledEvent& event) {
+		auto it = std::upper_bound(scheduledEvents.begin(), scheduledEvents.end(), event, [](const ScheduledEvent& a, const ScheduledEvent& b) {
+			return a.frame < b.frame;
+		});
+		scheduledEvents.insert(it, event);
+	}
+
+	/** Replaces the output rows that have pending events or held gates with 10V gates and triggers.
+	*/
+	void renderOutputEvents(float sampleRate) {
+		int pulseFrames = std::max((int) std::round(1e-3f * sampleRate / frameDivider), 1);
+
+		for (int i = 0; i < NUM_ROWS; i++) {
+			int count = clamp(block->outputEventCounts[i], 0, MAX_BUFFER_SIZE);
+			block->outputEventCounts[i] = 0;
+			if (count == 0 && !outputHigh[i] && outputPulseFrames[i] <= 0)
+				continue;
+
+			int e = 0;
+			for (int j = 0; j < block->bufferSize; j++) {
+				// Apply all events at or before this sample
+				for (; e < count && block->outputEventOffsets[i][e] <= j; e++) {
+					switch (block->outputEventTypes[i][e]) {
+						case EVENT_FALL: outputHigh[i] = false; break;
+						case EVENT_RISE: outputHigh[i] = true; break;
+						case EVENT_TRIGGER: outputPulseFrames[i] = pulseFrames; break;
+						default: break;
+					}
+				}
+				bool high = outputHigh[i] || outputPulseFrames[i] > 0;
+				if (outputPulseFrames[i] > 0)
+					outputPulseFrames[i]--;
+				if (j % rowDividers[i] == 0)
+					block->outputs[i][j / rowDividers[i]] = high ? 10.f : 0.f;
+			}
+		}
 	}
 
 	void setPath(std::string path) {
@@ -316,6 +682,11 @@ struct Prototype : Module {
 			delete scriptEngine;
 			scriptEngine = NULL;
 		}
+		if (batchGroup) {
+			batchGroup->removeMember(batchSlot);
+			batchGroup = NULL;
+			batchSlot = -1;
+		}
 		this->script = "";
 		this->engineName = "";
 		this->message = "";
@@ -323,6 +694,35 @@ struct Prototype : Module {
 		frameDivider = 32;
 		frame = 0;
 		bufferIndex = 0;
+		triggerLow = 0.1f;
+		triggerHigh = 1.f;
+		knobSmoothing = KNOB_SMOOTHING_OFF;
+		knobSmoothingTime = 0.01f;
+		smoothedKnobsInitialized = false;
+		controlDivider = 0;
+		controlFrame = 0;
+		for (int i = 0; i < NUM_ROWS; i++)
+			rowDividers[i] = 1;
+		scheduledEvents.clear();
+		nextScheduledId = 1;
+		scheduledFrame = -1;
+		fftSize = 1024;
+		hopSize = 256;
+		spectralWindow = SPECTRAL_WINDOW_HANN;
+		delete spectral;
+		spectral = NULL;
+		oversample = 1;
+		antiAliasing = 0;
+		batch = 0;
+		delete upsampler;
+		upsampler = NULL;
+		delete downsampler;
+		downsampler = NULL;
+		for (int i = 0; i < NUM_ROWS; i++) {
+			inputHigh[i] = false;
+			outputHigh[i] = false;
+			outputPulseFrames[i] = 0;
+		}
 		// Reset block
 		*block = ProcessBlock();
 
@@ -332,7 +732,10 @@ struct Prototype : Module {
 
 		// Create script engine from path extension
 		std::string extension = string::filenameExtension(string::filename(path));
-		scriptEngine = createScriptEngine(extension);
+		// The helper process's engine cannot be shared
+		if (!remote && joinBatch(extension, script))
+			return;
+		scriptEngine = remote ? createRemoteEngine(extension) : createScriptEngine(extension);
 		if (!scriptEngine) {
 			message = string::f("No engine for .%s extension", extension.c_str());
 			return;
@@ -340,13 +743,82 @@ struct Prototype : Module {
 		scriptEngine->module = this;
 
 		// Run script
-		if (scriptEngine->run(path, script)) {
+		bufferPool.unclaim();
+		scriptConfig.clear();
+		recordingConfig = true;
+		int err = scriptEngine->run(path, script);
+		recordingConfig = false;
+		if (err) {
 			// Error message should have been set by ScriptEngine
 			delete scriptEngine;
 			scriptEngine = NULL;
 			return;
 		}
+		// Buffers are released only after a successful run, so a script with an error does not lose the previous script's state
+		bufferPool.releaseUnclaimed();
 		this->engineName = scriptEngine->getEngineName();
+		setResampling();
+		if (batch && !remote)
+			setBatch(extension, script);
+	}
+
+	/** Joins a running batch group for the script, and applies its config without running the script.
+	Returns false if there is no group with room.
+	*/
+	bool joinBatch(const std::string& extension, const std::string& script) {
+		std::string key = extension + ":" + script;
+		batchGroup = findBatchGroup(this, key, &batchSlot);
+		if (!batchGroup)
+			return false;
+		// A base engine only forwards the config to this module
+		ScriptEngine configEngine;
+		configEngine.module = this;
+		for (const BatchConfig& c : batchGroup->config)
+			configEngine.setConfig(c.name, c.value, c.index);
+		// The group's engine processes the batch
+		block->batchSize = 1;
+		// No buffers are requested, so release those of the previous script
+		bufferPool.unclaim();
+		bufferPool.releaseUnclaimed();
+		this->engineName = batchGroup->engine->getEngineName();
+		setResampling();
+		return true;
+	}
+
+	/** Sets the batch size of the block that the script runs on, so that the engine sizes its rows for a batch group if config.batch is enabled. */
+	void setBlockBatchSize() {
+		block->batchSize = (batch && !remote) ? getBatchCapacity(block->bufferSize) : 1;
+	}
+
+	/** Hands this module's engine to a new batch group, or joins a group with room and deletes it. */
+	void setBatch(const std::string& extension, const std::string& script) {
+		// Spectral rows hold more than bufferSize floats
+		if (spectral) {
+			message = "Batch mode is not available in spectral mode";
+			block->batchSize = 1;
+			return;
+		}
+		// Modules with the same script and engine share a group
+		std::string key = extension + ":" + script;
+		batchGroup = joinBatchGroup(this, key, block->bufferSize, scriptConfig, [&]() -> ScriptEngine* {
+			// The engine keeps the block it ran on, and this module continues with a new one
+			ScriptEngine* engine = scriptEngine;
+			scriptEngine = NULL;
+			engine->workerBlock = block;
+			block = new ProcessBlock;
+			block->bufferSize = engine->workerBlock->bufferSize;
+			return engine;
+		}, &batchSlot);
+		block->batchSize = 1;
+		if (!batchGroup) {
+			WARN("Could not create batch for script %s. Running it unbatched.", path.c_str());
+			return;
+		}
+		// Another module's group had room
+		delete scriptEngine;
+		scriptEngine = NULL;
+		// The shared engine cannot schedule callbacks
+		scheduledEvents.clear();
 	}
 
 	static void watchCallback(efsw_watcher watcher, efsw_watchid watchid, const char* dir, const char* filename, enum efsw_action action, const char* old_filename, void* param) {
@@ -371,10 +843,16 @@ struct Prototype : Module {
 			script = unsecureScript;
 		json_object_set_new(rootJ, "script", json_stringn(script.data(), script.size()));
 
+		json_object_set_new(rootJ, "remote", json_boolean(remote));
+
 		return rootJ;
 	}
 
 	void dataFromJson(json_t* rootJ) override {
+		json_t* remoteJ = json_object_get(rootJ, "remote");
+		if (remoteJ)
+			remote = json_boolean_value(remoteJ);
+
 		json_t* pathJ = json_object_get(rootJ, "path");
 		if (pathJ) {
 			std::string path = json_string_value(pathJ);
@@ -571,6 +1049,19 @@ struct Prototype : Module {
 		editScriptItem->disabled = !doesPathExist() || (getEditorPath() == "");
 		menu->addChild(editScriptItem);
 
+#if !defined ARCH_WIN
+		struct RemoteItem : MenuItem {
+			Prototype* module;
+			void onAction(const event::Action& e) override {
+				module->remote ^= true;
+				module->setScript(module->script);
+			}
+		};
+		RemoteItem* remoteItem = createMenuItem<RemoteItem>("Run in helper process", CHECKMARK(remote));
+		remoteItem->module = this;
+		menu->addChild(remoteItem);
+#endif
+
 		menu->addChild(new MenuSeparator);
 
 		struct SetEditorItem : MenuItem {
@@ -588,6 +1079,24 @@ struct Prototype : Module {
 		};
 		SetPdEditorItem* setPdEditorItem = createMenuItem<SetPdEditorItem>("Set Pure Data application");
 		menu->addChild(setPdEditorItem);
+
+		// Stats
+		if (scriptEngine || batchGroup) {
+			menu->addChild(new MenuSeparator);
+			int latency = getLatency();
+			float sampleRate = APP->engine->getSampleRate();
+			menu->addChild(createMenuLabel(string::f("Latency: %d samples (%.1f ms)", latency, 1000.f * latency / sampleRate)));
+			if (upsampler) {
+				std::string mode = (oversample > 1) ? string::f("%dx oversampling", oversample) : string::f("1/%d decimation", frameDivider);
+				menu->addChild(createMenuLabel(string::f("Resampling: %s, %d multiply-adds per sample", mode.c_str(), getResamplingCost())));
+			}
+			if (batchGroup)
+				menu->addChild(createMenuLabel(string::f("Batch: instance %d of up to %d", batchSlot + 1, batchGroup->capacity)));
+			if (scriptEngine) {
+				for (const std::string& stat : scriptEngine->getStats())
+					menu->addChild(createMenuLabel(stat));
+			}
+		}
 	}
 
 	std::string getEditorPath() {
@@ -601,18 +1110,265 @@ struct Prototype : Module {
 };
 
 
+ScriptEngine::~ScriptEngine() {
+	// Workers may be running on the pool, so the last one to finish deletes its group
+	for (WorkerGroup* group : workerGroups)
+		group->release();
+	delete workerBlock;
+	for (Kernel* kernel : kernels)
+		delete kernel;
+	// Releases the publisher of each bus so a reloaded script can publish to it
+	for (BusPort* port : busPorts)
+		delete port;
+	// Recordings are finished by the stream I/O thread
+	for (auto& stream : streams)
+		stream->close();
+}
 void ScriptEngine::display(const std::string& message) {
+	if (worker) {
+		worker->group->setMessage(worker, message);
+		return;
+	}
 	module->message = message;
 }
 void ScriptEngine::setFrameDivider(int frameDivider) {
+	if (workerBlock)
+		return;
+	if (parent && !parent->checkBlockConfig(this, "frameDivider", std::max(frameDivider, 1)))
+		return;
 	module->frameDivider = std::max(frameDivider, 1);
+	if (module->recordingConfig)
+		module->scriptConfig.push_back({"frameDivider", (double) frameDivider, 0});
 }
 void ScriptEngine::setBufferSize(int bufferSize) {
+	if (workerBlock)
+		return;
+	if (parent && !parent->checkBlockConfig(this, "bufferSize", clamp(bufferSize, 1, MAX_BUFFER_SIZE)))
+		return;
 	module->block->bufferSize = clamp(bufferSize, 1, MAX_BUFFER_SIZE);
+	module->setBlockBatchSize();
+	if (module->recordingConfig)
+		module->scriptConfig.push_back({"bufferSize", (double) bufferSize, 0});
+}
+void ScriptEngine::setConfig(const std::string& name, double value, int index) {
+	if (!std::isfinite(value) || workerBlock)
+		return;
+	// frameDivider and bufferSize are recorded by their setters
+	if (module->recordingConfig && name != "frameDivider" && name != "bufferSize")
+		module->scriptConfig.push_back({name, value, index});
+	if (name == "frameDivider")
+		setFrameDivider((int) value);
+	else if (name == "bufferSize")
+		setBufferSize((int) value);
+	else if (name == "triggerLow")
+		module->triggerLow = value;
+	else if (name == "triggerHigh")
+		module->triggerHigh = value;
+	else if (name == "knobSmoothing")
+		module->knobSmoothing = clamp((int) value, (int) KNOB_SMOOTHING_OFF, (int) KNOB_SMOOTHING_ONE_POLE);
+	else if (name == "knobSmoothingTime")
+		module->knobSmoothingTime = value;
+	else if (name == "controlDivider")
+		module->controlDivider = std::max((int) value, 0);
+	else if (name == "rowDividers" && 0 <= index && index < NUM_ROWS)
+		module->rowDividers[index] = clamp((int) value, 1, MAX_BUFFER_SIZE);
+	else if (name == "fftSize")
+		module->fftSize = (int) value;
+	else if (name == "hopSize")
+		module->hopSize = (int) value;
+	else if (name == "window")
+		module->spectralWindow = (int) value;
+	else if (name == "oversample")
+		module->oversample = clamp((int) value, 1, MAX_OVERSAMPLE);
+	else if (name == "antiAliasing")
+		module->antiAliasing = clamp((int) value, 0, 1);
+	else if (name == "batch") {
+		module->batch = clamp((int) value, 0, 1);
+		module->setBlockBatchSize();
+	}
+	else if (name == "spectral")
+		module->setSpectral((int) value);
 }
 ProcessBlock* ScriptEngine::getProcessBlock() {
+	if (workerBlock)
+		return workerBlock;
 	return module->block;
 }
+int ScriptEngine::schedule(int64_t frame, int64_t period) {
+	if (workerBlock)
+		return -1;
+	int id = module->nextScheduledId++;
+	module->insertScheduledEvent({id, frame, std::max(period, (int64_t) 0), this});
+	return id;
+}
+void ScriptEngine::cancel(int id) {
+	if (workerBlock)
+		return;
+	auto& events = module->scheduledEvents;
+	events.erase(std::remove_if(events.begin(), events.end(), [&](const Prototype::ScheduledEvent& event) {
+		return event.id == id;
+	}), events.end());
+}
+double ScriptEngine::getBlockDuration() {
+	return module->getBlockDuration();
+}
+float ScriptEngine::getSampleRate() {
+	float sampleRate = getProcessBlock()->sampleRate;
+	if (sampleRate > 0.f)
+		return sampleRate;
+	return APP->engine->getSampleRate();
+}
+int64_t ScriptEngine::getFrame() {
+	if (workerBlock)
+		return workerBlock->frame;
+	if (module->scheduledFrame >= 0)
+		return module->scheduledFrame;
+	return module->block->frame;
+}
+int ScriptEngine::addKernel(const std::string& name) {
+	Kernel* kernel = createKernel(name);
+	if (!kernel)
+		return -1;
+	kernels.push_back(kernel);
+	return kernels.size() - 1;
+}
+Kernel* ScriptEngine::getKernel(int id) {
+	if (id < 0 || id >= (int) kernels.size())
+		return NULL;
+	return kernels[id];
+}
+std::string ScriptEngine::resolvePath(const std::string& path) {
+	bool absolute = (path.size() >= 1 && (path[0] == '/' || path[0] == '\\')) || (path.size() >= 2 && path[1] == ':');
+	if (absolute || module->path == "")
+		return path;
+	return string::directory(module->path) + "/" + path;
+}
+int ScriptEngine::addSample(const std::string& path) {
+	samples.push_back(loadSample(resolvePath(path)));
+	return samples.size() - 1;
+}
+Sample* ScriptEngine::getSample(int id) {
+	if (id < 0 || id >= (int) samples.size() || !samples[id]->isLoaded())
+		return NULL;
+	return samples[id].get();
+}
+int ScriptEngine::addStream(const std::string& path, bool recording, int channels, float sampleRate, bool loop) {
+	if (sampleRate <= 0.f)
+		sampleRate = APP->engine->getSampleRate();
+	streams.push_back(openStream(resolvePath(path), recording, clamp(channels, 1, 64), sampleRate, loop));
+	return streams.size() - 1;
+}
+Stream* ScriptEngine::getStream(int id) {
+	if (id < 0 || id >= (int) streams.size())
+		return NULL;
+	return streams[id].get();
+}
+std::shared_ptr<PooledBuffer> ScriptEngine::getBuffer(const std::string& name, int size) {
+	if (size <= 0)
+		return NULL;
+	std::shared_ptr<PooledBuffer> buffer = module->bufferPool.get(name, size);
+	if (buffer && std::find(buffers.begin(), buffers.end(), buffer) == buffers.end())
+		buffers.push_back(buffer);
+	return buffer;
+}
+int ScriptEngine::addBus(const std::string& name, int channels, bool publishing, int delay) {
+	if (workerBlock) {
+		display("Workers and batches cannot use buses");
+		return -1;
+	}
+	std::string error;
+	BusPort* port = openBus(name, channels, module->block->bufferSize, publishing, delay, &error);
+	if (!port) {
+		display(error);
+		return -1;
+	}
+	busPorts.push_back(port);
+	return busPorts.size() - 1;
+}
+BusPort* ScriptEngine::getBus(int id) {
+	if (id < 0 || id >= (int) busPorts.size())
+		return NULL;
+	return busPorts[id];
+}
+void ScriptEngine::startBuses() {
+	for (BusPort* port : busPorts)
+		port->start();
+}
+void ScriptEngine::publishBuses() {
+	for (BusPort* port : busPorts)
+		port->publish();
+}
+int ScriptEngine::addWorkers(const std::string& path, int count) {
+	if (workerBlock) {
+		display("Workers cannot create workers");
+		return -1;
+	}
+	std::string workerPath = resolvePath(path);
+	std::string script;
+	try {
+		std::ifstream file;
+		file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		file.open(workerPath);
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		script = buffer.str();
+	}
+	catch (const std::runtime_error& err) {
+		display(string::f("Could not read worker script %s", path.c_str()));
+		return -1;
+	}
+
+	std::string extension = string::filenameExtension(string::filename(workerPath));
+	WorkerGroup* group = new WorkerGroup;
+	for (int i = 0; i < clamp(count, 1, MAX_WORKERS); i++) {
+		ScriptEngine* engine = createScriptEngine(extension);
+		if (!engine || engine->getEngineName() != getEngineName()) {
+			delete engine;
+			delete group;
+			display(string::f("Worker script %s must use the %s engine", path.c_str(), getEngineName().c_str()));
+			return -1;
+		}
+		engine->module = module;
+		engine->workerBlock = new ProcessBlock;
+		*engine->workerBlock = *getProcessBlock();
+		engine->workerIndex = i;
+		Worker* worker = new Worker;
+		worker->group = group;
+		worker->engine = engine;
+		group->workers.push_back(worker);
+		// Workers run on the script's thread, so errors are displayed like the main script's
+		if (engine->run(workerPath, script)) {
+			delete group;
+			return -1;
+		}
+	}
+	// From now on, workers run on the pool
+	for (Worker* worker : group->workers)
+		worker->engine->worker = worker;
+	workerGroups.push_back(group);
+	return workerGroups.size() - 1;
+}
+int ScriptEngine::forkWorkers(int id) {
+	if (id < 0 || id >= (int) workerGroups.size())
+		return -1;
+	int started = workerGroups[id]->fork(getProcessBlock());
+	showWorkerMessages(workerGroups[id]);
+	return started;
+}
+int ScriptEngine::joinWorkers(int id, double timeout) {
+	if (id < 0 || id >= (int) workerGroups.size())
+		return -1;
+	if (timeout < 0.0)
+		timeout = 0.5 * getBlockDuration();
+	int joined = workerGroups[id]->join(getProcessBlock(), timeout);
+	showWorkerMessages(workerGroups[id]);
+	return joined;
+}
+void ScriptEngine::showWorkerMessages(WorkerGroup* group) {
+	std::string message;
+	if (group->takeMessage(&message))
+		display(message);
+}
 
 
 struct FileChoice : LedDisplayChoice {
@@ -6,7 +6,14 @@ extern "C" {
 }
 #include <dlfcn.h>
 #include "ScriptEngine.hpp"
+#include "Kernels.hpp"
+#include "Samples.hpp"
+#include "Streams.hpp"
+#include "Buffers.hpp"
+#include "Buses.hpp"
 #include <thread>
+#include <chrono>
+#include <mutex>
 
 
 /*
@@ -15,15 +22,36 @@ TODO:
 	- "undefined symbol: PyExc_RecursionError"
 	- This worked in Python 3.7, but because some other crash (regarding GIL interpreter objects, I forgot) was fixed on Python's issue tracker in the last month, I switched to Python 3.8 to solve that problem.
 - Test build and running on Windows/Mac. (Has not been attempted.)
-- Allow multiple instances with GIL.
-- Fix destructors.
 */
 
 
 extern rack::Plugin* pluginInstance;
 
 
-static void initPython() {
+/** process() is timed once every this many blocks */
+static const int PYTHON_TIMING_INTERVAL = 16;
+
+
+/** Calls `func` with positional arguments without creating a tuple. */
+static PyObject* vectorcall(PyObject* func, PyObject* const* args, size_t nargs) {
+#if PY_VERSION_HEX >= 0x03090000
+	return PyObject_Vectorcall(func, args, nargs, NULL);
+#else
+	return _PyObject_Vectorcall(func, args, nargs, NULL);
+#endif
+}
+
+
+/** Returns a view of the first `width` elements of each row of a `[NUM_ROWS][MAX_BUFFER_SIZE]` array. */
+static PyObject* newRowsView(int type, void* data, int width) {
+	int itemSize = (type == NPY_BOOL) ? sizeof(bool) : sizeof(float);
+	npy_intp dims[] = {NUM_ROWS, width};
+	npy_intp strides[] = {(npy_intp) MAX_BUFFER_SIZE * itemSize, itemSize};
+	return PyArray_New(&PyArray_Type, 2, dims, type, strides, data, itemSize, NPY_ARRAY_WRITEABLE | NPY_ARRAY_ALIGNED, NULL);
+}
+
+
+static void initPythonOnce() {
 	if (Py_IsInitialized())
 		return;
 
@@ -47,24 +75,63 @@ static void initPython() {
 		PyErr_Print();
 		abort();
 	}
+
+	// Release the GIL, which engines acquire on whichever thread calls them
+	PyEval_SaveThread();
+}
+
+/** Initializes Python the first time it is called, from any thread. */
+static void initPython() {
+	static std::once_flag flag;
+	std::call_once(flag, initPythonOnce);
 }
 
 
+/** Holds the GIL on the calling thread until the end of the scope.
+Rack calls modules from several threads, so every entry point into an engine must hold it.
+*/
+struct PythonLock {
+	PyGILState_STATE state;
+	PythonLock() {
+		state = PyGILState_Ensure();
+	}
+	~PythonLock() {
+		PyGILState_Release(state);
+	}
+};
+
+
 struct PythonEngine : ScriptEngine {
+	/** Namespace of this engine's script, so several scripts can run at once without sharing globals */
+	PyObject* mainModule = NULL;
+	/** Globals of the script, owned by `mainModule` */
 	PyObject* mainDict = NULL;
 	PyObject* processFunc = NULL;
+	PyObject* processControlFunc = NULL;
 	PyObject* blockObj = NULL;
-	PyInterpreterState* interp = NULL;
+	/** Arguments of process() and processControl(), which are always the block */
+	PyObject* blockArgs[1] = {};
+	/** Smoothed duration of process() in seconds, measured every PYTHON_TIMING_INTERVAL blocks and read by the UI thread */
+	float processTime = 0.f;
+	int processCount = 0;
+	/** Scheduled callbacks by id */
+	PyObject* callbacksDict = NULL;
 
 	~PythonEngine() {
-		if (mainDict)
-			Py_DECREF(mainDict);
+		if (!mainModule)
+			return;
+		PythonLock lock;
 		if (processFunc)
 			Py_DECREF(processFunc);
+		if (processControlFunc)
+			Py_DECREF(processControlFunc);
 		if (blockObj)
 			Py_DECREF(blockObj);
-		if (interp)
-			PyInterpreterState_Delete(interp);
+		if (callbacksDict)
+			Py_DECREF(callbacksDict);
+		// Break reference cycles between the script's functions and its globals
+		PyDict_Clear(mainDict);
+		Py_DECREF(mainModule);
 	}
 
 	std::string getEngineName() override {
@@ -74,25 +141,43 @@ struct PythonEngine : ScriptEngine {
 	int run(const std::string& path, const std::string& script) override {
 		ProcessBlock* block = getProcessBlock();
 		initPython();
+		PythonLock lock;
 
-		// PyThreadState* tstate = PyThreadState_Get();
-		// interp = PyInterpreterState_New();
-		// PyThreadState_Swap(tstate);
-
-		// Get globals dictionary
-		PyObject* mainModule = PyImport_AddModule("__main__");
+		// Create a module for the script's globals instead of sharing the interpreter's __main__.
+		// Subinterpreters would isolate more, but numpy does not support them.
+		// It is not added to sys.modules, so scripts can still check `__name__ == "__main__"`.
+		mainModule = PyModule_New("__main__");
 		assert(mainModule);
-		DEFER({Py_DECREF(mainModule);});
 		mainDict = PyModule_GetDict(mainModule);
 		assert(mainDict);
+		PyDict_SetItemString(mainDict, "__builtins__", PyEval_GetBuiltins());
 
 		// Set context pointer
 		PyObject* engineObj = PyCapsule_New(this, NULL, NULL);
 		PyDict_SetItemString(mainDict, "_engine", engineObj);
+		Py_DECREF(engineObj);
 
 		// Add functions to globals
 		static PyMethodDef native_functions[] = {
 			{"display", nativeDisplay, METH_VARARGS, ""},
+			{"schedule", nativeSchedule, METH_VARARGS, ""},
+			{"schedule_every", nativeScheduleEvery, METH_VARARGS, ""},
+			{"cancel", nativeCancel, METH_VARARGS, ""},
+			{"now", nativeNow, METH_NOARGS, ""},
+			{"_kernel_create", nativeKernelCreate, METH_VARARGS, ""},
+			{"_kernel_set", nativeKernelSet, METH_VARARGS, ""},
+			{"_kernel_load", nativeKernelLoad, METH_VARARGS, ""},
+			{"_kernel_process", nativeKernelProcess, METH_VARARGS, ""},
+			{"_sample_load", nativeSampleLoad, METH_VARARGS, ""},
+			{"_sample_info", nativeSampleInfo, METH_VARARGS, ""},
+			{"_stream_open", nativeStreamOpen, METH_VARARGS, ""},
+			{"_stream_write", nativeStreamWrite, METH_VARARGS, ""},
+			{"_stream_read", nativeStreamRead, METH_VARARGS, ""},
+			{"_stream_ended", nativeStreamEnded, METH_VARARGS, ""},
+			{"_stream_close", nativeStreamClose, METH_VARARGS, ""},
+			{"get_buffer", nativeGetBuffer, METH_VARARGS, ""},
+			{"_bus_open", nativeBusOpen, METH_VARARGS, ""},
+			{"_bus_offset", nativeBusOffset, METH_VARARGS, ""},
 			{NULL, NULL, 0, NULL},
 		};
 		if (PyModule_AddFunctions(mainModule, native_functions)) {
@@ -100,24 +185,100 @@ struct PythonEngine : ScriptEngine {
 			return -1;
 		}
 
-		// Set config
-		static PyStructSequence_Field configFields[] = {
-			{"frameDivider", ""},
-			{"bufferSize", ""},
-			{NULL, NULL},
-		};
-		static PyStructSequence_Desc configDesc = {"Config", "", configFields, LENGTHOF(configFields) - 1};
-		PyTypeObject* configType = PyStructSequence_NewType(&configDesc);
-		assert(configType);
+		callbacksDict = PyDict_New();
+		assert(callbacksDict);
+
+		// Wrap native kernels in a class
+		static const char* prelude = R"(
+class Kernel:
+	def __init__(self, name):
+		self.id = _kernel_create(name)
+		if self.id < 0:
+			raise ValueError("Unknown kernel " + str(name))
+	def set(self, *params):
+		_kernel_set(self.id, *params)
+	def load(self, data):
+		_kernel_load(self.id, data)
+	def process(self, input, output, n=-1):
+		_kernel_process(self.id, input, output, n)
+
+class Sample:
+	def __init__(self, path):
+		self.id = _sample_load(path)
+		self.channels = None
+		self.frames = 0
+		self.sample_rate = 0
+	def ready(self):
+		if self.channels is None:
+			info = _sample_info(self.id)
+			if info is None:
+				return False
+			self.channels, self.sample_rate = info
+			self.frames = self.channels.shape[1]
+		return True
+
+class Recorder:
+	def __init__(self, path, channels=1, sample_rate=0):
+		self.id = _stream_open(path, True, channels, sample_rate, False)
+	def write(self, data, n=-1):
+		return _stream_write(self.id, data, n)
+	def close(self):
+		_stream_close(self.id)
+
+class Player:
+	def __init__(self, path, channels=1, loop=False):
+		self.id = _stream_open(path, False, channels, 0, loop)
+	def read(self, data, n=-1):
+		return _stream_read(self.id, data, n)
+	def ended(self):
+		return _stream_ended(self.id)
+	def close(self):
+		_stream_close(self.id)
+
+class Bus:
+	def __init__(self, name, channels=1, publish=False, delay=0):
+		self.id, self.data, self.frames = _bus_open(str(name), channels, publish, delay)
+		self.channels = channels
+	def offset(self, c):
+		return _bus_offset(self.id, c)
+)";
+		PyObject* preludeResult = PyRun_String(prelude, Py_file_input, mainDict, mainDict);
+		if (!preludeResult) {
+			PyErr_Print();
+			return -1;
+		}
+		Py_DECREF(preludeResult);
 
-		PyObject* configObj = PyStructSequence_New(configType);
+		// Set config
+		// Use a SimpleNamespace so the script can assign its attributes.
+		PyObject* typesModule = PyImport_ImportModule("types");
+		assert(typesModule);
+		DEFER({Py_DECREF(typesModule);});
+		PyObject* namespaceType = PyObject_GetAttrString(typesModule, "SimpleNamespace");
+		assert(namespaceType);
+		DEFER({Py_DECREF(namespaceType);});
+
+		PyObject* configDefaults = PyDict_New();
+		DEFER({Py_DECREF(configDefaults);});
+		for (const ConfigKey& key : CONFIG_KEYS) {
+			PyObject* value;
+			if (key.size > 0) {
+				value = PyList_New(key.size);
+				for (int i = 0; i < key.size; i++)
+					PyList_SET_ITEM(value, i, PyFloat_FromDouble(key.defaultValue));
+			}
+			else {
+				value = PyFloat_FromDouble(key.defaultValue);
+			}
+			PyDict_SetItemString(configDefaults, key.name, value);
+			Py_DECREF(value);
+		}
+		PyObject* emptyArgs = PyTuple_New(0);
+		DEFER({Py_DECREF(emptyArgs);});
+		PyObject* configObj = PyObject_Call(namespaceType, emptyArgs, configDefaults);
 		assert(configObj);
 		PyDict_SetItemString(mainDict, "config", configObj);
-
-		// frameDivider
-		PyStructSequence_SetItem(configObj, 0, PyLong_FromLong(32));
-		// bufferSize
-		PyStructSequence_SetItem(configObj, 1, PyLong_FromLong(1));
+		Py_DECREF(configObj);
 
 		// Compile string
 		PyObject* code = Py_CompileString(script.c_str(), path.c_str(), Py_file_input);
@@ -135,14 +296,60 @@ struct PythonEngine : ScriptEngine {
 		}
 		DEFER({Py_DECREF(result);});
 
+		// Read config
+		configObj = PyDict_GetItemString(mainDict, "config");
+		for (const ConfigKey& key : CONFIG_KEYS) {
+			PyObject* value = configObj ? PyObject_GetAttrString(configObj, key.name) : NULL;
+			if (!value) {
+				PyErr_Clear();
+				continue;
+			}
+			DEFER({Py_DECREF(value);});
+			for (int i = 0; i < std::max(key.size, 1); i++) {
+				PyObject* element = value;
+				if (key.size > 0) {
+					element = PySequence_GetItem(value, i);
+					if (!element) {
+						PyErr_Clear();
+						break;
+					}
+				}
+				double number = PyFloat_AsDouble(element);
+				if (key.size > 0)
+					Py_DECREF(element);
+				if (PyErr_Occurred()) {
+					PyErr_Clear();
+					continue;
+				}
+				setConfigIfChanged(key.name, number, i);
+			}
+		}
+
 		// Create block
 		static PyStructSequence_Field blockFields[] = {
 			{"inputs", ""},
 			{"outputs", ""},
 			{"knobs", ""},
 			{"switches", ""},
+			{"row_buffer_sizes", ""},
 			{"lights", ""},
 			{"switch_lights", ""},
+			{"knob_buffers", ""},
+			{"switch_buffers", ""},
+			{"input_event_counts", ""},
+			{"input_event_offsets", ""},
+			{"input_event_types", ""},
+			{"output_event_counts", ""},
+			{"output_event_offsets", ""},
+			{"output_event_types", ""},
+			{"batch_size", ""},
+			{"batch_knobs", ""},
+			{"batch_switches", ""},
+			{"batch_lights", ""},
+			{"batch_switch_lights", ""},
+			{"sample_rate", ""},
+			{"sample_time", ""},
+			{"buffer_size", ""},
 			{NULL, NULL},
 		};
 		static PyStructSequence_Desc blockDesc = {"Block", "", blockFields, LENGTHOF(blockFields) - 1};
@@ -154,14 +361,15 @@ struct PythonEngine : ScriptEngine {
 		assert(blockObj);
 		DEBUG("ref %d", Py_REFCNT(blockObj));
 
+		// Rows are as wide as the block set by the script's config, or all instances' blocks in batch mode
+		int width = std::min(block->bufferSize * block->batchSize, MAX_BUFFER_SIZE);
+
 		// inputs
-		npy_intp inputsDims[] = {NUM_ROWS, MAX_BUFFER_SIZE};
-		PyObject* inputs = PyArray_SimpleNewFromData(2, inputsDims, NPY_FLOAT32, block->inputs);
+		PyObject* inputs = newRowsView(NPY_FLOAT32, block->inputs, width);
 		PyStructSequence_SetItem(blockObj, 0, inputs);
 
 		// outputs
-		npy_intp outputsDims[] = {NUM_ROWS, MAX_BUFFER_SIZE};
-		PyObject* outputs = PyArray_SimpleNewFromData(2, outputsDims, NPY_FLOAT32, block->outputs);
+		PyObject* outputs = newRowsView(NPY_FLOAT32, block->outputs, width);
 		PyStructSequence_SetItem(blockObj, 1, outputs);
 
 		// knobs
@@ -174,37 +382,88 @@ struct PythonEngine : ScriptEngine {
 		PyObject* switches = PyArray_SimpleNewFromData(1, switchesDims, NPY_BOOL, block->switches);
 		PyStructSequence_SetItem(blockObj, 3, switches);
 
+		// rowBufferSizes
+		npy_intp rowBufferSizesDims[] = {NUM_ROWS};
+		PyObject* rowBufferSizes = PyArray_SimpleNewFromData(1, rowBufferSizesDims, NPY_INT, block->rowBufferSizes);
+		PyStructSequence_SetItem(blockObj, 4, rowBufferSizes);
+
 		// lights
 		npy_intp lightsDims[] = {NUM_ROWS, 3};
 		PyObject* lights = PyArray_SimpleNewFromData(2, lightsDims, NPY_FLOAT32, block->lights);
-		PyStructSequence_SetItem(blockObj, 4, lights);
+		PyStructSequence_SetItem(blockObj, 5, lights);
 
 		// switchLights
 		npy_intp switchLightsDims[] = {NUM_ROWS, 3};
 		PyObject* switchLights = PyArray_SimpleNewFromData(2, switchLightsDims, NPY_FLOAT32, block->switchLights);
-		PyStructSequence_SetItem(blockObj, 5, switchLights);
+		PyStructSequence_SetItem(blockObj, 6, switchLights);
+
+		// knobBuffers
+		PyObject* knobBuffers = newRowsView(NPY_FLOAT32, block->knobBuffers, width);
+		PyStructSequence_SetItem(blockObj, 7, knobBuffers);
+
+		// switchBuffers
+		PyObject* switchBuffers = newRowsView(NPY_BOOL, block->switchBuffers, width);
+		PyStructSequence_SetItem(blockObj, 8, switchBuffers);
+
+		// events
+		npy_intp eventCountsDims[] = {NUM_ROWS};
+		npy_intp eventsDims[] = {NUM_ROWS, MAX_BUFFER_SIZE};
+		PyStructSequence_SetItem(blockObj, 9, PyArray_SimpleNewFromData(1, eventCountsDims, NPY_INT, block->inputEventCounts));
+		PyStructSequence_SetItem(blockObj, 10, PyArray_SimpleNewFromData(2, eventsDims, NPY_INT, block->inputEventOffsets));
+		PyStructSequence_SetItem(blockObj, 11, PyArray_SimpleNewFromData(2, eventsDims, NPY_UINT8, block->inputEventTypes));
+		PyStructSequence_SetItem(blockObj, 12, PyArray_SimpleNewFromData(1, eventCountsDims, NPY_INT, block->outputEventCounts));
+		PyStructSequence_SetItem(blockObj, 13, PyArray_SimpleNewFromData(2, eventsDims, NPY_INT, block->outputEventOffsets));
+		PyStructSequence_SetItem(blockObj, 14, PyArray_SimpleNewFromData(2, eventsDims, NPY_UINT8, block->outputEventTypes));
+
+		// batch
+		// batch_size is a 0-dimensional view, so it follows the number of instances in each call
+		PyStructSequence_SetItem(blockObj, 15, PyArray_SimpleNewFromData(0, NULL, NPY_INT, &block->batchSize));
+		npy_intp batchDims[] = {NUM_ROWS, MAX_BATCH};
+		npy_intp batchLightsDims[] = {NUM_ROWS, MAX_BATCH, 3};
+		PyStructSequence_SetItem(blockObj, 16, PyArray_SimpleNewFromData(2, batchDims, NPY_FLOAT32, block->batchKnobs));
+		PyStructSequence_SetItem(blockObj, 17, PyArray_SimpleNewFromData(2, batchDims, NPY_BOOL, block->batchSwitches));
+		PyStructSequence_SetItem(blockObj, 18, PyArray_SimpleNewFromData(3, batchLightsDims, NPY_FLOAT32, block->batchLights));
+		PyStructSequence_SetItem(blockObj, 19, PyArray_SimpleNewFromData(3, batchLightsDims, NPY_FLOAT32, block->batchSwitchLights));
+
+		// Block settings are 0-dimensional views, so they follow the block without being set before each call
+		PyStructSequence_SetItem(blockObj, 20, PyArray_SimpleNewFromData(0, NULL, NPY_FLOAT32, &block->sampleRate));
+		PyStructSequence_SetItem(blockObj, 21, PyArray_SimpleNewFromData(0, NULL, NPY_FLOAT32, &block->sampleTime));
+		PyStructSequence_SetItem(blockObj, 22, PyArray_SimpleNewFromData(0, NULL, NPY_INT, &block->bufferSize));
+		blockArgs[0] = blockObj;
 
 		// Get process function from globals
+		// This is optional when the script only uses scheduled callbacks.
 		processFunc = PyDict_GetItemString(mainDict, "process");
-		if (!processFunc) {
-			display("No process() function");
-			return -1;
-		}
-		if (!PyCallable_Check(processFunc)) {
+		if (processFunc && !PyCallable_Check(processFunc)) {
+			processFunc = NULL;
 			display("process() is not callable");
 			return -1;
 		}
+		// Borrowed from the globals, which the script could change
+		Py_XINCREF(processFunc);
+		processControlFunc = PyDict_GetItemString(mainDict, "processControl");
+		if (processControlFunc && !PyCallable_Check(processControlFunc))
+			processControlFunc = NULL;
+		Py_XINCREF(processControlFunc);
 
 		return 0;
 	}
 
 	int process() override {
+		if (!processFunc)
+			return 0;
+		PythonLock lock;
 		// DEBUG("ref %d", Py_REFCNT(blockObj));
+		bool timed = (processCount++ % PYTHON_TIMING_INTERVAL == 0);
+		std::chrono::steady_clock::time_point start;
+		if (timed)
+			start = std::chrono::steady_clock::now();
 		// Call process()
-		PyObject* args = PyTuple_Pack(1, blockObj);
-		assert(args);
-		DEFER({Py_DECREF(args);});
-		PyObject* processResult = PyObject_CallObject(processFunc, args);
+		PyObject* processResult = vectorcall(processFunc, blockArgs, 1);
+		if (timed) {
+			float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+			processTime += (time - processTime) * 0.1f;
+		}
 		if (!processResult) {
 			PyErr_Print();
 
@@ -226,13 +485,423 @@ struct PythonEngine : ScriptEngine {
 		return 0;
 	}
 
-	static PyObject* nativeDisplay(PyObject* self, PyObject* args) {
+	int processControl() override {
+		if (!processControlFunc)
+			return 0;
+		PythonLock lock;
+		PyObject* result = vectorcall(processControlFunc, blockArgs, 1);
+		if (!result) {
+			PyErr_Print();
+			return -1;
+		}
+		Py_DECREF(result);
+		return 0;
+	}
+
+	int processScheduled(int id, int offset, bool last) override {
+		PythonLock lock;
+		PyObject* key = PyLong_FromLong(id);
+		DEFER({Py_DECREF(key);});
+		PyObject* callback = PyDict_GetItem(callbacksDict, key);
+		if (!callback)
+			return 0;
+		Py_INCREF(callback);
+		DEFER({Py_DECREF(callback);});
+		if (last)
+			PyDict_DelItem(callbacksDict, key);
+
+		PyObject* offsetObj = PyLong_FromLong(offset);
+		DEFER({Py_DECREF(offsetObj);});
+		PyObject* args[] = {blockObj, offsetObj};
+		PyObject* result = vectorcall(callback, args, 2);
+		if (!result) {
+			PyErr_Print();
+			return -1;
+		}
+		Py_DECREF(result);
+		return 0;
+	}
+
+	std::vector<std::string> getStats() override {
+		return {rack::string::f("process(): %.3f ms per block", processTime * 1e3f)};
+	}
+
+	static PythonEngine* getEngine() {
 		PyObject* mainDict = PyEval_GetGlobals();
 		assert(mainDict);
 		PyObject* engineObj = PyDict_GetItemString(mainDict, "_engine");
 		assert(engineObj);
 		PythonEngine* engine = (PythonEngine*) PyCapsule_GetPointer(engineObj, NULL);
 		assert(engine);
+		return engine;
+	}
+
+	/** Registers `callback` under a new scheduled id and returns the id as a Python int. */
+	static PyObject* addCallback(PythonEngine* engine, double frame, double period, PyObject* callback) {
+		if (!PyCallable_Check(callback)) {
+			PyErr_SetString(PyExc_TypeError, "callback is not callable");
+			return NULL;
+		}
+		int id = engine->schedule((int64_t) frame, (int64_t) period);
+		PyObject* key = PyLong_FromLong(id);
+		PyDict_SetItem(engine->callbacksDict, key, callback);
+		return key;
+	}
+
+	static PyObject* nativeSchedule(PyObject* self, PyObject* args) {
+		double frame;
+		PyObject* callback;
+		if (!PyArg_ParseTuple(args, "dO", &frame, &callback))
+			return NULL;
+		return addCallback(getEngine(), frame, 0.0, callback);
+	}
+
+	static PyObject* nativeScheduleEvery(PyObject* self, PyObject* args) {
+		PythonEngine* engine = getEngine();
+		double period;
+		PyObject* callback;
+		PyObject* frameObj = Py_None;
+		if (!PyArg_ParseTuple(args, "dO|O", &period, &callback, &frameObj))
+			return NULL;
+		period = std::max(period, 1.0);
+		double frame = engine->getFrame() + period;
+		if (frameObj != Py_None) {
+			frame = PyFloat_AsDouble(frameObj);
+			if (PyErr_Occurred())
+				return NULL;
+		}
+		return addCallback(engine, frame, period, callback);
+	}
+
+	static PyObject* nativeCancel(PyObject* self, PyObject* args) {
+		PythonEngine* engine = getEngine();
+		int id;
+		if (!PyArg_ParseTuple(args, "i", &id))
+			return NULL;
+		engine->cancel(id);
+		PyObject* key = PyLong_FromLong(id);
+		DEFER({Py_DECREF(key);});
+		if (PyDict_DelItem(engine->callbacksDict, key))
+			PyErr_Clear();
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	static PyObject* nativeNow(PyObject* self, PyObject* args) {
+		return PyLong_FromLongLong(getEngine()->getFrame());
+	}
+
+	static Kernel* getKernelArg(PythonEngine* engine, int id) {
+		Kernel* kernel = engine->getKernel(id);
+		if (!kernel)
+			PyErr_SetString(PyExc_ValueError, "invalid kernel");
+		return kernel;
+	}
+
+	/** Gets a contiguous float32 buffer from a numpy array or other buffer object. */
+	static bool getFloat32Buffer(PyObject* obj, Py_buffer* view, bool writable) {
+		int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT;
+		if (writable)
+			flags |= PyBUF_WRITABLE;
+		if (PyObject_GetBuffer(obj, view, flags))
+			return false;
+		if (view->itemsize != sizeof(float) || !view->format || std::string(view->format) != "f") {
+			PyBuffer_Release(view);
+			PyErr_SetString(PyExc_TypeError, "expected a contiguous float32 array");
+			return false;
+		}
+		return true;
+	}
+
+	static PyObject* nativeKernelCreate(PyObject* self, PyObject* args) {
+		const char* name;
+		if (!PyArg_ParseTuple(args, "s", &name))
+			return NULL;
+		return PyLong_FromLong(getEngine()->addKernel(name));
+	}
+
+	static PyObject* nativeKernelSet(PyObject* self, PyObject* args) {
+		Py_ssize_t argc = PyTuple_Size(args);
+		if (argc < 1)
+			return NULL;
+		Kernel* kernel = getKernelArg(getEngine(), PyLong_AsLong(PyTuple_GET_ITEM(args, 0)));
+		if (!kernel)
+			return NULL;
+		float params[16];
+		int numParams = std::min((int) argc - 1, (int) LENGTHOF(params));
+		for (int i = 0; i < numParams; i++) {
+			params[i] = PyFloat_AsDouble(PyTuple_GET_ITEM(args, i + 1));
+			if (PyErr_Occurred())
+				return NULL;
+		}
+		kernel->setParams(params, numParams);
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	static PyObject* nativeKernelLoad(PyObject* self, PyObject* args) {
+		int id;
+		PyObject* dataObj;
+		if (!PyArg_ParseTuple(args, "iO", &id, &dataObj))
+			return NULL;
+		Kernel* kernel = getKernelArg(getEngine(), id);
+		if (!kernel)
+			return NULL;
+		// Audio file path
+		if (PyUnicode_Check(dataObj)) {
+			const char* path = PyUnicode_AsUTF8(dataObj);
+			if (!path)
+				return NULL;
+			PythonEngine* engine = getEngine();
+			kernel->loadFile(engine->resolvePath(path), engine->getSampleRate());
+			Py_INCREF(Py_None);
+			return Py_None;
+		}
+		// Accept any sequence of numbers by converting it to a float32 array
+		PyObject* array = PyArray_FROMANY(dataObj, NPY_FLOAT32, 1, 1, NPY_ARRAY_C_CONTIGUOUS);
+		if (!array)
+			return NULL;
+		DEFER({Py_DECREF(array);});
+		kernel->load((const float*) PyArray_DATA((PyArrayObject*) array), PyArray_SIZE((PyArrayObject*) array));
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	static PyObject* nativeSampleLoad(PyObject* self, PyObject* args) {
+		const char* path;
+		if (!PyArg_ParseTuple(args, "s", &path))
+			return NULL;
+		return PyLong_FromLong(getEngine()->addSample(path));
+	}
+
+	/** Returns (channels, sample_rate) with a read-only 2D view of the samples, or None if the sample is not loaded yet. */
+	static PyObject* nativeSampleInfo(PyObject* self, PyObject* args) {
+		int id;
+		if (!PyArg_ParseTuple(args, "i", &id))
+			return NULL;
+		PythonEngine* engine = getEngine();
+		Sample* sample = engine->getSample(id);
+		if (!sample) {
+			Py_INCREF(Py_None);
+			return Py_None;
+		}
+		npy_intp dims[] = {sample->channels, sample->frames};
+		PyObject* array = PyArray_SimpleNewFromData(2, dims, NPY_FLOAT32, const_cast<float*>(sample->data));
+		if (!array)
+			return NULL;
+		PyArray_CLEARFLAGS((PyArrayObject*) array, NPY_ARRAY_WRITEABLE);
+		// Keep the sample alive as long as the view, which may outlive this engine
+		std::shared_ptr<Sample>* owner = new std::shared_ptr<Sample>(engine->samples[id]);
+		PyObject* capsule = PyCapsule_New(owner, NULL, [](PyObject* capsule) {
+			delete (std::shared_ptr<Sample>*) PyCapsule_GetPointer(capsule, NULL);
+		});
+		if (!capsule) {
+			delete owner;
+			Py_DECREF(array);
+			return NULL;
+		}
+		// Steals the capsule reference, even on failure
+		if (PyArray_SetBaseObject((PyArrayObject*) array, capsule)) {
+			Py_DECREF(array);
+			return NULL;
+		}
+		return Py_BuildValue("(Nf)", array, sample->sampleRate);
+	}
+
+	/** Returns a writable 1D float32 view of a pooled buffer. */
+	static PyObject* nativeGetBuffer(PyObject* self, PyObject* args) {
+		const char* name;
+		int size;
+		if (!PyArg_ParseTuple(args, "si", &name, &size))
+			return NULL;
+		std::shared_ptr<PooledBuffer> buffer = getEngine()->getBuffer(name, size);
+		if (!buffer) {
+			PyErr_Format(PyExc_MemoryError, "Could not allocate buffer %s", name);
+			return NULL;
+		}
+		npy_intp dims[] = {(npy_intp) buffer->size};
+		PyObject* array = PyArray_SimpleNewFromData(1, dims, NPY_FLOAT32, buffer->data);
+		if (!array)
+			return NULL;
+		// Keep the buffer alive as long as the view, which may outlive this engine
+		std::shared_ptr<PooledBuffer>* owner = new std::shared_ptr<PooledBuffer>(buffer);
+		PyObject* capsule = PyCapsule_New(owner, NULL, [](PyObject* capsule) {
+			delete (std::shared_ptr<PooledBuffer>*) PyCapsule_GetPointer(capsule, NULL);
+		});
+		if (!capsule) {
+			delete owner;
+			Py_DECREF(array);
+			return NULL;
+		}
+		// Steals the capsule reference, even on failure
+		if (PyArray_SetBaseObject((PyArrayObject*) array, capsule)) {
+			Py_DECREF(array);
+			return NULL;
+		}
+		return array;
+	}
+
+	/** Returns (id, data, frames) with a writable 1D view of every slot of the bus. */
+	static PyObject* nativeBusOpen(PyObject* self, PyObject* args) {
+		const char* name;
+		int channels;
+		int publishing;
+		int delay;
+		if (!PyArg_ParseTuple(args, "sipi", &name, &channels, &publishing, &delay))
+			return NULL;
+		PythonEngine* engine = getEngine();
+		int id = engine->addBus(name, channels, publishing, delay);
+		BusPort* port = engine->getBus(id);
+		if (!port) {
+			PyErr_Format(PyExc_ValueError, "Could not open bus %s", name);
+			return NULL;
+		}
+		npy_intp dims[] = {(npy_intp) port->bus->memory.size};
+		PyObject* array = PyArray_SimpleNewFromData(1, dims, NPY_FLOAT32, port->bus->memory.data);
+		if (!array)
+			return NULL;
+		// Keep the bus alive as long as the view, which may outlive this engine
+		std::shared_ptr<Bus>* owner = new std::shared_ptr<Bus>(port->bus);
+		PyObject* capsule = PyCapsule_New(owner, NULL, [](PyObject* capsule) {
+			delete (std::shared_ptr<Bus>*) PyCapsule_GetPointer(capsule, NULL);
+		});
+		if (!capsule) {
+			delete owner;
+			Py_DECREF(array);
+			return NULL;
+		}
+		// Steals the capsule reference, even on failure
+		if (PyArray_SetBaseObject((PyArrayObject*) array, capsule)) {
+			Py_DECREF(array);
+			return NULL;
+		}
+		return Py_BuildValue("(iNi)", id, array, port->bus->frames);
+	}
+
+	static PyObject* nativeBusOffset(PyObject* self, PyObject* args) {
+		int id;
+		int channel;
+		if (!PyArg_ParseTuple(args, "ii", &id, &channel))
+			return NULL;
+		BusPort* port = getEngine()->getBus(id);
+		if (!port) {
+			PyErr_SetString(PyExc_ValueError, "invalid bus");
+			return NULL;
+		}
+		int offset = port->getOffset(channel);
+		if (offset < 0) {
+			PyErr_SetString(PyExc_IndexError, "invalid bus channel");
+			return NULL;
+		}
+		return PyLong_FromLong(offset);
+	}
+
+	static Stream* getStreamArg(PythonEngine* engine, int id) {
+		Stream* stream = engine->getStream(id);
+		if (!stream)
+			PyErr_SetString(PyExc_ValueError, "invalid stream");
+		return stream;
+	}
+
+	static PyObject* nativeStreamOpen(PyObject* self, PyObject* args) {
+		const char* path;
+		int recording;
+		int channels;
+		float sampleRate;
+		int loop;
+		if (!PyArg_ParseTuple(args, "spifp", &path, &recording, &channels, &sampleRate, &loop))
+			return NULL;
+		return PyLong_FromLong(getEngine()->addStream(path, recording, channels, sampleRate, loop));
+	}
+
+	/** Writes or reads up to `count` interleaved samples of a float32 array, or all of them if `count` is negative. */
+	static PyObject* transferStream(PyObject* args, bool recording) {
+		int id;
+		PyObject* dataObj;
+		int count = -1;
+		if (!PyArg_ParseTuple(args, "iO|i", &id, &dataObj, &count))
+			return NULL;
+		Stream* stream = getStreamArg(getEngine(), id);
+		if (!stream)
+			return NULL;
+		Py_buffer data;
+		if (!getFloat32Buffer(dataObj, &data, !recording))
+			return NULL;
+		DEFER({PyBuffer_Release(&data);});
+		Py_ssize_t n = data.len / sizeof(float);
+		if (count >= 0)
+			n = std::min(n, (Py_ssize_t) count);
+		if (recording)
+			return PyLong_FromLong(stream->write((const float*) data.buf, n));
+		return PyLong_FromLong(stream->read((float*) data.buf, n));
+	}
+
+	static PyObject* nativeStreamWrite(PyObject* self, PyObject* args) {
+		return transferStream(args, true);
+	}
+
+	static PyObject* nativeStreamRead(PyObject* self, PyObject* args) {
+		return transferStream(args, false);
+	}
+
+	static PyObject* nativeStreamEnded(PyObject* self, PyObject* args) {
+		int id;
+		if (!PyArg_ParseTuple(args, "i", &id))
+			return NULL;
+		Stream* stream = getStreamArg(getEngine(), id);
+		if (!stream)
+			return NULL;
+		return PyBool_FromLong(stream->isEnded());
+	}
+
+	static PyObject* nativeStreamClose(PyObject* self, PyObject* args) {
+		int id;
+		if (!PyArg_ParseTuple(args, "i", &id))
+			return NULL;
+		Stream* stream = getStreamArg(getEngine(), id);
+		if (!stream)
+			return NULL;
+		stream->close();
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	static PyObject* nativeKernelProcess(PyObject* self, PyObject* args) {
+		int id;
+		PyObject* inputObj;
+		PyObject* outputObj;
+		int count = -1;
+		if (!PyArg_ParseTuple(args, "iOO|i", &id, &inputObj, &outputObj, &count))
+			return NULL;
+		Kernel* kernel = getKernelArg(getEngine(), id);
+		if (!kernel)
+			return NULL;
+
+		Py_buffer output;
+		if (!getFloat32Buffer(outputObj, &output, true))
+			return NULL;
+		DEFER({PyBuffer_Release(&output);});
+		Py_ssize_t n = output.len / sizeof(float);
+		// input may be None for generators
+		Py_buffer input = {};
+		const float* in = NULL;
+		if (inputObj != Py_None) {
+			if (!getFloat32Buffer(inputObj, &input, false))
+				return NULL;
+			in = (const float*) input.buf;
+			n = std::min(n, input.len / (Py_ssize_t) sizeof(float));
+		}
+		DEFER({if (in) PyBuffer_Release(&input);});
+		if (count >= 0)
+			n = std::min(n, (Py_ssize_t) count);
+
+		kernel->process(in, (float*) output.buf, n);
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	static PyObject* nativeDisplay(PyObject* self, PyObject* args) {
+		PythonEngine* engine = getEngine();
 
 		PyObject* msgO = PyTuple_GetItem(args, 0);
 		if (!msgO)
@@ -1,7 +1,11 @@
 #include "ScriptEngine.hpp"
+#include "Kernels.hpp"
+#include "Samples.hpp"
+#include "Streams.hpp"
+#include "Buffers.hpp"
+#include "Buses.hpp"
 #include <quickjs/quickjs.h>
-
-static JSClassID QuickJSEngineClass;
+#include <mutex>
 
 static std::string ErrorToString(JSContext *ctx) {
   JSValue exception_val, val;
@@ -39,16 +43,72 @@ static std::string ErrorToString(JSContext *ctx) {
 }
 
 
+/** Returns `prelude` compiled to bytecode, compiling it with `ctx` on first use, or an empty vector if it has errors.
+Bytecode does not depend on the context that compiled it, so each context reads it instead of parsing the prelude again.
+*/
+static const std::vector<uint8_t>& getPreludeBytecode(JSContext* ctx, const std::string& prelude) {
+  static std::vector<uint8_t> bytecode;
+  static std::once_flag once;
+  std::call_once(once, [&]() {
+    JSValue func = JS_Eval(ctx, prelude.c_str(), prelude.size(), "QuickJS Prelude", JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+    if (JS_IsException(func)) {
+      JS_FreeValue(ctx, JS_GetException(ctx));
+      return;
+    }
+    size_t size;
+    uint8_t* data = JS_WriteObject(ctx, &size, func, JS_WRITE_OBJ_BYTECODE);
+    if (data) {
+      bytecode.assign(data, data + size);
+      js_free(ctx, data);
+    }
+    JS_FreeValue(ctx, func);
+  });
+  return bytecode;
+}
+
+
+/** A native function defined on the global object, or on another object such as `console` */
+struct QuickJSFunction {
+  const char* property;
+  const char* name;
+  JSCFunction* func;
+  int length;
+};
+
+
 struct QuickJSEngine : ScriptEngine {
   JSRuntime *rt = NULL;
 	JSContext *ctx = NULL;
+  // Held from run() so that process() does not look up globals by name
+  JSValue processFunc = JS_UNDEFINED;
+  JSValue processControlFunc = JS_UNDEFINED;
+  JSValue blockObj = JS_UNDEFINED;
+  JSValue callbacksObj = JS_UNDEFINED;
+  JSAtom sampleRateAtom = JS_ATOM_NULL;
+  JSAtom sampleTimeAtom = JS_ATOM_NULL;
+  JSAtom bufferSizeAtom = JS_ATOM_NULL;
+  JSAtom frameAtom = JS_ATOM_NULL;
+  JSAtom batchSizeAtom = JS_ATOM_NULL;
+  // Block properties last set on blockObj, since only the frame changes every block
+  float blockSampleRate = -1.f;
+  int blockBufferSize = -1;
+  int blockBatchSize = -1;
 
   QuickJSEngine() {
+    // A runtime can only be used by one thread at a time, and Rack processes modules on several threads, so sharing one would need a lock around process()
     rt = JS_NewRuntime();
   }
 
 	~QuickJSEngine() {
     if (ctx) {
+      JS_FreeValue(ctx, processFunc);
+      JS_FreeValue(ctx, processControlFunc);
+      JS_FreeValue(ctx, blockObj);
+      JS_FreeValue(ctx, callbacksObj);
+      for (JSAtom atom : {sampleRateAtom, sampleTimeAtom, bufferSizeAtom, frameAtom, batchSizeAtom}) {
+        if (atom != JS_ATOM_NULL)
+          JS_FreeAtom(ctx, atom);
+      }
       JS_FreeContext(ctx);
     }
     if (rt) {
@@ -71,38 +131,178 @@ struct QuickJSEngine : ScriptEngine {
 
 		// Initialize globals
     // user pointer
+    JS_SetContextOpaque(ctx, this);
     JSValue global_obj = JS_GetGlobalObject(ctx);
-    JSValue handle = JS_NewObjectClass(ctx, QuickJSEngineClass);
-    JS_SetOpaque(handle, this);
-    JS_SetPropertyStr(ctx, global_obj, "p", handle);
 
     // console
+    static const QuickJSFunction consoleFunctions[] = {
+      {"log", "log", native_console_log, 1},
+      {"info", "info", native_console_info, 1},
+      {"debug", "debug", native_console_debug, 1},
+      {"warn", "warn", native_console_warn, 1},
+    };
     JSValue console = JS_NewObject(ctx);
-    JS_SetPropertyStr(ctx, console, "log",
-                      JS_NewCFunction(ctx, native_console_log, "log", 1));
-    JS_SetPropertyStr(ctx, console, "info",
-                      JS_NewCFunction(ctx, native_console_info, "info", 1));
-    JS_SetPropertyStr(ctx, console, "debug",
-                      JS_NewCFunction(ctx, native_console_debug, "debug", 1));
-    JS_SetPropertyStr(ctx, console, "warn",
-                      JS_NewCFunction(ctx, native_console_warn, "warn", 1));
+    setFunctions(console, consoleFunctions, LENGTHOF(consoleFunctions));
     JS_SetPropertyStr(ctx, global_obj, "console", console);
 
-    // display
-    JS_SetPropertyStr(ctx, global_obj, "display",
-                      JS_NewCFunction(ctx, native_display, "display", 1));
-
 		// config: Set defaults
     JSValue config = JS_NewObject(ctx);
-    // frameDivider
-    JSValue fd =JS_NewInt32(ctx, 32);
-    JS_SetPropertyStr(ctx, config, "frameDivider", fd);
-    JS_FreeValue(ctx, fd);
-    // bufferSize
-    JSValue bs = JS_NewInt32(ctx, 1);
-    JS_SetPropertyStr(ctx, config, "bufferSize", bs);
+    for (const ConfigKey& key : CONFIG_KEYS) {
+      if (key.size > 0) {
+        JSValue arr = JS_NewArray(ctx);
+        for (int i = 0; i < key.size; i++) {
+          JS_SetPropertyUint32(ctx, arr, i, JS_NewFloat64(ctx, key.defaultValue));
+        }
+        JS_SetPropertyStr(ctx, config, key.name, arr);
+      }
+      else {
+        JS_SetPropertyStr(ctx, config, key.name, JS_NewFloat64(ctx, key.defaultValue));
+      }
+    }
     JS_SetPropertyStr(ctx, global_obj, "config", config);
-    JS_FreeValue(ctx, bs);
+
+    // Natives wrapped by the prelude
+    static const QuickJSFunction globalFunctions[] = {
+      {"display", "display", native_display, 1},
+      // scheduler
+      {"__schedule", "__schedule", native_schedule, 2},
+      {"__cancel", "__cancel", native_cancel, 1},
+      {"now", "now", native_now, 0},
+      // kernels
+      {"__kernelCreate", "__kernelCreate", native_kernel_create, 1},
+      {"__kernelSet", "set", native_kernel_set, 4},
+      {"__kernelLoad", "load", native_kernel_load, 1},
+      {"__kernelProcess", "process", native_kernel_process, 3},
+      // samples
+      {"__sampleLoad", "__sampleLoad", native_sample_load, 1},
+      {"__sampleInfo", "__sampleInfo", native_sample_info, 1},
+      // streams
+      {"__streamOpen", "__streamOpen", native_stream_open, 5},
+      {"__streamWrite", "write", native_stream_write, 2},
+      {"__streamRead", "read", native_stream_read, 2},
+      {"__streamEnded", "ended", native_stream_ended, 0},
+      {"__streamClose", "close", native_stream_close, 0},
+      // buffers
+      {"__bufferGet", "__bufferGet", native_buffer_get, 2},
+      // workers
+      {"__workersCreate", "__workersCreate", native_workers_create, 2},
+      {"__workersFork", "fork", native_workers_fork, 0},
+      {"__workersJoin", "join", native_workers_join, 1},
+      // buses
+      {"__busOpen", "__busOpen", native_bus_open, 4},
+      {"__busData", "__busData", native_bus_data, 1},
+      {"__busOffset", "offset", native_bus_offset, 1},
+    };
+    setFunctions(global_obj, globalFunctions, LENGTHOF(globalFunctions));
+    JS_SetPropertyStr(ctx, global_obj, "workerIndex", JS_NewInt32(ctx, workerIndex));
+
+    // Scheduled callbacks are kept in __callbacks by id so the host can call them with processScheduled().
+    static const std::string prelude = R"(
+    var __callbacks = {};
+    function schedule(frame, callback) {
+      var id = __schedule(frame, 0);
+      __callbacks[id] = callback;
+      return id;
+    }
+    function scheduleEvery(period, callback, frame) {
+      period = Math.max(period, 1);
+      if (frame === undefined)
+        frame = now() + period;
+      var id = __schedule(frame, period);
+      __callbacks[id] = callback;
+      return id;
+    }
+    function cancel(id) {
+      __cancel(id);
+      delete __callbacks[id];
+    }
+    function spawn(generatorFunction) {
+      var generator = generatorFunction();
+      function resume(frame) {
+        schedule(frame, function(block, offset) {
+          var result = generator.next(block);
+          if (!result.done)
+            resume(frame + Math.max(Math.floor(result.value) || 1, 1));
+        });
+      }
+      resume(now());
+    }
+    function Kernel(name) {
+      this.id = __kernelCreate(name);
+      if (this.id < 0)
+        throw new Error("Unknown kernel " + name);
+    }
+    Kernel.prototype.set = __kernelSet;
+    Kernel.prototype.load = __kernelLoad;
+    Kernel.prototype.process = __kernelProcess;
+    function Sample(path) {
+      this.id = __sampleLoad(path);
+      this.channels = [];
+      this.frames = 0;
+      this.sampleRate = 0;
+    }
+    Sample.prototype.ready = function() {
+      if (this.channels.length > 0)
+        return true;
+      var info = __sampleInfo(this.id);
+      if (!info)
+        return false;
+      this.frames = info.frames;
+      this.sampleRate = info.sampleRate;
+      this.channels = info.buffers.map(function(buffer) {return new Float32Array(buffer);});
+      return true;
+    };
+    function Recorder(path, channels, sampleRate) {
+      this.id = __streamOpen(path, true, channels || 1, sampleRate || 0, false);
+    }
+    Recorder.prototype.write = __streamWrite;
+    Recorder.prototype.close = __streamClose;
+    function Player(path, channels, loop) {
+      this.id = __streamOpen(path, false, channels || 1, 0, !!loop);
+    }
+    Player.prototype.read = __streamRead;
+    Player.prototype.ended = __streamEnded;
+    Player.prototype.close = __streamClose;
+    function getBuffer(name, size) {
+      var buffer = __bufferGet(String(name), size);
+      if (!buffer)
+        throw new Error("Could not allocate buffer " + name);
+      return new Float32Array(buffer);
+    }
+    function Workers(path, count) {
+      this.id = __workersCreate(path, count || 1);
+      if (this.id < 0)
+        throw new Error("Could not create workers " + path);
+    }
+    Workers.prototype.fork = __workersFork;
+    Workers.prototype.join = __workersJoin;
+    function Bus(name, channels, publish, delay) {
+      this.id = __busOpen(String(name), channels || 1, !!publish, delay || 0);
+      if (this.id < 0)
+        throw new Error("Could not open bus " + name);
+      this.data = new Float32Array(__busData(this.id));
+      this.channels = channels || 1;
+      this.frames = this.data.length / (4 * this.channels);
+    }
+    Bus.prototype.offset = __busOffset;
+    )";
+
+    const std::vector<uint8_t>& preludeBytecode = getPreludeBytecode(ctx, prelude);
+    JSValue preludeVal;
+    if (!preludeBytecode.empty()) {
+      JSValue preludeFunc = JS_ReadObject(ctx, preludeBytecode.data(), preludeBytecode.size(), JS_READ_OBJ_BYTECODE);
+      preludeVal = JS_IsException(preludeFunc) ? preludeFunc : JS_EvalFunction(ctx, preludeFunc);
+    }
+    else {
+      // Evaluate the source to report its error
+      preludeVal = JS_Eval(ctx, prelude.c_str(), prelude.size(), "QuickJS Prelude", 0);
+    }
+    if (JS_IsException(preludeVal)) {
+      std::string errorString = ErrorToString(ctx);
+      WARN("QuickJS: %s", errorString.c_str());
+      display(errorString.c_str());
+    }
+    JS_FreeValue(ctx, preludeVal);
 
 		// Compile string
     JSValue val = JS_Eval(ctx, script.c_str(), script.size(), path.c_str(), 0);
@@ -118,170 +318,203 @@ struct QuickJSEngine : ScriptEngine {
     // config: Read values
     config = JS_GetPropertyStr(ctx, global_obj, "config");
     {
-      // frameDivider
-      JSValue divider = JS_GetPropertyStr(ctx, config, "frameDivider");
-      int32_t dividerValue;
-      if (JS_ToInt32(ctx, &dividerValue, divider) == 0) {
-        setFrameDivider(dividerValue);
-      }
-
-      // bufferSize
-      JSValue buffer = JS_GetPropertyStr(ctx, config, "bufferSize");
-      int32_t bufferValue;
-      if (JS_ToInt32(ctx, &bufferValue, buffer) == 0) {
-        setBufferSize(bufferValue);
+      for (const ConfigKey& key : CONFIG_KEYS) {
+        JSValue value = JS_GetPropertyStr(ctx, config, key.name);
+        double number;
+        if (key.size > 0) {
+          for (int i = 0; i < key.size; i++) {
+            JSValue element = JS_GetPropertyUint32(ctx, value, i);
+            if (JS_ToFloat64(ctx, &number, element) == 0) {
+              setConfigIfChanged(key.name, number, i);
+            }
+            JS_FreeValue(ctx, element);
+          }
+        }
+        else if (JS_ToFloat64(ctx, &number, value) == 0) {
+          setConfigIfChanged(key.name, number);
+        }
+        JS_FreeValue(ctx, value);
       }
 
       JS_FreeValue(ctx, config);
     }
 
     // block
-    JSValue blockIdx = JS_NewObject(ctx);
     {
-      // inputs
-      JSValue arr = JS_NewArray(ctx);
-      for (int i = 0; i < NUM_ROWS; i++) {
-        JSValue buffer = JS_NewArrayBuffer(ctx, (uint8_t *) block->inputs[i], sizeof(float) * block->bufferSize, NULL, NULL, true);
-        if (JS_SetPropertyUint32(ctx, arr, i, buffer) < 0) {
-          WARN("Unable to set property %d of inputs array", i);
-        }
-      }
-      JS_SetPropertyStr(ctx, blockIdx, "inputs", arr);
-
-      // outputs
-      arr = JS_NewArray(ctx);
-      for (int i = 0; i < NUM_ROWS; i++) {
-        JSValue buffer = JS_NewArrayBuffer(ctx, (uint8_t *) block->outputs[i], sizeof(float) * block->bufferSize, NULL, NULL, true);
-        if (JS_SetPropertyUint32(ctx, arr, i, buffer) < 0) {
-          WARN("Unable to set property %d of outputs array", i);
-        }
-      }
-      JS_SetPropertyStr(ctx, blockIdx, "outputs", arr);
-
-      // knobs
-      JSValue knobsIdx = JS_NewArrayBuffer(ctx, (uint8_t *) &block->knobs, sizeof(float) * NUM_ROWS, NULL, NULL, true);
-      JS_SetPropertyStr(ctx, blockIdx, "knobs", knobsIdx);
-
-      // switches
-      JSValue switchesIdx = JS_NewArrayBuffer(ctx, (uint8_t *) &block->switches, sizeof(bool) * NUM_ROWS, NULL, NULL, true);
-      JS_SetPropertyStr(ctx, blockIdx, "switches", switchesIdx);
-
-      // lights
-      arr = JS_NewArray(ctx);
-      for (int i = 0; i < NUM_ROWS; i++) {
-        JSValue buffer = JS_NewArrayBuffer(ctx, (uint8_t *) &block->lights[i], sizeof(float) * 3, NULL, NULL, true);
-        if (JS_SetPropertyUint32(ctx, arr, i, buffer) < 0) {
-          WARN("Unable to set property %d of lights array", i);
-        }
-      }
-      JS_SetPropertyStr(ctx, blockIdx, "lights", arr);
-
-      // switchlights
-      arr = JS_NewArray(ctx);
-      for (int i = 0; i < NUM_ROWS; i++) {
-        JSValue buffer = JS_NewArrayBuffer(ctx, (uint8_t *) &block->switchLights[i], sizeof(float) * 3, NULL, NULL, true);
-        if (JS_SetPropertyUint32(ctx, arr, i, buffer) < 0) {
-          WARN("Unable to set property %d of switchLights array", i);
-        }
-      }
-      JS_SetPropertyStr(ctx, blockIdx, "switchLights", arr);
+      JSValue float32Array = JS_GetPropertyStr(ctx, global_obj, "Float32Array");
+      JSValue int32Array = JS_GetPropertyStr(ctx, global_obj, "Int32Array");
+      JSValue uint8Array = JS_GetPropertyStr(ctx, global_obj, "Uint8Array");
+      // In batch mode, every row holds the blocks of all instances, including knob buffers and events
+      int rowSize = block->bufferSize * block->batchSize;
+      blockObj = JS_NewObject(ctx);
+
+      JS_SetPropertyStr(ctx, blockObj, "inputs", newTypedArrays(float32Array, block->inputs, sizeof(block->inputs[0]), sizeof(float) * rowSize));
+      JS_SetPropertyStr(ctx, blockObj, "outputs", newTypedArrays(float32Array, block->outputs, sizeof(block->outputs[0]), sizeof(float) * rowSize));
+      JS_SetPropertyStr(ctx, blockObj, "knobs", newTypedArray(float32Array, block->knobs, sizeof(block->knobs)));
+      JS_SetPropertyStr(ctx, blockObj, "rowBufferSizes", newTypedArray(int32Array, block->rowBufferSizes, sizeof(block->rowBufferSizes)));
+      JS_SetPropertyStr(ctx, blockObj, "switches", newTypedArray(uint8Array, block->switches, sizeof(block->switches)));
+      JS_SetPropertyStr(ctx, blockObj, "lights", newTypedArrays(float32Array, block->lights, sizeof(block->lights[0]), sizeof(block->lights[0])));
+      JS_SetPropertyStr(ctx, blockObj, "switchLights", newTypedArrays(float32Array, block->switchLights, sizeof(block->switchLights[0]), sizeof(block->switchLights[0])));
+      JS_SetPropertyStr(ctx, blockObj, "knobBuffers", newTypedArrays(float32Array, block->knobBuffers, sizeof(block->knobBuffers[0]), sizeof(float) * rowSize));
+      JS_SetPropertyStr(ctx, blockObj, "switchBuffers", newTypedArrays(uint8Array, block->switchBuffers, sizeof(block->switchBuffers[0]), sizeof(bool) * rowSize));
+
+      // events
+      JS_SetPropertyStr(ctx, blockObj, "inputEventCounts", newTypedArray(int32Array, block->inputEventCounts, sizeof(block->inputEventCounts)));
+      JS_SetPropertyStr(ctx, blockObj, "outputEventCounts", newTypedArray(int32Array, block->outputEventCounts, sizeof(block->outputEventCounts)));
+      JS_SetPropertyStr(ctx, blockObj, "inputEventOffsets", newTypedArrays(int32Array, block->inputEventOffsets, sizeof(block->inputEventOffsets[0]), sizeof(int) * rowSize));
+      JS_SetPropertyStr(ctx, blockObj, "inputEventTypes", newTypedArrays(uint8Array, block->inputEventTypes, sizeof(block->inputEventTypes[0]), sizeof(uint8_t) * rowSize));
+      JS_SetPropertyStr(ctx, blockObj, "outputEventOffsets", newTypedArrays(int32Array, block->outputEventOffsets, sizeof(block->outputEventOffsets[0]), sizeof(int) * rowSize));
+      JS_SetPropertyStr(ctx, blockObj, "outputEventTypes", newTypedArrays(uint8Array, block->outputEventTypes, sizeof(block->outputEventTypes[0]), sizeof(uint8_t) * rowSize));
+
+      // batch
+      JS_SetPropertyStr(ctx, blockObj, "batchKnobs", newTypedArrays(float32Array, block->batchKnobs, sizeof(block->batchKnobs[0]), sizeof(block->batchKnobs[0])));
+      JS_SetPropertyStr(ctx, blockObj, "batchSwitches", newTypedArrays(uint8Array, block->batchSwitches, sizeof(block->batchSwitches[0]), sizeof(block->batchSwitches[0])));
+      JS_SetPropertyStr(ctx, blockObj, "batchLights", newTypedArrays(float32Array, block->batchLights, sizeof(block->batchLights[0]), sizeof(block->batchLights[0])));
+      JS_SetPropertyStr(ctx, blockObj, "batchSwitchLights", newTypedArrays(float32Array, block->batchSwitchLights, sizeof(block->batchSwitchLights[0]), sizeof(block->batchSwitchLights[0])));
+
+      JS_FreeValue(ctx, float32Array);
+      JS_FreeValue(ctx, int32Array);
+      JS_FreeValue(ctx, uint8Array);
     }
+    JS_SetPropertyStr(ctx, global_obj, "block", JS_DupValue(ctx, blockObj));
 
-    JS_SetPropertyStr(ctx, global_obj, "block", blockIdx);
+    sampleRateAtom = JS_NewAtom(ctx, "sampleRate");
+    sampleTimeAtom = JS_NewAtom(ctx, "sampleTime");
+    bufferSizeAtom = JS_NewAtom(ctx, "bufferSize");
+    frameAtom = JS_NewAtom(ctx, "frame");
+    batchSizeAtom = JS_NewAtom(ctx, "batchSize");
+    updateBlock();
 
-    // this is a horrible hack to get QuickJS to allocate the correct types
-    static const std::string updateTypes = R"(
-    for (var i = 0; i < 6; i++) {
-      block.inputs[i] = new Float32Array(block.inputs[i]);
-      block.outputs[i] = new Float32Array(block.outputs[i]);
-      block.lights[i] = new Float32Array(block.lights[i]);
-      block.switchLights[i] = new Float32Array(block.switchLights[i]);
-    }
-    block.knobs = new Float32Array(block.knobs);
-    block.switches = new Uint8Array(block.switches);
-    )";
-
-    JSValue hack = JS_Eval(ctx, updateTypes.c_str(), updateTypes.size(), "QuickJS Hack", 0);
-    if (JS_IsException(hack)) {
-      std::string errorString = ErrorToString(ctx);
-      WARN("QuickJS: %s", errorString.c_str());
-      display(errorString.c_str());
-    }
-
-    JS_FreeValue(ctx, hack);
+    // process() and processControl() are optional, and are looked up once after the script has run
+    processFunc = getFunction(global_obj, "process");
+    processControlFunc = getFunction(global_obj, "processControl");
+    callbacksObj = JS_GetPropertyStr(ctx, global_obj, "__callbacks");
 
     JS_FreeValue(ctx, val);
     JS_FreeValue(ctx, global_obj);
 
-    if (JS_IsException(val)) {
-      std::string errorString = ErrorToString(ctx);
-      WARN("QuickJS: %s", errorString.c_str());
-      display(errorString.c_str());
-
-      JS_FreeValue(ctx, val);
-      JS_FreeValue(ctx, blockIdx);
-      JS_FreeValue(ctx, global_obj);
+		return 0;
+	}
 
-      return -1;
+  void setFunctions(JSValueConst obj, const QuickJSFunction* functions, int count) {
+    for (int i = 0; i < count; i++) {
+      const QuickJSFunction& f = functions[i];
+      JS_SetPropertyStr(ctx, obj, f.property, JS_NewCFunction(ctx, f.func, f.name, f.length));
     }
+  }
 
-		return 0;
-	}
+  /** Returns a typed array over `size` bytes at `data`, constructed with `ctor` such as Float32Array. */
+  JSValue newTypedArray(JSValueConst ctor, void* data, size_t size) {
+    // The block outlives the context, so the ArrayBuffer does not need a free function
+    JSValue buffer = JS_NewArrayBuffer(ctx, (uint8_t *) data, size, NULL, NULL, true);
+    JSValue array = JS_CallConstructor(ctx, ctor, 1, &buffer);
+    JS_FreeValue(ctx, buffer);
+    return array;
+  }
 
-	int process() override {
-    // global object
-    JSValue global_obj = JS_GetGlobalObject(ctx);
+  /** Returns an array of NUM_ROWS typed arrays over the rows of `rows`, which are `stride` bytes apart. */
+  JSValue newTypedArrays(JSValueConst ctor, void* rows, size_t stride, size_t size) {
+    JSValue arr = JS_NewArray(ctx);
+    for (int i = 0; i < NUM_ROWS; i++) {
+      JS_SetPropertyUint32(ctx, arr, i, newTypedArray(ctor, (uint8_t *) rows + i * stride, size));
+    }
+    return arr;
+  }
 
-    // block
-    ProcessBlock* block = getProcessBlock();
-    JSValue blockIdx = JS_GetPropertyStr(ctx, global_obj, "block");
-    {
-      // sampleRate
-      JSValue sampleRate = JS_NewFloat64(ctx, (double) block->sampleRate);
-      JS_SetPropertyStr(ctx, blockIdx, "sampleRate", sampleRate);
+  /** Returns a new reference to the global function `name`, or undefined. */
+  JSValue getFunction(JSValueConst global_obj, const char* name) {
+    JSValue func = JS_GetPropertyStr(ctx, global_obj, name);
+    if (JS_IsFunction(ctx, func))
+      return func;
+    JS_FreeValue(ctx, func);
+    return JS_UNDEFINED;
+  }
 
-      // sampleTime
-      JSValue sampleTime = JS_NewFloat64(ctx, (double) block->sampleTime);
-      JS_SetPropertyStr(ctx, blockIdx, "sampleTime", sampleTime);
+  void updateBlock() {
+    ProcessBlock* block = getProcessBlock();
 
-      // bufferSize
-      JSValue bufferSize = JS_NewInt32(ctx, (double) block->bufferSize);
-      JS_SetPropertyStr(ctx, blockIdx, "bufferSize", bufferSize);
+    if (block->sampleRate != blockSampleRate) {
+      blockSampleRate = block->sampleRate;
+      JS_SetProperty(ctx, blockObj, sampleRateAtom, JS_NewFloat64(ctx, (double) block->sampleRate));
+      JS_SetProperty(ctx, blockObj, sampleTimeAtom, JS_NewFloat64(ctx, (double) block->sampleTime));
     }
+    if (block->bufferSize != blockBufferSize) {
+      blockBufferSize = block->bufferSize;
+      JS_SetProperty(ctx, blockObj, bufferSizeAtom, JS_NewInt32(ctx, block->bufferSize));
+    }
+    if (block->batchSize != blockBatchSize) {
+      blockBatchSize = block->batchSize;
+      JS_SetProperty(ctx, blockObj, batchSizeAtom, JS_NewInt32(ctx, block->batchSize));
+    }
+    JS_SetProperty(ctx, blockObj, frameAtom, JS_NewFloat64(ctx, (double) block->frame));
+  }
 
-    JSValue process = JS_GetPropertyStr(ctx, global_obj, "process");
-
-    JSValue val = JS_Call(ctx, process, JS_UNDEFINED, 1, &blockIdx);
+	int process() override {
+    // process() is optional when the script only uses scheduled callbacks
+    if (JS_IsUndefined(processFunc))
+      return 0;
 
+    updateBlock();
+    JSValue val = JS_Call(ctx, processFunc, JS_UNDEFINED, 1, &blockObj);
+    int err = 0;
     if (JS_IsException(val)) {
       std::string errorString = ErrorToString(ctx);
       WARN("QuickJS: %s", errorString.c_str());
       display(errorString.c_str());
+      err = -1;
+    }
 
-      JS_FreeValue(ctx, val);
-      JS_FreeValue(ctx, process);
-      JS_FreeValue(ctx, blockIdx);
-      JS_FreeValue(ctx, global_obj);
+    JS_FreeValue(ctx, val);
+		return err;
+	}
 
-      return -1;
+	int processControl() override {
+    if (JS_IsUndefined(processControlFunc))
+      return 0;
+
+    JSValue val = JS_Call(ctx, processControlFunc, JS_UNDEFINED, 1, &blockObj);
+    int err = 0;
+    if (JS_IsException(val)) {
+      std::string errorString = ErrorToString(ctx);
+      WARN("QuickJS: %s", errorString.c_str());
+      display(errorString.c_str());
+      err = -1;
     }
 
     JS_FreeValue(ctx, val);
-    JS_FreeValue(ctx, process);
-    JS_FreeValue(ctx, global_obj);
+    return err;
+  }
 
-		return 0;
-	}
+  int processScheduled(int id, int offset, bool last) override {
+    JSValue callback = JS_GetPropertyUint32(ctx, callbacksObj, id);
+    if (last) {
+      JSAtom atom = JS_NewAtomUInt32(ctx, id);
+      JS_DeleteProperty(ctx, callbacksObj, atom, 0);
+      JS_FreeAtom(ctx, atom);
+    }
 
-  static QuickJSEngine* getQuickJSEngine(JSContext* ctx) {
-    JSValue global_obj = JS_GetGlobalObject(ctx);
-    JSValue p = JS_GetPropertyStr(ctx, global_obj, "p");
-		QuickJSEngine* engine = (QuickJSEngine*) JS_GetOpaque(p, QuickJSEngineClass);
+    int err = 0;
+    if (JS_IsFunction(ctx, callback)) {
+      JSValue args[2];
+      args[0] = blockObj;
+      args[1] = JS_NewInt32(ctx, offset);
+      updateBlock();
+      JSValue val = JS_Call(ctx, callback, JS_UNDEFINED, 2, args);
+      if (JS_IsException(val)) {
+        std::string errorString = ErrorToString(ctx);
+        WARN("QuickJS: %s", errorString.c_str());
+        display(errorString.c_str());
+        err = -1;
+      }
+      JS_FreeValue(ctx, val);
+    }
 
-    JS_FreeValue(ctx, p);
-    JS_FreeValue(ctx, global_obj);
+    JS_FreeValue(ctx, callback);
+    return err;
+  }
 
-		return engine;
+  static QuickJSEngine* getQuickJSEngine(JSContext* ctx) {
+		return (QuickJSEngine*) JS_GetContextOpaque(ctx);
 	}
 
 	static JSValue native_console_log(JSContext* ctx, JSValueConst this_val,
@@ -316,6 +549,354 @@ struct QuickJSEngine : ScriptEngine {
     }
 		return JS_UNDEFINED;
 	}
+	static JSValue native_schedule(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    double frame = 0.0;
+    double period = 0.0;
+    if (argc < 1 || JS_ToFloat64(ctx, &frame, argv[0]))
+      return JS_EXCEPTION;
+    if (argc >= 2 && JS_ToFloat64(ctx, &period, argv[1]))
+      return JS_EXCEPTION;
+    int id = getQuickJSEngine(ctx)->schedule((int64_t) frame, (int64_t) period);
+    return JS_NewInt32(ctx, id);
+  }
+	static JSValue native_cancel(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    int32_t id;
+    if (argc >= 1 && JS_ToInt32(ctx, &id, argv[0]) == 0)
+      getQuickJSEngine(ctx)->cancel(id);
+    return JS_UNDEFINED;
+  }
+	static JSValue native_now(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    return JS_NewFloat64(ctx, (double) getQuickJSEngine(ctx)->getFrame());
+  }
+  /** Returns the kernel of a Kernel object, or NULL. */
+  static Kernel* getThisKernel(JSContext* ctx, JSValueConst kernelObj) {
+    JSValue idVal = JS_GetPropertyStr(ctx, kernelObj, "id");
+    int32_t id = -1;
+    JS_ToInt32(ctx, &id, idVal);
+    JS_FreeValue(ctx, idVal);
+    return getQuickJSEngine(ctx)->getKernel(id);
+  }
+
+  /** Returns the data of a Float32Array, or NULL. */
+  static float* getFloat32Array(JSContext* ctx, JSValueConst val, size_t* length) {
+    size_t byteOffset, byteLength, bytesPerElement;
+    JSValue buffer = JS_GetTypedArrayBuffer(ctx, val, &byteOffset, &byteLength, &bytesPerElement);
+    if (JS_IsException(buffer)) {
+      // Not a typed array
+      JS_FreeValue(ctx, JS_GetException(ctx));
+      return NULL;
+    }
+    size_t size;
+    uint8_t* data = JS_GetArrayBuffer(ctx, &size, buffer);
+    JS_FreeValue(ctx, buffer);
+    if (!data || bytesPerElement != sizeof(float))
+      return NULL;
+    *length = byteLength / sizeof(float);
+    return (float*) (data + byteOffset);
+  }
+
+	static JSValue native_kernel_create(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    if (argc < 1)
+      return JS_NewInt32(ctx, -1);
+    const char* name = JS_ToCString(ctx, argv[0]);
+    if (!name)
+      return JS_EXCEPTION;
+    int id = getQuickJSEngine(ctx)->addKernel(name);
+    JS_FreeCString(ctx, name);
+    return JS_NewInt32(ctx, id);
+  }
+	static JSValue native_kernel_set(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    Kernel* kernel = getThisKernel(ctx, this_val);
+    if (!kernel)
+      return JS_ThrowTypeError(ctx, "not a Kernel");
+    float params[16];
+    int numParams = std::min(argc, (int) LENGTHOF(params));
+    for (int i = 0; i < numParams; i++) {
+      double param;
+      if (JS_ToFloat64(ctx, &param, argv[i]))
+        return JS_EXCEPTION;
+      params[i] = param;
+    }
+    kernel->setParams(params, numParams);
+    return JS_UNDEFINED;
+  }
+	static JSValue native_kernel_load(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    Kernel* kernel = getThisKernel(ctx, this_val);
+    if (!kernel)
+      return JS_ThrowTypeError(ctx, "not a Kernel");
+    if (argc < 1)
+      return JS_UNDEFINED;
+    // Audio file path
+    if (JS_IsString(argv[0])) {
+      const char* path = JS_ToCString(ctx, argv[0]);
+      if (!path)
+        return JS_EXCEPTION;
+      QuickJSEngine* engine = getQuickJSEngine(ctx);
+      kernel->loadFile(engine->resolvePath(path), engine->getSampleRate());
+      JS_FreeCString(ctx, path);
+      return JS_UNDEFINED;
+    }
+    size_t length;
+    float* data = getFloat32Array(ctx, argv[0], &length);
+    if (data) {
+      kernel->load(data, length);
+      return JS_UNDEFINED;
+    }
+    // Plain arrays
+    JSValue lengthVal = JS_GetPropertyStr(ctx, argv[0], "length");
+    int32_t size = 0;
+    JS_ToInt32(ctx, &size, lengthVal);
+    JS_FreeValue(ctx, lengthVal);
+    std::vector<float> values(std::max(size, 0));
+    for (int i = 0; i < (int) values.size(); i++) {
+      JSValue element = JS_GetPropertyUint32(ctx, argv[0], i);
+      double value = 0.0;
+      JS_ToFloat64(ctx, &value, element);
+      JS_FreeValue(ctx, element);
+      values[i] = value;
+    }
+    kernel->load(values.data(), values.size());
+    return JS_UNDEFINED;
+  }
+	static JSValue native_kernel_process(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    Kernel* kernel = getThisKernel(ctx, this_val);
+    if (!kernel)
+      return JS_ThrowTypeError(ctx, "not a Kernel");
+    if (argc < 2)
+      return JS_ThrowTypeError(ctx, "process(input, output[, n]) requires an output array");
+    size_t outLength;
+    float* out = getFloat32Array(ctx, argv[1], &outLength);
+    if (!out)
+      return JS_ThrowTypeError(ctx, "output is not a Float32Array");
+    size_t n = outLength;
+    // input may be null for generators
+    float* in = NULL;
+    if (!JS_IsNull(argv[0]) && !JS_IsUndefined(argv[0])) {
+      size_t inLength;
+      in = getFloat32Array(ctx, argv[0], &inLength);
+      if (!in)
+        return JS_ThrowTypeError(ctx, "input is not a Float32Array");
+      n = std::min(n, inLength);
+    }
+    if (argc >= 3 && !JS_IsUndefined(argv[2])) {
+      int32_t count;
+      if (JS_ToInt32(ctx, &count, argv[2]))
+        return JS_EXCEPTION;
+      n = std::min(n, (size_t) std::max(count, 0));
+    }
+    kernel->process(in, out, n);
+    return JS_UNDEFINED;
+  }
+
+	static JSValue native_sample_load(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    if (argc < 1)
+      return JS_ThrowTypeError(ctx, "path required");
+    const char* path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+      return JS_EXCEPTION;
+    int id = getQuickJSEngine(ctx)->addSample(path);
+    JS_FreeCString(ctx, path);
+    return JS_NewInt32(ctx, id);
+  }
+  /** Returns {frames, sampleRate, buffers} with an ArrayBuffer over each channel, or undefined if the sample is not loaded yet. */
+	static JSValue native_sample_info(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    int32_t id = -1;
+    if (argc < 1 || JS_ToInt32(ctx, &id, argv[0]))
+      return JS_EXCEPTION;
+    Sample* sample = getQuickJSEngine(ctx)->getSample(id);
+    if (!sample)
+      return JS_UNDEFINED;
+    JSValue info = JS_NewObject(ctx);
+    JS_SetPropertyStr(ctx, info, "frames", JS_NewInt32(ctx, sample->frames));
+    JS_SetPropertyStr(ctx, info, "sampleRate", JS_NewFloat64(ctx, sample->sampleRate));
+    JSValue buffers = JS_NewArray(ctx);
+    for (int c = 0; c < sample->channels; c++) {
+      // The engine keeps the sample alive, so the buffer does not need a free function
+      JSValue buffer = JS_NewArrayBuffer(ctx, (uint8_t *) const_cast<float*>(sample->getChannel(c)), sizeof(float) * sample->frames, NULL, NULL, true);
+      JS_SetPropertyUint32(ctx, buffers, c, buffer);
+    }
+    JS_SetPropertyStr(ctx, info, "buffers", buffers);
+    return info;
+  }
+
+  static Stream* getThisStream(JSContext* ctx, JSValueConst streamObj) {
+    JSValue idVal = JS_GetPropertyStr(ctx, streamObj, "id");
+    int32_t id = -1;
+    JS_ToInt32(ctx, &id, idVal);
+    JS_FreeValue(ctx, idVal);
+    return getQuickJSEngine(ctx)->getStream(id);
+  }
+	static JSValue native_stream_open(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    if (argc < 5)
+      return JS_ThrowTypeError(ctx, "path required");
+    const char* path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+      return JS_EXCEPTION;
+    int32_t channels = 1;
+    double sampleRate = 0.0;
+    JS_ToInt32(ctx, &channels, argv[2]);
+    JS_ToFloat64(ctx, &sampleRate, argv[3]);
+    int id = getQuickJSEngine(ctx)->addStream(path, JS_ToBool(ctx, argv[1]), channels, sampleRate, JS_ToBool(ctx, argv[4]));
+    JS_FreeCString(ctx, path);
+    return JS_NewInt32(ctx, id);
+  }
+  /** Returns the number of interleaved samples to pass to write() or read(), limited by the array length. */
+  static int getStreamCount(JSContext* ctx, int argc, JSValueConst *argv, size_t length) {
+    size_t n = length;
+    if (argc >= 2 && !JS_IsUndefined(argv[1])) {
+      int32_t count = 0;
+      JS_ToInt32(ctx, &count, argv[1]);
+      n = std::min(n, (size_t) std::max(count, 0));
+    }
+    return n;
+  }
+	static JSValue native_stream_write(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    Stream* stream = getThisStream(ctx, this_val);
+    if (!stream)
+      return JS_ThrowTypeError(ctx, "not a Recorder");
+    size_t length;
+    float* data = (argc >= 1) ? getFloat32Array(ctx, argv[0], &length) : NULL;
+    if (!data)
+      return JS_ThrowTypeError(ctx, "write(array[, n]) requires a Float32Array");
+    return JS_NewInt32(ctx, stream->write(data, getStreamCount(ctx, argc, argv, length)));
+  }
+	static JSValue native_stream_read(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    Stream* stream = getThisStream(ctx, this_val);
+    if (!stream)
+      return JS_ThrowTypeError(ctx, "not a Player");
+    size_t length;
+    float* data = (argc >= 1) ? getFloat32Array(ctx, argv[0], &length) : NULL;
+    if (!data)
+      return JS_ThrowTypeError(ctx, "read(array[, n]) requires a Float32Array");
+    return JS_NewInt32(ctx, stream->read(data, getStreamCount(ctx, argc, argv, length)));
+  }
+	static JSValue native_stream_ended(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    Stream* stream = getThisStream(ctx, this_val);
+    if (!stream)
+      return JS_ThrowTypeError(ctx, "not a Player");
+    return JS_NewBool(ctx, stream->isEnded());
+  }
+  /** Returns an ArrayBuffer over the pooled buffer, or undefined if it could not be allocated. */
+	static JSValue native_buffer_get(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    if (argc < 2)
+      return JS_ThrowTypeError(ctx, "getBuffer(name, size) requires a name and size");
+    int32_t size = 0;
+    if (JS_ToInt32(ctx, &size, argv[1]))
+      return JS_EXCEPTION;
+    const char* name = JS_ToCString(ctx, argv[0]);
+    if (!name)
+      return JS_EXCEPTION;
+    std::shared_ptr<PooledBuffer> buffer = getQuickJSEngine(ctx)->getBuffer(name, size);
+    JS_FreeCString(ctx, name);
+    if (!buffer)
+      return JS_UNDEFINED;
+    // The engine keeps the buffer alive, so the ArrayBuffer does not need a free function
+    return JS_NewArrayBuffer(ctx, (uint8_t *) buffer->data, sizeof(float) * buffer->size, NULL, NULL, true);
+  }
+	static JSValue native_workers_create(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    if (argc < 2)
+      return JS_ThrowTypeError(ctx, "path required");
+    int32_t count = 1;
+    if (JS_ToInt32(ctx, &count, argv[1]))
+      return JS_EXCEPTION;
+    const char* path = JS_ToCString(ctx, argv[0]);
+    if (!path)
+      return JS_EXCEPTION;
+    int id = getQuickJSEngine(ctx)->addWorkers(path, count);
+    JS_FreeCString(ctx, path);
+    return JS_NewInt32(ctx, id);
+  }
+  static int32_t getThisWorkers(JSContext* ctx, JSValueConst workersObj) {
+    JSValue idVal = JS_GetPropertyStr(ctx, workersObj, "id");
+    int32_t id = -1;
+    JS_ToInt32(ctx, &id, idVal);
+    JS_FreeValue(ctx, idVal);
+    return id;
+  }
+	static JSValue native_workers_fork(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    int started = getQuickJSEngine(ctx)->forkWorkers(getThisWorkers(ctx, this_val));
+    if (started < 0)
+      return JS_ThrowTypeError(ctx, "not a Workers");
+    return JS_NewInt32(ctx, started);
+  }
+	static JSValue native_workers_join(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    double timeout = -1.0;
+    if (argc >= 1 && !JS_IsUndefined(argv[0]) && JS_ToFloat64(ctx, &timeout, argv[0]))
+      return JS_EXCEPTION;
+    int joined = getQuickJSEngine(ctx)->joinWorkers(getThisWorkers(ctx, this_val), timeout);
+    if (joined < 0)
+      return JS_ThrowTypeError(ctx, "not a Workers");
+    return JS_NewInt32(ctx, joined);
+  }
+	static JSValue native_bus_open(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    if (argc < 4)
+      return JS_ThrowTypeError(ctx, "name required");
+    int32_t channels = 1;
+    int32_t delay = 0;
+    if (JS_ToInt32(ctx, &channels, argv[1]) || JS_ToInt32(ctx, &delay, argv[3]))
+      return JS_EXCEPTION;
+    const char* name = JS_ToCString(ctx, argv[0]);
+    if (!name)
+      return JS_EXCEPTION;
+    int id = getQuickJSEngine(ctx)->addBus(name, channels, JS_ToBool(ctx, argv[2]), delay);
+    JS_FreeCString(ctx, name);
+    return JS_NewInt32(ctx, id);
+  }
+  /** Returns an ArrayBuffer over every slot of the bus. */
+	static JSValue native_bus_data(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    int32_t id = -1;
+    if (argc >= 1)
+      JS_ToInt32(ctx, &id, argv[0]);
+    BusPort* port = getQuickJSEngine(ctx)->getBus(id);
+    if (!port)
+      return JS_ThrowTypeError(ctx, "invalid bus");
+    // The engine keeps the bus alive, so the ArrayBuffer does not need a free function
+    return JS_NewArrayBuffer(ctx, (uint8_t *) port->bus->memory.data, sizeof(float) * port->bus->memory.size, NULL, NULL, true);
+  }
+	static JSValue native_bus_offset(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    JSValue idVal = JS_GetPropertyStr(ctx, this_val, "id");
+    int32_t id = -1;
+    JS_ToInt32(ctx, &id, idVal);
+    JS_FreeValue(ctx, idVal);
+    BusPort* port = getQuickJSEngine(ctx)->getBus(id);
+    if (!port)
+      return JS_ThrowTypeError(ctx, "not a Bus");
+    int32_t channel = 0;
+    if (argc >= 1 && JS_ToInt32(ctx, &channel, argv[0]))
+      return JS_EXCEPTION;
+    int offset = port->getOffset(channel);
+    if (offset < 0)
+      return JS_ThrowRangeError(ctx, "invalid bus channel");
+    return JS_NewInt32(ctx, offset);
+  }
+	static JSValue native_stream_close(JSContext* ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv) {
+    Stream* stream = getThisStream(ctx, this_val);
+    if (stream)
+      stream->close();
+    return JS_UNDEFINED;
+  }
+
 	static JSValue native_display(JSContext* ctx, JSValueConst this_val,
                                     int argc, JSValueConst *argv) {
     if (argc) {
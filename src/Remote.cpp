@@ -0,0 +1,346 @@
+#include "Remote.hpp"
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <climits>
+#if !defined ARCH_WIN
+	#include <csignal>
+	#include <fcntl.h>
+	#include <spawn.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/wait.h>
+#endif
+#if defined ARCH_LIN
+	#include <linux/futex.h>
+	#include <sys/syscall.h>
+#endif
+
+
+using namespace rack;
+
+
+#if !defined ARCH_WIN
+extern char** environ;
+#endif
+extern Plugin* pluginInstance;
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain 32-bit integers");
+
+
+void RemoteShared::setMessage(const std::string& message) {
+	std::snprintf(this->message, sizeof(this->message), "%s", message.c_str());
+	messageSerial++;
+}
+
+void RemoteShared::addConfig(const std::string& name, double value, int index) {
+	if (configCount >= MAX_REMOTE_CONFIG)
+		return;
+	RemoteConfig& c = config[configCount++];
+	std::snprintf(c.name, sizeof(c.name), "%s", name.c_str());
+	c.value = value;
+	c.index = index;
+}
+
+
+void futexWait(std::atomic<uint32_t>& word, uint32_t current, double timeout) {
+#if defined ARCH_LIN
+	struct timespec ts;
+	ts.tv_sec = (time_t) timeout;
+	ts.tv_nsec = (long) ((timeout - ts.tv_sec) * 1e9);
+	// Not FUTEX_PRIVATE_FLAG, since the word is shared between processes
+	syscall(SYS_futex, (uint32_t*) &word, FUTEX_WAIT, current, &ts, NULL, 0);
+#else
+	// Mac has no public futex, so poll
+	(void) word;
+	(void) current;
+	std::this_thread::sleep_for(std::chrono::duration<double>(std::min(timeout, 50e-6)));
+#endif
+}
+
+void futexWake(std::atomic<uint32_t>& word) {
+#if defined ARCH_LIN
+	syscall(SYS_futex, (uint32_t*) &word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+	(void) word;
+#endif
+}
+
+/** Waits until `word` equals `value`. Returns false if `timeout` seconds pass first. */
+static bool waitFor(std::atomic<uint32_t>& word, uint32_t value, double timeout) {
+	// Most blocks finish within a few microseconds of the deadline, so spin briefly before sleeping
+	for (int i = 0; i < 1000; i++) {
+		if (word.load(std::memory_order_acquire) == value)
+			return true;
+	}
+	auto start = std::chrono::steady_clock::now();
+	while (true) {
+		uint32_t current = word.load(std::memory_order_acquire);
+		if (current == value)
+			return true;
+		double remaining = timeout - std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (remaining <= 0.0)
+			return false;
+		futexWait(word, current, remaining);
+	}
+}
+
+
+void copyBlockInputs(ProcessBlock* dst, const ProcessBlock* src) {
+	int n = src->bufferSize;
+	dst->sampleRate = src->sampleRate;
+	dst->sampleTime = src->sampleTime;
+	dst->bufferSize = n;
+	dst->frame = src->frame;
+	for (int i = 0; i < NUM_ROWS; i++) {
+		std::memcpy(dst->inputs[i], src->inputs[i], sizeof(float) * n);
+		std::memcpy(dst->knobBuffers[i], src->knobBuffers[i], sizeof(float) * n);
+		std::memcpy(dst->switchBuffers[i], src->switchBuffers[i], sizeof(bool) * n);
+		dst->knobs[i] = src->knobs[i];
+		dst->switches[i] = src->switches[i];
+		dst->rowBufferSizes[i] = src->rowBufferSizes[i];
+		int count = clamp(src->inputEventCounts[i], 0, MAX_BUFFER_SIZE);
+		dst->inputEventCounts[i] = count;
+		std::memcpy(dst->inputEventOffsets[i], src->inputEventOffsets[i], sizeof(int) * count);
+		std::memcpy(dst->inputEventTypes[i], src->inputEventTypes[i], sizeof(uint8_t) * count);
+	}
+}
+
+void copyBlockResults(ProcessBlock* dst, const ProcessBlock* src) {
+	int n = src->bufferSize;
+	for (int i = 0; i < NUM_ROWS; i++) {
+		std::memcpy(dst->outputs[i], src->outputs[i], sizeof(float) * n);
+		std::memcpy(dst->lights[i], src->lights[i], sizeof(src->lights[i]));
+		std::memcpy(dst->switchLights[i], src->switchLights[i], sizeof(src->switchLights[i]));
+		int count = clamp(src->outputEventCounts[i], 0, MAX_BUFFER_SIZE);
+		dst->outputEventCounts[i] = count;
+		std::memcpy(dst->outputEventOffsets[i], src->outputEventOffsets[i], sizeof(int) * count);
+		std::memcpy(dst->outputEventTypes[i], src->outputEventTypes[i], sizeof(uint8_t) * count);
+	}
+}
+
+
+/* The remote engine runs a script in a helper process started from the plugin's prototype-helper executable, so the script's interpreter state and crashes are isolated from Rack and from other modules.
+ *
+ * run() only starts the helper, and the module outputs silence until the helper has run the script.
+ * The script's config is then applied to the module on the audio thread.
+ * Each block's inputs are sent through shared memory at the end of one process() call and the results are collected at the next, so the helper runs in parallel with the rest of Rack's engine.
+ * If the helper misses the deadline of half a block, the module keeps its previous outputs and drops that block's inputs.
+ */
+
+struct RemoteEngine : ScriptEngine {
+	std::string extension;
+	RemoteShared* shared = NULL;
+	size_t sharedSize = 0;
+	/** Name of the shared memory object, unlinked by the helper once it has mapped it */
+	std::string sharedName;
+#if !defined ARCH_WIN
+	pid_t pid = -1;
+#endif
+	/** Set once the helper has run the script, after which the UI thread may read its engine name */
+	std::atomic<bool> started{false};
+	/** Whether a block has been sent and not yet collected */
+	bool busy = false;
+	bool pendingControl = false;
+	/** Knobs of the block being processed, to apply only the knobs changed by the script */
+	float sentKnobs[NUM_ROWS] = {};
+	uint32_t messageSerial = 0;
+	/** Number of blocks the helper could not process in time, read by the UI thread */
+	int lateBlocks = 0;
+
+	~RemoteEngine() {
+#if !defined ARCH_WIN
+		if (pid > 0) {
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+		}
+		if (shared) {
+			shared->~RemoteShared();
+			munmap(shared, sharedSize);
+		}
+		// In case the helper exited before mapping it
+		if (!sharedName.empty())
+			shm_unlink(sharedName.c_str());
+#endif
+	}
+
+	std::string getEngineName() override {
+		return "Helper";
+	}
+
+	int run(const std::string& path, const std::string& script) override {
+#if defined ARCH_WIN
+		display("Helper processes are not available on Windows");
+		return -1;
+#else
+		// The name must be unique across Rack instances, and at most 31 characters on Mac
+		static std::atomic<int> nextId{0};
+		sharedName = string::f("/vcvproto-%d-%d", (int) getpid(), nextId++);
+		int fd = shm_open(sharedName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0) {
+			sharedName = "";
+			display("Could not create memory for the helper process");
+			return -1;
+		}
+		sharedSize = sizeof(RemoteShared) + script.size();
+		void* memory = MAP_FAILED;
+		if (ftruncate(fd, sharedSize) == 0)
+			memory = mmap(NULL, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (memory == MAP_FAILED) {
+			display("Could not map memory for the helper process");
+			return -1;
+		}
+		shared = new (memory) RemoteShared;
+		shared->request = 1;
+		shared->sampleRate = getSampleRate();
+		shared->scriptSize = script.size();
+		std::memcpy(shared->getScript(), script.data(), script.size());
+
+		// Both directories end with a slash
+		std::string helperPath = asset::plugin(pluginInstance, REMOTE_HELPER_NAME);
+		std::vector<std::string> args = {helperPath, sharedName, asset::plugin(pluginInstance, ""), asset::user(""), extension, path};
+		std::vector<char*> argv;
+		for (std::string& arg : args)
+			argv.push_back((char*) arg.c_str());
+		argv.push_back(NULL);
+
+		// The helper would inherit the signal mask of this thread and the signals ignored by Rack
+		posix_spawnattr_t attr;
+		posix_spawnattr_init(&attr);
+		sigset_t mask;
+		sigemptyset(&mask);
+		posix_spawnattr_setsigmask(&attr, &mask);
+		sigset_t defaults;
+		sigemptyset(&defaults);
+		for (int sig : {SIGINT, SIGTERM, SIGHUP, SIGPIPE, SIGCHLD})
+			sigaddset(&defaults, sig);
+		posix_spawnattr_setsigdefault(&attr, &defaults);
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+		int err = posix_spawn(&pid, helperPath.c_str(), NULL, &attr, argv.data(), environ);
+		posix_spawnattr_destroy(&attr);
+		if (err) {
+			pid = -1;
+			display(string::f("Could not start %s: %s", REMOTE_HELPER_NAME, std::strerror(err)));
+			return -1;
+		}
+		display("Running script in helper process");
+		return 0;
+#endif
+	}
+
+	int process() override {
+		ProcessBlock* block = getProcessBlock();
+		if (!started) {
+			// Output silence until the helper has run the script
+			if (shared->done.load(std::memory_order_acquire) != 1) {
+				if (!isAlive()) {
+					display("Helper process exited while running the script");
+					return -1;
+				}
+				return 0;
+			}
+			started = true;
+			display("");
+			updateMessage();
+			if (shared->result)
+				return shared->result;
+			applyConfig();
+			// The block may have been resized, so send the next one
+			return 0;
+		}
+
+		if (busy) {
+			uint32_t request = shared->request.load(std::memory_order_relaxed);
+			if (!waitFor(shared->done, request, 0.5 * getBlockDuration())) {
+				if (!isAlive()) {
+					display("Helper process exited");
+					return -1;
+				}
+				// Keep the previous outputs and skip this block
+				lateBlocks++;
+				return 0;
+			}
+			busy = false;
+			updateMessage();
+			if (shared->result)
+				return shared->result;
+			copyBlockResults(block, &shared->block);
+			for (int i = 0; i < NUM_ROWS; i++) {
+				if (shared->block.knobs[i] != sentKnobs[i])
+					block->knobs[i] = shared->block.knobs[i];
+			}
+		}
+
+		copyBlockInputs(&shared->block, block);
+		std::memcpy(sentKnobs, block->knobs, sizeof(sentKnobs));
+		shared->control = pendingControl;
+		pendingControl = false;
+		shared->request.fetch_add(1, std::memory_order_release);
+		futexWake(shared->request);
+		busy = true;
+		return 0;
+	}
+
+	int processControl() override {
+		// Sent with the next block
+		pendingControl = true;
+		return 0;
+	}
+
+	int getBlockLatency() override {
+		return 1;
+	}
+
+	std::vector<std::string> getStats() override {
+		std::vector<std::string> stats;
+#if !defined ARCH_WIN
+		if (started)
+			stats.push_back(string::f("Helper process %d (%s): %.3f ms per block, %d late blocks", (int) pid, shared->engineName, shared->processTime * 1e3f, lateBlocks));
+#endif
+		return stats;
+	}
+
+	/** Applies the config set by the script in the helper to the module.
+	Oversampling, spectral mode, and batching are set up by the module when run() returns, so they are not available to scripts in helper processes.
+	*/
+	void applyConfig() {
+		for (int i = 0; i < shared->configCount; i++) {
+			const RemoteConfig& c = shared->config[i];
+			if (!std::strcmp(c.name, "oversample") || !std::strcmp(c.name, "antiAliasing") || !std::strcmp(c.name, "spectral") || !std::strcmp(c.name, "batch"))
+				continue;
+			setConfig(c.name, c.value, c.index);
+		}
+	}
+
+	/** Displays the helper's latest message. Call only while the helper is waiting. */
+	void updateMessage() {
+		if (shared->messageSerial == messageSerial)
+			return;
+		messageSerial = shared->messageSerial;
+		display(shared->message);
+	}
+
+	bool isAlive() {
+#if defined ARCH_WIN
+		return false;
+#else
+		if (pid <= 0)
+			return false;
+		if (waitpid(pid, NULL, WNOHANG) == pid) {
+			pid = -1;
+			return false;
+		}
+		return true;
+#endif
+	}
+};
+
+
+ScriptEngine* createRemoteEngine(const std::string& extension) {
+	if (scriptEngineFactories.find(extension) == scriptEngineFactories.end())
+		return NULL;
+	RemoteEngine* engine = new RemoteEngine;
+	engine->extension = extension;
+	return engine;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "ScriptEngine.hpp"
+#include <atomic>
+
+
+static const int MAX_REMOTE_MESSAGE = 1024;
+static const int MAX_REMOTE_CONFIG = 256;
+
+
+/** A config property set by the script in a helper process, applied to the module once the script has run. */
+struct RemoteConfig {
+	char name[32];
+	double value;
+	int index;
+};
+
+
+/** Memory shared between a module and the helper process that runs its engine.
+The module creates it as a POSIX shared memory object, followed by the script's `scriptSize` bytes, and the helper maps it by name.
+The module sends a block by incrementing `request`, and the helper answers by setting `done` to the same value.
+The helper sets `done` to 1 when the script has run, before the module sends its first block.
+Both are futex words on Linux.
+Everything else is written by one side while the other is waiting, so it needs no locking.
+*/
+struct RemoteShared {
+	std::atomic<uint32_t> request;
+	std::atomic<uint32_t> done;
+	/** Whether the helper calls processControl() before process() for this request */
+	bool control = false;
+	/** Return value of run(), or of the last block */
+	int result = 0;
+	/** Moving average of the helper's processing time per block, in seconds */
+	std::atomic<float> processTime;
+	/** Engine sample rate when the helper was started, until the first block arrives */
+	float sampleRate = 0.f;
+	char engineName[64] = {};
+	/** Last message displayed by the script, changed when `messageSerial` is incremented */
+	char message[MAX_REMOTE_MESSAGE] = {};
+	uint32_t messageSerial = 0;
+	/** Config properties set by the script during run(), in order */
+	RemoteConfig config[MAX_REMOTE_CONFIG];
+	int configCount = 0;
+	/** Inputs sent by the module and results written by the helper, using the first `bufferSize` elements of each row */
+	ProcessBlock block;
+	/** Length of the script following this struct */
+	size_t scriptSize = 0;
+
+	RemoteShared() : request(0), done(0), processTime(0.f) {}
+	void setMessage(const std::string& message);
+	void addConfig(const std::string& name, double value, int index);
+	char* getScript() {
+		return (char*) (this + 1);
+	}
+};
+
+
+/** Name of the helper executable in the plugin directory.
+It is started with the arguments `<shared memory name> <plugin directory> <user directory> <extension> <script path>`, where the directories are those of Rack's asset::plugin() and asset::user().
+*/
+static const char* const REMOTE_HELPER_NAME = "prototype-helper";
+
+
+/** Sleeps until `word` might have changed from `current`, or `timeout` seconds have passed. */
+void futexWait(std::atomic<uint32_t>& word, uint32_t current, double timeout);
+void futexWake(std::atomic<uint32_t>& word);
+/** Copies the parts of `src` that a script reads. */
+void copyBlockInputs(ProcessBlock* dst, const ProcessBlock* src);
+/** Copies the parts of `src` that a script writes, except knobs. */
+void copyBlockResults(ProcessBlock* dst, const ProcessBlock* src);
+
+
+/** Returns an engine that runs the script in a helper process with the engine for `extension`, or NULL if there is no such engine.
+Blocks are exchanged through shared memory and returned at the next block, so it adds one block of latency.
+*/
+ScriptEngine* createRemoteEngine(const std::string& extension);
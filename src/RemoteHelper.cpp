@@ -0,0 +1,394 @@
+#include "ScriptEngine.hpp"
+#include "Kernels.hpp"
+#include "Buffers.hpp"
+#include "Remote.hpp"
+#include <chrono>
+#include <random>
+#include <cstdarg>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined ARCH_LIN
+	#include <sys/prctl.h>
+#endif
+
+
+/* The prototype-helper executable, started by RemoteEngine to run one script in a fresh process.
+ *
+ * It links the script engines without the Prototype module or Rack, so this file defines the parts of both that the engines use.
+ * ScriptEngine records the script's config and messages in the shared memory instead of applying them to a module.
+ * Samples, streams, workers, buses, and scheduled callbacks need the module's threads, so they are refused.
+ */
+
+
+using namespace rack;
+Plugin* pluginInstance = NULL;
+
+
+// Don't bother deleting this with a destructor.
+__attribute((init_priority(999)))
+std::map<std::string, ScriptEngineFactory*> scriptEngineFactories;
+
+ScriptEngine* createScriptEngine(std::string extension) {
+	auto it = scriptEngineFactories.find(extension);
+	if (it == scriptEngineFactories.end())
+		return NULL;
+	return it->second->createScriptEngine();
+}
+
+
+/** Directories passed by the module, each ending with a slash */
+static std::string pluginDir;
+static std::string userDir;
+static RemoteShared* shared = NULL;
+
+
+/** The parts of the module that ScriptEngine uses in the helper */
+struct Prototype {
+	std::string path;
+	ProcessBlock* block = NULL;
+	int frameDivider = 32;
+	BufferPool bufferPool;
+};
+
+
+// Rack functions called by the engines and their support code
+
+namespace rack {
+namespace logger {
+
+void log(Level level, const char* filename, int line, const char* format, ...) {
+	static const char* const levelLabels[] = {"debug", "info", "warn", "fatal"};
+	std::fprintf(stderr, "[%s %s %s:%d] ", REMOTE_HELPER_NAME, levelLabels[level], filename, line);
+	va_list args;
+	va_start(args, format);
+	std::vfprintf(stderr, format, args);
+	va_end(args);
+	std::fprintf(stderr, "\n");
+}
+
+} // namespace logger
+
+namespace string {
+
+std::string f(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	va_list argsCopy;
+	va_copy(argsCopy, args);
+	int size = std::vsnprintf(NULL, 0, format, argsCopy);
+	va_end(argsCopy);
+	std::string s;
+	if (size > 0) {
+		s.resize(size + 1);
+		std::vsnprintf(&s[0], size + 1, format, args);
+		s.resize(size);
+	}
+	va_end(args);
+	return s;
+}
+
+std::string trim(const std::string& s) {
+	const std::string whitespace = " \n\r\t";
+	size_t first = s.find_first_not_of(whitespace);
+	if (first == std::string::npos)
+		return "";
+	size_t last = s.find_last_not_of(whitespace);
+	return s.substr(first, last - first + 1);
+}
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+	return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string directory(const std::string& path) {
+	size_t pos = path.find_last_of('/');
+	if (pos == std::string::npos)
+		return ".";
+	if (pos == 0)
+		return "/";
+	return path.substr(0, pos);
+}
+
+std::string filename(const std::string& path) {
+	size_t pos = path.find_last_of('/');
+	if (pos == std::string::npos)
+		return path;
+	return path.substr(pos + 1);
+}
+
+std::string filenameExtension(const std::string& filename) {
+	size_t pos = filename.find_last_of('.');
+	if (pos == std::string::npos)
+		return "";
+	return filename.substr(pos + 1);
+}
+
+} // namespace string
+
+namespace system {
+
+std::list<std::string> getEntries(const std::string& path) {
+	std::list<std::string> entries;
+	DIR* dir = opendir(path.c_str());
+	if (!dir)
+		return entries;
+	while (struct dirent* d = readdir(dir)) {
+		std::string name = d->d_name;
+		if (name == "." || name == "..")
+			continue;
+		entries.push_back(path + "/" + name);
+	}
+	closedir(dir);
+	return entries;
+}
+
+void createDirectory(const std::string& path) {
+	mkdir(path.c_str(), 0755);
+}
+
+void setThreadName(const std::string& name) {
+#if defined ARCH_LIN
+	// Linux limits thread names to 15 characters
+	pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#elif defined ARCH_MAC
+	pthread_setname_np(name.c_str());
+#endif
+}
+
+} // namespace system
+
+namespace asset {
+
+std::string plugin(plugin::Plugin* plugin, const std::string& filename) {
+	return pluginDir + filename;
+}
+
+std::string user(const std::string& filename) {
+	return userDir + filename;
+}
+
+} // namespace asset
+
+namespace random {
+
+uint32_t u32() {
+	static thread_local std::mt19937 generator(std::random_device{}());
+	return generator();
+}
+
+} // namespace random
+} // namespace rack
+
+
+// ScriptEngine as seen by an engine running in the helper
+
+ScriptEngine::~ScriptEngine() {
+	delete workerBlock;
+	for (Kernel* kernel : kernels)
+		delete kernel;
+}
+void ScriptEngine::display(const std::string& message) {
+	shared->setMessage(message);
+}
+void ScriptEngine::setFrameDivider(int frameDivider) {
+	if (parent && !parent->checkBlockConfig(this, "frameDivider", std::max(frameDivider, 1)))
+		return;
+	module->frameDivider = std::max(frameDivider, 1);
+	shared->addConfig("frameDivider", frameDivider, 0);
+}
+void ScriptEngine::setBufferSize(int bufferSize) {
+	if (parent && !parent->checkBlockConfig(this, "bufferSize", clamp(bufferSize, 1, MAX_BUFFER_SIZE)))
+		return;
+	// Engines size their arrays from the block when they run the script
+	module->block->bufferSize = clamp(bufferSize, 1, MAX_BUFFER_SIZE);
+	shared->addConfig("bufferSize", bufferSize, 0);
+}
+void ScriptEngine::setConfig(const std::string& name, double value, int index) {
+	if (!std::isfinite(value))
+		return;
+	if (name == "frameDivider")
+		setFrameDivider((int) value);
+	else if (name == "bufferSize")
+		setBufferSize((int) value);
+	else
+		shared->addConfig(name, value, index);
+}
+ProcessBlock* ScriptEngine::getProcessBlock() {
+	if (workerBlock)
+		return workerBlock;
+	return module->block;
+}
+int ScriptEngine::schedule(int64_t frame, int64_t period) {
+	return -1;
+}
+void ScriptEngine::cancel(int id) {
+}
+double ScriptEngine::getBlockDuration() {
+	return (double) module->block->bufferSize * module->frameDivider / getSampleRate();
+}
+float ScriptEngine::getSampleRate() {
+	float sampleRate = getProcessBlock()->sampleRate;
+	if (sampleRate > 0.f)
+		return sampleRate;
+	return shared->sampleRate;
+}
+int64_t ScriptEngine::getFrame() {
+	return getProcessBlock()->frame;
+}
+int ScriptEngine::addKernel(const std::string& name) {
+	Kernel* kernel = createKernel(name);
+	if (!kernel)
+		return -1;
+	kernels.push_back(kernel);
+	return kernels.size() - 1;
+}
+Kernel* ScriptEngine::getKernel(int id) {
+	if (id < 0 || id >= (int) kernels.size())
+		return NULL;
+	return kernels[id];
+}
+std::string ScriptEngine::resolvePath(const std::string& path) {
+	bool absolute = (path.size() >= 1 && path[0] == '/');
+	if (absolute || module->path == "")
+		return path;
+	return string::directory(module->path) + "/" + path;
+}
+int ScriptEngine::addSample(const std::string& path) {
+	display("Helper processes cannot load samples");
+	return -1;
+}
+Sample* ScriptEngine::getSample(int id) {
+	return NULL;
+}
+int ScriptEngine::addStream(const std::string& path, bool recording, int channels, float sampleRate, bool loop) {
+	display("Helper processes cannot open streams");
+	return -1;
+}
+Stream* ScriptEngine::getStream(int id) {
+	return NULL;
+}
+std::shared_ptr<PooledBuffer> ScriptEngine::getBuffer(const std::string& name, int size) {
+	if (size <= 0)
+		return NULL;
+	std::shared_ptr<PooledBuffer> buffer = module->bufferPool.get(name, size);
+	if (buffer && std::find(buffers.begin(), buffers.end(), buffer) == buffers.end())
+		buffers.push_back(buffer);
+	return buffer;
+}
+int ScriptEngine::addBus(const std::string& name, int channels, bool publishing, int delay) {
+	display("Helper processes cannot use buses");
+	return -1;
+}
+BusPort* ScriptEngine::getBus(int id) {
+	return NULL;
+}
+void ScriptEngine::startBuses() {
+}
+void ScriptEngine::publishBuses() {
+}
+int ScriptEngine::addWorkers(const std::string& path, int count) {
+	display("Helper processes cannot create workers");
+	return -1;
+}
+int ScriptEngine::forkWorkers(int id) {
+	return -1;
+}
+int ScriptEngine::joinWorkers(int id, double timeout) {
+	return -1;
+}
+void ScriptEngine::showWorkerMessages(WorkerGroup* group) {
+}
+
+
+/** Sets `done` to `request` and wakes the module. */
+static void answer(uint32_t request) {
+	shared->done.store(request, std::memory_order_release);
+	futexWake(shared->done);
+}
+
+
+int main(int argc, char* argv[]) {
+	if (argc != 6) {
+		std::fprintf(stderr, "%s is started by the VCV Prototype module\n", REMOTE_HELPER_NAME);
+		return 1;
+	}
+#if defined ARCH_LIN
+	// Exit with Rack. Elsewhere the helper polls for its parent below.
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+	pid_t parent = getppid();
+	const char* sharedName = argv[1];
+	pluginDir = argv[2];
+	userDir = argv[3];
+	std::string extension = argv[4];
+	std::string path = argv[5];
+
+	int fd = shm_open(sharedName, O_RDWR, 0);
+	if (fd < 0)
+		return 1;
+	struct stat st;
+	void* memory = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(RemoteShared))
+		memory = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	// The module keeps its own mapping, so the name is no longer needed
+	shm_unlink(sharedName);
+	if (memory == MAP_FAILED)
+		return 1;
+	shared = (RemoteShared*) memory;
+
+	Prototype module;
+	module.path = path;
+	module.block = new ProcessBlock;
+	ScriptEngine* engine = createScriptEngine(extension);
+	if (!engine) {
+		shared->setMessage(string::f("No engine for .%s extension", extension.c_str()));
+		shared->result = -1;
+		answer(1);
+		return 0;
+	}
+	engine->module = &module;
+	std::string script(shared->getScript(), shared->scriptSize);
+	shared->result = engine->run(path, script);
+	std::snprintf(shared->engineName, sizeof(shared->engineName), "%s", engine->getEngineName().c_str());
+	// The module sets `request` to 1 before starting the helper
+	uint32_t request = 1;
+	answer(request);
+	// The module discards the helper's state, so skip the engine's teardown
+	if (shared->result)
+		_exit(0);
+
+	ProcessBlock* block = engine->getProcessBlock();
+	while (true) {
+		while (shared->request.load(std::memory_order_acquire) == request) {
+			futexWait(shared->request, request, 1.0);
+			// Linux kills the helper with its parent, elsewhere it is reparented
+			if (getppid() != parent)
+				_exit(0);
+		}
+		request = shared->request.load(std::memory_order_acquire);
+
+		copyBlockInputs(block, &shared->block);
+		auto start = std::chrono::steady_clock::now();
+		int err = 0;
+		if (shared->control)
+			err = engine->processControl();
+		if (!err)
+			err = engine->process();
+		float time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+		shared->processTime = shared->processTime + (time - shared->processTime) * 0.01f;
+		copyBlockResults(&shared->block, block);
+		std::memcpy(shared->block.knobs, block->knobs, sizeof(block->knobs));
+
+		shared->result = err;
+		answer(request);
+		if (err)
+			_exit(0);
+	}
+}
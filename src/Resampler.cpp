@@ -0,0 +1,63 @@
+#include "Resampler.hpp"
+
+
+using namespace rack;
+
+
+/** Windowed-sinc lowpass with `length` coefficients and a cutoff just below the Nyquist frequency of the low rate, normalized to a DC gain of `gain` */
+static std::vector<float> designLowpass(int factor, int length, float gain) {
+	std::vector<float> h(length);
+	// Cycles per high-rate sample
+	float cutoff = 0.45f / factor;
+	std::vector<float> window(length);
+	dsp::blackmanHarrisWindow(window.data(), length);
+	float sum = 0.f;
+	for (int n = 0; n < length; n++) {
+		float t = n - (length - 1) / 2.f;
+		h[n] = 2.f * cutoff * dsp::sinc(2.f * cutoff * t) * window[n];
+		sum += h[n];
+	}
+	for (int n = 0; n < length; n++)
+		h[n] *= gain / sum;
+	return h;
+}
+
+
+Upsampler::Upsampler(int factor) {
+	this->factor = factor;
+	int length = factor * RESAMPLER_TAPS;
+	// Zero-stuffing divides the gain by the factor
+	std::vector<float> h = designLowpass(factor, length, factor);
+	// y[n * factor + p] = sum_k h[k * factor + p] x[n - k]
+	kernel.resize(length);
+	for (int p = 0; p < factor; p++)
+		for (int k = 0; k < RESAMPLER_TAPS; k++)
+			kernel[p * RESAMPLER_TAPS + (RESAMPLER_TAPS - 1 - k)] = h[k * factor + p];
+}
+
+void Upsampler::push(const float* in) {
+	for (int i = 0; i < NUM_ROWS; i++) {
+		history[i][index] = in[i];
+		history[i][index + RESAMPLER_TAPS] = in[i];
+	}
+	if (++index >= RESAMPLER_TAPS)
+		index = 0;
+}
+
+
+Downsampler::Downsampler(int factor) {
+	this->factor = factor;
+	length = factor * RESAMPLER_TAPS;
+	std::vector<float> h = designLowpass(factor, length, 1.f);
+	kernel.assign(h.rbegin(), h.rend());
+	history.resize(NUM_ROWS * 2 * length);
+}
+
+void Downsampler::push(const float* in) {
+	for (int i = 0; i < NUM_ROWS; i++) {
+		history[i * 2 * length + index] = in[i];
+		history[i * 2 * length + index + length] = in[i];
+	}
+	if (++index >= length)
+		index = 0;
+}
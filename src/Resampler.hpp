@@ -0,0 +1,57 @@
+#pragma once
+#include "ScriptEngine.hpp"
+
+
+/** Number of coefficients of each polyphase component.
+The filters are `factor * RESAMPLER_TAPS` long, so their cost per high-rate sample does not depend on the factor.
+*/
+static const int RESAMPLER_TAPS = 16;
+static const int MAX_OVERSAMPLE = 16;
+
+
+/** Interpolates every row to `factor` times its sample rate with a polyphase windowed-sinc FIR filter. */
+struct Upsampler {
+	int factor;
+	/** Polyphase components, each reversed to match the history order. Phase `p` starts at `p * RESAMPLER_TAPS`. */
+	std::vector<float> kernel;
+	/** Last RESAMPLER_TAPS low-rate samples of each row, written twice so every window is contiguous */
+	float history[NUM_ROWS][2 * RESAMPLER_TAPS] = {};
+	int index = 0;
+
+	Upsampler(int factor);
+	/** Pushes one low-rate sample of each row. */
+	void push(const float* in);
+	/** Returns high-rate sample `phase` of a row since the last push(), from 0 to factor - 1. */
+	float output(int row, int phase) {
+		const float* x = &history[row][index];
+		const float* h = &kernel[phase * RESAMPLER_TAPS];
+		float y = 0.f;
+		for (int k = 0; k < RESAMPLER_TAPS; k++)
+			y += h[k] * x[k];
+		return y;
+	}
+};
+
+
+/** Lowpass filters every row below the Nyquist frequency of `1 / factor` its sample rate, so it can be decimated without aliasing. */
+struct Downsampler {
+	int factor;
+	int length;
+	/** Reversed to match the history order */
+	std::vector<float> kernel;
+	/** Last `length` high-rate samples of each row, written twice so every window is contiguous */
+	std::vector<float> history;
+	int index = 0;
+
+	Downsampler(int factor);
+	/** Pushes one high-rate sample of each row. */
+	void push(const float* in);
+	/** Returns the filtered sample of a row at the last push(). */
+	float output(int row) {
+		const float* x = &history[row * 2 * length + index];
+		float y = 0.f;
+		for (int k = 0; k < length; k++)
+			y += kernel[k] * x[k];
+		return y;
+	}
+};
@@ -0,0 +1,271 @@
+#include "Samples.hpp"
+#include "Wav.hpp"
+#include "Cache.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <sys/stat.h>
+#if !defined ARCH_WIN
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+
+using namespace rack;
+
+
+/** Header of cache files, followed by planar float32 samples. 32 bytes keep the samples aligned for SIMD. */
+struct SampleCacheHeader {
+	char magic[4];
+	int32_t version;
+	int32_t channels;
+	int32_t frames;
+	float sampleRate;
+	int32_t reserved[3];
+};
+
+static const char SAMPLE_CACHE_MAGIC[4] = {'P', 'R', 'S', 'C'};
+static const int SAMPLE_CACHE_VERSION = 1;
+
+
+Sample::~Sample() {
+#if !defined ARCH_WIN
+	if (map)
+		munmap(map, mapSize);
+#endif
+}
+
+
+/** 64-bit FNV-1a */
+static uint64_t hashString(const std::string& s) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (unsigned char c : s) {
+		hash ^= c;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+/** Maps a cache file and points the sample at it. Returns false if the file is missing or invalid. */
+static bool mapCacheFile(const std::string& cachePath, Sample* sample) {
+#if defined ARCH_WIN
+	FILE* file = std::fopen(cachePath.c_str(), "rb");
+	if (!file)
+		return false;
+	DEFER({
+		std::fclose(file);
+	});
+	SampleCacheHeader header;
+	if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, SAMPLE_CACHE_MAGIC, 4) || header.version != SAMPLE_CACHE_VERSION)
+		return false;
+	std::vector<float> memory((size_t) header.channels * header.frames);
+	if (std::fread(memory.data(), sizeof(float), memory.size(), file) != memory.size())
+		return false;
+	sample->memory.swap(memory);
+	sample->data = sample->memory.data();
+	sample->channels = header.channels;
+	sample->frames = header.frames;
+	sample->sampleRate = header.sampleRate;
+#else
+	int fd = open(cachePath.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	DEFER({
+		close(fd);
+	});
+	struct stat st;
+	if (fstat(fd, &st) || (size_t) st.st_size < sizeof(SampleCacheHeader))
+		return false;
+	// Private and copy-on-write, so pages are shared with other processes until written, and a script that writes to a channel cannot change the cache file or crash Rack
+	void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return false;
+	const SampleCacheHeader* header = (const SampleCacheHeader*) map;
+	size_t size = sizeof(SampleCacheHeader) + sizeof(float) * (size_t) header->channels * header->frames;
+	if (std::memcmp(header->magic, SAMPLE_CACHE_MAGIC, 4) || header->version != SAMPLE_CACHE_VERSION || size != (size_t) st.st_size) {
+		munmap(map, st.st_size);
+		return false;
+	}
+	sample->map = map;
+	sample->mapSize = st.st_size;
+	sample->data = (float*) ((char*) map + sizeof(SampleCacheHeader));
+	sample->channels = header->channels;
+	sample->frames = header->frames;
+	sample->sampleRate = header->sampleRate;
+#endif
+	return true;
+}
+
+
+/** Writes decoded audio to a cache file. */
+static bool writeCacheFile(const AudioData& audio, const std::string& cachePath) {
+	SampleCacheHeader header = {};
+	std::memcpy(header.magic, SAMPLE_CACHE_MAGIC, 4);
+	header.version = SAMPLE_CACHE_VERSION;
+	header.channels = audio.channels;
+	header.frames = audio.frames;
+	header.sampleRate = audio.sampleRate;
+
+	// Write to a temporary file and rename it, so other processes never map a partial file
+	std::string tempPath = cachePath + ".tmp";
+	FILE* file = std::fopen(tempPath.c_str(), "wb");
+	if (!file) {
+		WARN("Could not write sample cache %s", tempPath.c_str());
+		return false;
+	}
+	bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && std::fwrite(audio.samples.data(), sizeof(float), audio.samples.size(), file) == audio.samples.size();
+	ok = (std::fclose(file) == 0) && ok;
+	if (!ok) {
+		std::remove(tempPath.c_str());
+		return false;
+	}
+#if defined ARCH_WIN
+	std::remove(cachePath.c_str());
+#endif
+	return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+}
+
+
+struct SampleLoader {
+	std::mutex mutex;
+	std::condition_variable cv;
+	/** Samples by path, size, and modification time */
+	std::map<std::string, std::weak_ptr<Sample>> samples;
+	/** A sample to load with its key, or a task to run */
+	struct Job {
+		std::shared_ptr<Sample> sample;
+		std::string key;
+		std::function<void()> task;
+	};
+	std::deque<Job> queue;
+	std::thread thread;
+	bool running = true;
+	std::string cacheDir;
+
+	SampleLoader() {
+		cacheDir = getCacheDir();
+		thread = std::thread([this]() {
+			system::setThreadName("Prototype Sample Loader");
+			run();
+		});
+	}
+
+	~SampleLoader() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		cv.notify_one();
+		thread.join();
+	}
+
+	std::shared_ptr<Sample> load(const std::string& path) {
+		struct stat st;
+		if (stat(path.c_str(), &st)) {
+			WARN("Could not find sample %s", path.c_str());
+			std::shared_ptr<Sample> sample = std::make_shared<Sample>();
+			sample->path = path;
+			sample->failed = true;
+			return sample;
+		}
+		std::string key = string::f("%s:%lld:%lld", path.c_str(), (long long) st.st_size, (long long) st.st_mtime);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		std::weak_ptr<Sample>& entry = samples[key];
+		std::shared_ptr<Sample> sample = entry.lock();
+		if (sample)
+			return sample;
+
+		// Forget entries whose samples were freed
+		for (auto it = samples.begin(); it != samples.end();) {
+			if (it->second.expired() && &it->second != &entry)
+				it = samples.erase(it);
+			else
+				it++;
+		}
+
+		sample = std::make_shared<Sample>();
+		sample->path = path;
+		entry = sample;
+		Job job;
+		job.sample = sample;
+		job.key = key;
+		queue.push_back(job);
+		cv.notify_one();
+		return sample;
+	}
+
+	void addTask(std::function<void()> task) {
+		std::lock_guard<std::mutex> lock(mutex);
+		Job job;
+		job.task = task;
+		queue.push_back(job);
+		cv.notify_one();
+	}
+
+	void run() {
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&]() {return !running || !queue.empty();});
+				if (!running)
+					return;
+				job = std::move(queue.front());
+				queue.pop_front();
+			}
+			if (job.task) {
+				job.task();
+				continue;
+			}
+			std::shared_ptr<Sample> sample = std::move(job.sample);
+			const std::string& key = job.key;
+			// The last module using it may have been removed before it was loaded
+			if (sample.use_count() <= 1)
+				continue;
+
+			std::string cachePath = string::f("%s/%016llx.f32", cacheDir.c_str(), (unsigned long long) hashString(key));
+			if (mapCacheFile(cachePath, sample.get())) {
+				touchCacheFile(cachePath);
+			}
+			else {
+				AudioData audio;
+				if (!loadWav(sample->path, &audio)) {
+					sample->failed = true;
+					continue;
+				}
+				system::createDirectory(cacheDir);
+				if (!writeCacheFile(audio, cachePath) || !mapCacheFile(cachePath, sample.get())) {
+					// Keep the decoded samples in memory if the cache cannot be written
+					sample->channels = audio.channels;
+					sample->frames = audio.frames;
+					sample->sampleRate = audio.sampleRate;
+					sample->memory.swap(audio.samples);
+					sample->data = sample->memory.data();
+				}
+				trimCache();
+			}
+			sample->loaded.store(true, std::memory_order_release);
+		}
+	}
+};
+
+
+static SampleLoader& getSampleLoader() {
+	static SampleLoader loader;
+	return loader;
+}
+
+
+std::shared_ptr<Sample> loadSample(const std::string& path) {
+	return getSampleLoader().load(path);
+}
+
+
+void runAfterSamples(std::function<void()> task) {
+	getSampleLoader().addTask(task);
+}
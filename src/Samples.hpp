@@ -0,0 +1,45 @@
+#pragma once
+#include <rack.hpp>
+
+
+/** An audio file decoded by the background loader and shared by every module that loads it.
+Decoded samples are written to a planar float32 cache file in the user folder and memory-mapped copy-on-write, so the same file is decoded once and its pages are shared between modules until one is written.
+*/
+struct Sample {
+	std::string path;
+	int channels = 0;
+	int frames = 0;
+	float sampleRate = 0.f;
+	/** `channels * frames` samples. Channel `c` starts at `c * frames`.
+	Shared with the other modules using the sample, so engines expose it to scripts without copying and scripts should not write to it.
+	Writes are visible to those modules but never reach the cache file.
+	*/
+	const float* data = NULL;
+
+	std::atomic<bool> loaded{false};
+	std::atomic<bool> failed{false};
+	void* map = NULL;
+	size_t mapSize = 0;
+	/** Holds the samples where memory mapping is unavailable */
+	std::vector<float> memory;
+
+	~Sample();
+	/** Returns true once the fields above can be read from any thread. */
+	bool isLoaded() {
+		return loaded.load(std::memory_order_acquire);
+	}
+	const float* getChannel(int c) {
+		return &data[c * frames];
+	}
+};
+
+
+/** Returns the shared sample of the audio file at `path`, and starts loading it on the loader thread if needed.
+Files are identified by path, size, and modification time, so an edited file is loaded again.
+Only WAV files are supported.
+*/
+std::shared_ptr<Sample> loadSample(const std::string& path);
+/** Runs `task` on the loader thread once the samples requested before it have loaded or failed.
+Use it to prepare data derived from samples without allocating on the audio thread.
+*/
+void runAfterSamples(std::function<void()> task);
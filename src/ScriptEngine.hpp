@@ -4,27 +4,120 @@
 
 static const int NUM_ROWS = 6;
 static const int MAX_BUFFER_SIZE = 4096;
+/** Maximum number of modules processed together with config.batch */
+static const int MAX_BATCH = 32;
 
 
 struct Prototype;
+struct Kernel;
+struct Sample;
+struct Stream;
+struct PooledBuffer;
+struct Worker;
+struct WorkerGroup;
+struct BusPort;
+
+
+/** Smoothing modes of ProcessBlock::knobBuffers. */
+enum KnobSmoothing {
+	KNOB_SMOOTHING_OFF = 0,
+	KNOB_SMOOTHING_LINEAR = 1,
+	KNOB_SMOOTHING_ONE_POLE = 2,
+};
+
+
+/** Types of trigger/gate events in ProcessBlock event lists. */
+enum EventType {
+	EVENT_FALL = 0,
+	EVENT_RISE = 1,
+	/** Output only. Emits a 1ms trigger pulse. */
+	EVENT_TRIGGER = 2,
+};
 
 
 struct ProcessBlock {
 	float sampleRate = 0.f;
 	float sampleTime = 0.f;
 	int bufferSize = 1;
+	/** Sample frame of `inputs[i][0]`, counted since the script was loaded. */
+	int64_t frame = 0;
 	float inputs[NUM_ROWS][MAX_BUFFER_SIZE] = {};
 	float outputs[NUM_ROWS][MAX_BUFFER_SIZE] = {};
 	float knobs[NUM_ROWS] = {};
 	bool switches[NUM_ROWS] = {};
 	float lights[NUM_ROWS][3] = {};
 	float switchLights[NUM_ROWS][3] = {};
+	/** Per-sample knob and switch values, filled only if config.knobSmoothing is enabled. */
+	float knobBuffers[NUM_ROWS][MAX_BUFFER_SIZE] = {};
+	bool switchBuffers[NUM_ROWS][MAX_BUFFER_SIZE] = {};
+	/** Number of samples used in each row of `inputs` and `outputs`, according to config.rowDividers. */
+	int rowBufferSizes[NUM_ROWS] = {};
+	/** Edges detected by the host on each input, in order of sample offset. */
+	int inputEventCounts[NUM_ROWS] = {};
+	int inputEventOffsets[NUM_ROWS][MAX_BUFFER_SIZE] = {};
+	uint8_t inputEventTypes[NUM_ROWS][MAX_BUFFER_SIZE] = {};
+	/** Events written by the script, rendered into `outputs` by the host after process(). */
+	int outputEventCounts[NUM_ROWS] = {};
+	int outputEventOffsets[NUM_ROWS][MAX_BUFFER_SIZE] = {};
+	uint8_t outputEventTypes[NUM_ROWS][MAX_BUFFER_SIZE] = {};
+	/** Number of module instances in the block if config.batch is enabled, otherwise 1.
+	Instance `k` uses elements `k * bufferSize` to `(k + 1) * bufferSize - 1` of each row of `inputs` and `outputs`.
+	Engines size those rows as `bufferSize * batchSize` when the script is run, which the host sets to the batch capacity.
+	*/
+	int batchSize = 1;
+	/** Knobs, switches, and lights of each instance in batch mode, indexed by row and then by instance.
+	Lights are indexed by `k * 3 + color`.
+	*/
+	float batchKnobs[NUM_ROWS][MAX_BATCH] = {};
+	bool batchSwitches[NUM_ROWS][MAX_BATCH] = {};
+	float batchLights[NUM_ROWS][MAX_BATCH * 3] = {};
+	float batchSwitchLights[NUM_ROWS][MAX_BATCH * 3] = {};
+};
+
+
+/** Numeric properties of the script's `config` object.
+Engines should set each property to its default value before running the script, and pass the value back to setConfig() afterwards.
+*/
+struct ConfigKey {
+	const char* name;
+	double defaultValue;
+	/** If nonzero, the property is an array of this length with each element set to `defaultValue`. */
+	int size;
+};
+
+static const ConfigKey CONFIG_KEYS[] = {
+	{"frameDivider", 32, 0},
+	{"bufferSize", 1, 0},
+	// Schmitt trigger thresholds for input events, in volts
+	{"triggerLow", 0.1, 0},
+	{"triggerHigh", 1.0, 0},
+	// 0 = off, 1 = linear ramp across each block, 2 = one-pole lowpass
+	{"knobSmoothing", 0, 0},
+	// Time constant of one-pole knob smoothing, in seconds
+	{"knobSmoothingTime", 0.01, 0},
+	// Call processControl() every this many sample frames, rounded up to whole blocks. 0 disables processControl().
+	{"controlDivider", 0, 0},
+	// Decimation factor of each input/output row within a block
+	{"rowDividers", 1, NUM_ROWS},
+	// Run the script at this multiple of the engine sample rate, with polyphase FIR interpolation of inputs and decimation of outputs. Overrides frameDivider.
+	{"oversample", 1, 0},
+	// 0 = sample and hold with frameDivider, 1 = band-limit inputs and interpolate outputs with polyphase FIR filters
+	{"antiAliasing", 0, 0},
+	// 1 = process all modules running this script with one shared engine, in one call per block. Adds one block of latency.
+	{"batch", 0, 0},
+	// Spectral mode settings. These must come before "spectral", which applies them.
+	{"fftSize", 1024, 0},
+	{"hopSize", 256, 0},
+	// 0 = Hann, 1 = Blackman-Harris, 2 = rectangular
+	{"window", 0, 0},
+	// 0 = off, 1 = complex bins, 2 = magnitude/phase bins
+	{"spectral", 0, 0},
 };
 
 
 struct ScriptEngine {
 	// Virtual methods for subclasses
-	virtual ~ScriptEngine() {}
+	virtual ~ScriptEngine();
 	virtual std::string getEngineName() {return "";}
 	/** Executes the script.
 	Return nonzero if failure, and set error message with setMessage().
@@ -37,14 +130,134 @@ struct ScriptEngine {
 	*/
 	virtual int process() {return 0;}
 
+	/** Calls the script's processControl() method if it defines one.
+	Called before process() every config.controlDivider sample frames.
+	Return nonzero if failure, and set error message with setMessage().
+	*/
+	virtual int processControl() {return 0;}
+
+	/** Calls the callback that the script registered with schedule() under `id`.
+	`offset` is the buffer index at which the callback is due.
+	If `last` is true, the callback will not be called again and can be released.
+	Return nonzero if failure, and set error message with setMessage().
+	*/
+	virtual int processScheduled(int id, int offset, bool last) {return 0;}
+
+	/** Returns lines describing the engine's performance, shown in the module's context menu.
+	Called from the UI thread.
+	*/
+	virtual std::vector<std::string> getStats() {return {};}
+
+	/** Returns the number of blocks by which the engine delays its outputs, such as engines that process on another thread. */
+	virtual int getBlockLatency() {return 0;}
+
 	// Communication with Prototype module.
 	// These cannot be called from your constructor, so initialize your engine in the run() method.
 	void display(const std::string& message);
 	void setFrameDivider(int frameDivider);
 	void setBufferSize(int bufferSize);
+	/** Sets a property from CONFIG_KEYS. Unknown names are ignored.
+	`index` is the element index of array properties.
+	*/
+	void setConfig(const std::string& name, double value, int index = 0);
+	/** Sets a property from CONFIG_KEYS unless `value` is its default.
+	Engines pass the script's config back with it, since the module starts every script with the defaults, and a chain stage that leaves a property untouched must not override the stages before it.
+	*/
+	void setConfigIfChanged(const std::string& name, double value, int index = 0) {
+		for (const ConfigKey& key : CONFIG_KEYS) {
+			if (name == key.name && value == key.defaultValue)
+				return;
+		}
+		setConfig(name, value, index);
+	}
 	ProcessBlock* getProcessBlock();
+	/** Requests processScheduled() at the absolute sample frame `frame`, and every `period` frames afterwards if `period` is positive.
+	Returns the id passed to processScheduled() and cancel().
+	*/
+	int schedule(int64_t frame, int64_t period = 0);
+	/** Stops calling processScheduled() for `id`. */
+	void cancel(int id);
+	/** Returns the time of the running scheduled callback in sample frames, or the start of the current block otherwise. */
+	int64_t getFrame();
+	/** Returns the real-time duration of one of the module's blocks in seconds. */
+	double getBlockDuration();
+	/** Returns the sample rate of the script's blocks, or the engine sample rate before the first block. */
+	float getSampleRate();
+	/** Creates a DSP kernel owned by this engine. See Kernels.hpp.
+	Returns its id, or -1 if the name is unknown.
+	*/
+	int addKernel(const std::string& name);
+	/** Returns the kernel with the given id, or NULL if invalid. */
+	Kernel* getKernel(int id);
+	/** Returns `path` relative to the script's directory unless it is absolute. */
+	std::string resolvePath(const std::string& path);
+	/** Starts loading an audio file in the background, shared with other modules. See Samples.hpp.
+	Returns its id.
+	*/
+	int addSample(const std::string& path);
+	/** Returns the sample with the given id if it has finished loading, or NULL. */
+	Sample* getSample(int id);
+	/** Opens a file for recording or playback on the stream I/O thread. See Streams.hpp.
+	A `sampleRate` of 0 uses the engine sample rate.
+	Returns its id.
+	*/
+	int addStream(const std::string& path, bool recording, int channels, float sampleRate, bool loop);
+	/** Returns the stream with the given id, or NULL if invalid. */
+	Stream* getStream(int id);
+	/** Returns the module's pooled buffer named `name` with `size` floats. See Buffers.hpp.
+	Its contents are kept if the script is reloaded and requests the same name and size.
+	Returns NULL if `size` is invalid or the module's buffers would exceed their size limit.
+	*/
+	std::shared_ptr<PooledBuffer> getBuffer(const std::string& name, int size);
+	/** Creates `count` contexts of this engine running the script at `path` on the worker thread pool. See Workers.hpp.
+	Workers cannot create workers.
+	Returns the group's id, or -1 on failure with the error message set.
+	*/
+	int addWorkers(const std::string& path, int count);
+	/** Starts a worker group on the current block. Returns the number of workers started, or -1 if the id is invalid. */
+	int forkWorkers(int id);
+	/** Waits for a worker group and adds its outputs to the current block.
+	A negative `timeout` waits up to half the duration of a block.
+	Returns the number of workers whose outputs were added, or -1 if the id is invalid.
+	*/
+	int joinWorkers(int id, double timeout = -1.0);
+	/** Connects to the shared bus named `name` as its publisher or as a subscriber. See Buses.hpp.
+	The bus's blocks have the module's current buffer size.
+	Subscribers read the block published `delay` blocks before the latest one.
+	Returns its id, or -1 on failure with the error message set.
+	*/
+	int addBus(const std::string& name, int channels, bool publishing, int delay);
+	/** Returns the bus port with the given id, or NULL if invalid. */
+	BusPort* getBus(int id);
+	/** Selects the bus slots used by the block about to be processed.
+	Engines that run other engines override it to start their buses too.
+	*/
+	virtual void startBuses();
+	/** Publishes the blocks written to this engine's buses. */
+	virtual void publishBuses();
+	/** Called when `engine`, run by this engine as a stage, sets "frameDivider" or "bufferSize" to `value`.
+	Return false to reject the setting.
+	*/
+	virtual bool checkBlockConfig(ScriptEngine* engine, const std::string& name, int value) {return true;}
 	// private
 	Prototype* module = NULL;
+	std::vector<Kernel*> kernels;
+	std::vector<std::shared_ptr<Sample>> samples;
+	std::vector<std::shared_ptr<Stream>> streams;
+	/** Keeps every buffer returned by getBuffer() alive while the script can access it */
+	std::vector<std::shared_ptr<PooledBuffer>> buffers;
+	std::vector<WorkerGroup*> workerGroups;
+	std::vector<BusPort*> busPorts;
+	/** Set on worker and batch engines, which use their own block and cannot change the module's config or scheduler */
+	ProcessBlock* workerBlock = NULL;
+	/** Index of a worker engine in its group, or -1 for the main engine */
+	int workerIndex = -1;
+	/** Set on worker engines once their script has run, so display() from the pool is shown by the main engine's thread */
+	Worker* worker = NULL;
+	/** Displays the last message of the group's workers on the thread running this engine */
+	void showWorkerMessages(WorkerGroup* group);
+	/** The engine running this one as a stage, or NULL */
+	ScriptEngine* parent = NULL;
 };
 
 
@@ -0,0 +1,92 @@
+#include "Spectral.hpp"
+
+
+using namespace rack;
+
+
+Spectral::Spectral(int size, int hop, int windowType, int format) {
+	this->size = size;
+	this->hop = hop;
+	this->format = format;
+	fft = new dsp::RealFFT(size);
+
+	std::fill(window, window + size, 1.f);
+	if (windowType == SPECTRAL_WINDOW_HANN)
+		dsp::hannWindow(window, size);
+	else if (windowType == SPECTRAL_WINDOW_BLACKMAN_HARRIS)
+		dsp::blackmanHarrisWindow(window, size);
+
+	// The same window is applied before analysis and after synthesis, so each output sample is weighted by the sum of the squared window over all overlapping frames.
+	float gain = 0.f;
+	for (int n = 0; n < size; n++)
+		gain += window[n] * window[n];
+	gain /= hop;
+	// irfft(rfft(x)) = size * x
+	outputScale = 1.f / (gain * size);
+
+	std::memset(inputRing, 0, sizeof(inputRing));
+	std::memset(outputRing, 0, sizeof(outputRing));
+}
+
+Spectral::~Spectral() {
+	delete fft;
+}
+
+void Spectral::analyze(int row, float* bins) {
+	// Oldest sample first
+	for (int n = 0; n < size; n++) {
+		int index = position + n;
+		if (index >= size)
+			index -= size;
+		frame[n] = inputRing[row][index] * window[n];
+	}
+	fft->rfft(frame, packed);
+
+	// pffft packs the real Nyquist bin into the imaginary part of DC
+	std::memcpy(&bins[2], &packed[2], sizeof(float) * (size - 2));
+	bins[0] = packed[0];
+	bins[1] = 0.f;
+	bins[size] = packed[1];
+	bins[size + 1] = 0.f;
+
+	if (format == SPECTRAL_POLAR) {
+		for (int k = 0; k <= size / 2; k++) {
+			float re = bins[2 * k];
+			float im = bins[2 * k + 1];
+			bins[2 * k] = std::hypot(re, im);
+			bins[2 * k + 1] = std::atan2(im, re);
+		}
+	}
+}
+
+void Spectral::synthesize(int row, const float* bins) {
+	if (format == SPECTRAL_POLAR) {
+		for (int k = 0; k <= size / 2; k++) {
+			float mag = bins[2 * k];
+			float phase = bins[2 * k + 1];
+			float re = mag * std::cos(phase);
+			float im = mag * std::sin(phase);
+			if (k == 0)
+				packed[0] = re;
+			else if (k == size / 2)
+				packed[1] = re;
+			else {
+				packed[2 * k] = re;
+				packed[2 * k + 1] = im;
+			}
+		}
+	}
+	else {
+		std::memcpy(&packed[2], &bins[2], sizeof(float) * (size - 2));
+		packed[0] = bins[0];
+		packed[1] = bins[size];
+	}
+	fft->irfft(packed, frame);
+
+	for (int n = 0; n < size; n++) {
+		int index = position + n;
+		if (index >= size)
+			index -= size;
+		outputRing[row][index] += frame[n] * window[n] * outputScale;
+	}
+}
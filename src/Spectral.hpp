@@ -0,0 +1,64 @@
+#pragma once
+#include "ScriptEngine.hpp"
+
+
+/** Formats of spectral frames passed to scripts in ProcessBlock::inputs and outputs. */
+enum SpectralFormat {
+	SPECTRAL_OFF = 0,
+	/** Interleaved real and imaginary parts of bins 0 to fftSize/2 */
+	SPECTRAL_COMPLEX = 1,
+	/** Interleaved magnitude and phase of bins 0 to fftSize/2 */
+	SPECTRAL_POLAR = 2,
+};
+
+/** Analysis/synthesis windows of the spectral stage. */
+enum SpectralWindow {
+	SPECTRAL_WINDOW_HANN = 0,
+	SPECTRAL_WINDOW_BLACKMAN_HARRIS = 1,
+	SPECTRAL_WINDOW_RECTANGULAR = 2,
+};
+
+/** Largest FFT whose bins fit in a ProcessBlock row */
+static const int MAX_FFT_SIZE = MAX_BUFFER_SIZE / 2;
+
+
+/** Short-time Fourier transform with weighted overlap-add resynthesis for every row.
+Each spectral frame holds `size + 2` floats.
+*/
+struct Spectral {
+	int size = 0;
+	int hop = 0;
+	int format = SPECTRAL_COMPLEX;
+	rack::dsp::RealFFT* fft = NULL;
+
+	alignas(16) float window[MAX_FFT_SIZE];
+	alignas(16) float frame[MAX_FFT_SIZE];
+	alignas(16) float packed[MAX_FFT_SIZE];
+	/** Last `size` input samples of each row, as ring buffers */
+	float inputRing[NUM_ROWS][MAX_FFT_SIZE];
+	/** Overlap-add accumulators of each row, as ring buffers */
+	float outputRing[NUM_ROWS][MAX_FFT_SIZE];
+	int position = 0;
+	/** Scales the output by the inverse of the overlap-added window gain */
+	float outputScale = 1.f;
+
+	Spectral(int size, int hop, int windowType, int format);
+	~Spectral();
+
+	/** Pushes one input sample of a row and returns its output sample, delayed by `size` samples. */
+	float step(int row, float in) {
+		inputRing[row][position] = in;
+		float out = outputRing[row][position];
+		outputRing[row][position] = 0.f;
+		return out;
+	}
+	/** Advances the ring buffers after all rows are stepped. */
+	void advance() {
+		if (++position >= size)
+			position = 0;
+	}
+	/** Transforms the last `size` input samples of a row into a spectral frame. */
+	void analyze(int row, float* bins);
+	/** Transforms a spectral frame back and overlap-adds it into the output of a row. */
+	void synthesize(int row, const float* bins);
+};
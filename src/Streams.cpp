@@ -0,0 +1,212 @@
+#include "Streams.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+using namespace rack;
+
+
+int Stream::write(const float* data, int n) {
+	int count = std::min((size_t) std::max(n, 0), ring.capacity());
+	count -= count % channels;
+	ring.pushBuffer(data, count);
+	if (count < n)
+		dropped += n - count;
+	return count;
+}
+
+int Stream::read(float* data, int n) {
+	n = std::max(n, 0);
+	int count = std::min((size_t) n, ring.size());
+	count -= count % channels;
+	ring.shiftBuffer(data, count);
+	std::fill(data + count, data + n, 0.f);
+	if (count < n && !ended)
+		dropped += n - count;
+	return count;
+}
+
+void Stream::close() {
+	closed = true;
+}
+
+bool Stream::service() {
+	if (!opened) {
+		opened = true;
+		buffer.resize(CHUNK_SIZE);
+		raw = (string::filenameExtension(string::filename(path)) == "raw");
+		file = std::fopen(path.c_str(), recording ? "wb" : "rb");
+		if (!file) {
+			WARN("Could not open stream %s", path.c_str());
+		}
+		else if (recording) {
+			if (!raw)
+				writeWavHeader(file, channels, sampleRate, 0);
+		}
+		else if (raw) {
+			format.format = 3;
+			format.bits = 32;
+			format.channels = channels;
+			format.dataSize = INT64_MAX;
+		}
+		else if (!readWavHeader(file, path, &format)) {
+			std::fclose(file);
+			file = NULL;
+		}
+		if (file)
+			dataStart = std::ftell(file);
+		else
+			ended = true;
+	}
+
+	if (recording) {
+		// Check before draining, since the script stops pushing once it closes the stream
+		bool finish = closed;
+		while (ring.size() >= (size_t) CHUNK_SIZE || (finish && !ring.empty())) {
+			int count = std::min(ring.size(), (size_t) CHUNK_SIZE);
+			ring.shiftBuffer(buffer.data(), count);
+			if (file)
+				std::fwrite(buffer.data(), sizeof(float), count, file);
+			framesWritten += count / channels;
+		}
+		if (!finish)
+			return true;
+		if (file) {
+			// Rewrite the header with the final length
+			if (!raw) {
+				std::fseek(file, 0, SEEK_SET);
+				writeWavHeader(file, channels, sampleRate, framesWritten);
+			}
+			std::fclose(file);
+			file = NULL;
+		}
+		return false;
+	}
+
+	// Playback
+	if (closed) {
+		if (file)
+			std::fclose(file);
+		file = NULL;
+		return false;
+	}
+	if (file && data.empty()) {
+		decoded.resize(CHUNK_SIZE);
+		data.resize(CHUNK_SIZE * 8);
+	}
+	while (file && !ended && ring.capacity() >= (size_t) CHUNK_SIZE) {
+		int frameSize = format.getFrameSize();
+		int frames = CHUNK_SIZE / std::max(channels, format.channels);
+		frames = std::min((int64_t) frames, (format.dataSize - dataRead) / frameSize);
+		frames = std::fread(data.data(), frameSize, frames, file);
+		dataRead += (int64_t) frames * frameSize;
+		if (frames == 0) {
+			if (loop && dataRead > 0) {
+				std::fseek(file, dataStart, SEEK_SET);
+				dataRead = 0;
+				continue;
+			}
+			ended = true;
+			break;
+		}
+
+		decodeWavSamples(data.data(), decoded.data(), frames * format.channels, format);
+		// Map file channels to stream channels, repeating them if the file has fewer
+		for (int i = 0; i < frames; i++)
+			for (int c = 0; c < channels; c++)
+				buffer[i * channels + c] = decoded[i * format.channels + c % format.channels];
+		ring.pushBuffer(buffer.data(), frames * channels);
+	}
+	return true;
+}
+
+
+struct StreamThread {
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<std::shared_ptr<Stream>> streams;
+	std::thread thread;
+	bool running = true;
+
+	StreamThread() {
+		thread = std::thread([this]() {
+			system::setThreadName("Prototype Streams");
+			run();
+		});
+	}
+
+	~StreamThread() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		cv.notify_one();
+		thread.join();
+	}
+
+	void add(std::shared_ptr<Stream> stream) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			streams.push_back(stream);
+		}
+		cv.notify_one();
+	}
+
+	void run() {
+		std::vector<std::shared_ptr<Stream>> active;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				// Finished streams are removed by the loop below, so copy the list to service it without the lock
+				active = streams;
+			}
+			std::vector<Stream*> finished;
+			for (std::shared_ptr<Stream>& stream : active) {
+				if (!stream->service())
+					finished.push_back(stream.get());
+			}
+			active.clear();
+
+			std::unique_lock<std::mutex> lock(mutex);
+			streams.erase(std::remove_if(streams.begin(), streams.end(), [&](const std::shared_ptr<Stream>& stream) {
+				return std::find(finished.begin(), finished.end(), stream.get()) != finished.end();
+			}), streams.end());
+			if (!running) {
+				// Finish recordings so their files are valid
+				for (std::shared_ptr<Stream>& stream : streams) {
+					stream->close();
+					stream->service();
+				}
+				return;
+			}
+			// Chunks last about 340 ms at 48 kHz, so polling every 10 ms keeps the ring buffers well ahead
+			cv.wait_for(lock, std::chrono::milliseconds(10));
+		}
+	}
+};
+
+
+static StreamThread& getStreamThread() {
+	static StreamThread streamThread;
+	return streamThread;
+}
+
+std::shared_ptr<Stream> openStream(const std::string& path, bool recording, int channels, float sampleRate, bool loop) {
+	std::shared_ptr<Stream> stream = std::make_shared<Stream>();
+	stream->path = path;
+	stream->recording = recording;
+	stream->channels = clamp(channels, 1, 64);
+	stream->sampleRate = sampleRate;
+	stream->loop = loop;
+	getStreamThread().add(stream);
+	return stream;
+}
+
+int writeStream(Stream* stream, const float* data, int n) {
+	return stream->write(data, n);
+}
+
+int readStream(Stream* stream, float* data, int n) {
+	return stream->read(data, n);
+}
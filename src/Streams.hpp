@@ -0,0 +1,64 @@
+#pragma once
+#include <rack.hpp>
+#include "Wav.hpp"
+
+
+/** A file recorded or played by a script.
+The script pushes or pulls interleaved samples through a lock-free ring buffer, and the stream I/O thread moves them to or from the file in large sequential chunks.
+Paths ending in `.raw` are headerless interleaved float32. Other paths are WAV files, recorded as 32-bit float.
+*/
+struct Stream {
+	/** About 2.7 seconds of mono audio at 48 kHz */
+	static const size_t RING_SIZE = 1 << 17;
+	/** Samples moved per file read or write */
+	static const int CHUNK_SIZE = 1 << 14;
+
+	std::string path;
+	bool recording;
+	int channels;
+	float sampleRate;
+	bool loop;
+	/** Written by the script and read by the I/O thread when recording, and the reverse when playing */
+	rack::dsp::RingBuffer<float, RING_SIZE> ring;
+	std::atomic<bool> closed{false};
+	/** Set when playback reaches the end of the file, or the file cannot be opened */
+	std::atomic<bool> ended{false};
+	/** Samples dropped because the ring buffer was full when recording, or empty when playing */
+	std::atomic<int64_t> dropped{0};
+
+	// I/O thread
+	FILE* file = NULL;
+	bool opened = false;
+	bool raw = false;
+	WavFormat format;
+	long dataStart = 0;
+	int64_t dataRead = 0;
+	int64_t framesWritten = 0;
+	/** Chunk buffers, allocated by the I/O thread to keep them off its stack */
+	std::vector<float> buffer;
+	std::vector<float> decoded;
+	std::vector<uint8_t> data;
+
+	/** Pushes `n` interleaved samples, rounded down to whole frames. Returns the number pushed. */
+	int write(const float* data, int n);
+	/** Pulls `n` interleaved samples and fills the rest with zeros. Returns the number pulled. */
+	int read(float* data, int n);
+	/** Returns whether playback has ended and every sample has been read. */
+	bool isEnded() {
+		return ended && ring.empty();
+	}
+	/** Finishes the file after the remaining samples are written. The stream must not be used afterwards. */
+	void close();
+	/** Called by the I/O thread. Returns false when the stream is finished. */
+	bool service();
+};
+
+
+/** Opens a stream and starts opening its file on the I/O thread.
+`sampleRate` is written to recorded WAV files. `loop` restarts playback at the end of the file.
+*/
+std::shared_ptr<Stream> openStream(const std::string& path, bool recording, int channels, float sampleRate, bool loop);
+/** Calls `stream->write()`, for binding as a C function pointer. */
+int writeStream(Stream* stream, const float* data, int n);
+/** Calls `stream->read()`, for binding as a C function pointer. */
+int readStream(Stream* stream, float* data, int n);
@@ -6,8 +6,11 @@
 #include "LangSource/VMGlobals.h"
 #include "LangSource/PyrObject.h"
 #include "LangSource/PyrKernel.h"
+#include "LangSource/PyrInterpreter.h"
 
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <numeric>
 #include <unistd.h> // getcwd
@@ -26,38 +29,70 @@
  * ~vcv_process is invoked once per process block. Users should not manipulate
  * the block object in any way other than by writing directly to the arrays in `outputs`,
  * `knobs`, `lights`, and `switchLights`.
+ *
+ * sclang is a global interpreter, so one host thread owns the VM and serves every module
+ * running a SuperCollider script. Each module is a client with its own Environment, in which
+ * its script is interpreted and its ~vcv_process is evaluated.
+ *
+ * When a client is loaded, the VM creates one VcvPrototypeProcessBlock for it whose arrays
+ * have the final buffer size. Modules submit their blocks at block boundaries. The host copies
+ * them into the arrays of those objects in place and evaluates every submitted block with one
+ * call of VcvPrototypeProcessBlock.vcvProcessAll through the VM, so no code is compiled while
+ * processing. Modules pick up their results at their next block boundary, one block later.
  */
 
 extern rack::plugin::Plugin* pluginInstance; // plugin's version of 'this'
-class SuperColliderEngine;
+class SuperColliderHost;
+
+// A module's connection to the host. Fields other than the atomics are guarded by the host's mutex.
+struct SC_VcvPrototypeModule {
+	int id = -1;
+	std::string script;
+	std::atomic_bool loaded{false}; // set to true when the script has been interpreted
+	std::atomic_bool failed{false};
+	bool removed = false;
+	int frameDivider = 1;
+	int bufferSize = 1;
+	// set when the module has submitted a block that the host has not evaluated yet
+	bool pending = false;
+	// set when `result` holds outputs that the module has not picked up yet
+	bool hasResult = false;
+	// latest message posted by the script, shown by the module at its next block
+	std::string message;
+	bool messageChanged = false;
+	std::unique_ptr<ProcessBlock> submitted{new ProcessBlock};
+	std::unique_ptr<ProcessBlock> result{new ProcessBlock};
+	// knobs passed to the evaluation that produced `result`, so only knobs changed by the script are set
+	float evaluatedKnobs[NUM_ROWS] = {};
+
+	void setMessage(const std::string& text) {
+		message = text;
+		messageChanged = true;
+	}
+};
 
 class SC_VcvPrototypeClient final : public SC_LanguageClient {
 public:
-	SC_VcvPrototypeClient(SuperColliderEngine* engine);
+	SC_VcvPrototypeClient(SuperColliderHost* host);
 	~SC_VcvPrototypeClient();
 
 	// These will invoke the interpreter
-	void interpretScript(const std::string& script) noexcept
-	{
-		// Insert our own environment variable in the script so we can check
-		// later (in testCompile()) whether it compiled all right.
-		auto modifiedScript = std::string(compileTestVariableName) + "=1;" + script;
-		interpret(modifiedScript.c_str());
-		testCompile();
-	}
-	void evaluateProcessBlock(ProcessBlock* block) noexcept;
+	// Interprets the module's script in its own Environment and creates its process block.
+	void loadModule(SC_VcvPrototypeModule* module) noexcept;
+	void removeModule(int id) noexcept;
+	// Copies a submitted block into the module's process block object and marks it for the next evaluation.
+	void writeProcessBlock(SC_VcvPrototypeModule* module) noexcept;
+	// Evaluates every marked module's ~vcv_process in one VM entry.
+	void evaluateProcessBlocks() noexcept;
+	// Copies the result of the last evaluation into the module's result block.
+	void readProcessBlock(SC_VcvPrototypeModule* module) noexcept;
 	void setNumRows() noexcept {
 		auto&& command = "VcvPrototypeProcessBlock.numRows = " + std::to_string(NUM_ROWS);
 		interpret(command.c_str());
 	}
-	int getFrameDivider() noexcept {
-		return getEnvVarAsPositiveInt("~vcv_frameDivider", "~vcv_frameDivider should be an Integer");
-	}
-	int getBufferSize() noexcept {
-		return getEnvVarAsPositiveInt("~vcv_bufferSize", "~vcv_bufferSize should be an Integer");
-	}
 
 	bool isOk() const noexcept { return _ok; }
+	const std::string& getError() const noexcept { return _error; }
 
 	void postText(const char* str, size_t len) override;
 
@@ -69,95 +104,327 @@ public:
 private:
 	static const char * compileTestVariableName;
 
+	// See .sc object definition
+	enum ClassVarIndex {
+		NumRowsClassVar,
+		CurrentModuleClassVar,
+		EnvironmentsClassVar,
+		FunctionsClassVar,
+		BlocksClassVar,
+		DueClassVar,
+		ResultsClassVar,
+	};
+
 	void interpret(const char * text) noexcept;
+	void interpretScript(const std::string& script) noexcept
+	{
+		// Insert our own environment variable in the script so we can check
+		// later (in testCompile()) whether it compiled all right.
+		auto modifiedScript = std::string(compileTestVariableName) + "=1;" + script;
+		interpret(modifiedScript.c_str());
+		testCompile();
+	}
+	int getFrameDivider() noexcept {
+		return getEnvVarAsPositiveInt("~vcv_frameDivider", "~vcv_frameDivider should be an Integer");
+	}
+	int getBufferSize() noexcept {
+		return getEnvVarAsPositiveInt("~vcv_bufferSize", "~vcv_bufferSize should be an Integer");
+	}
 
 	void testCompile() noexcept { getEnvVarAsPositiveInt(compileTestVariableName, "Script failed to compile"); }
 
-	// Called on unrecoverable error, will stop the plugin
+	// Called on unrecoverable error, will stop the current module, or every module if there is none
 	void fail(const std::string& msg) noexcept;
 
-	const char* buildScProcessBlockString(const ProcessBlock* block) const noexcept;
+	PyrSlot* getClassVar(ClassVarIndex index) noexcept;
+	// returns the slot of the module in one of the per-module classvar arrays, or NULL if it is missing
+	PyrSlot* getModuleSlot(ClassVarIndex index, int id) noexcept;
 
 	int getEnvVarAsPositiveInt(const char* envVarName, const char* errorMsg) noexcept;
 
-	// converts top of stack back to ProcessBlock data
-	void readScProcessBlockResult(ProcessBlock* block) noexcept;
+	// copies ProcessBlock data into a process block object
+	void writeScProcessBlock(PyrSlot* blockSlot, ProcessBlock* block) noexcept;
+
+	// converts a result of ~vcv_process back to ProcessBlock data
+	void readScProcessBlockResult(PyrSlot* resultSlot, ProcessBlock* block) noexcept;
 
-	// helpers for copying SC info back into process block's arrays
+	// helpers for copying between SC arrays and process block's arrays
+	enum CopyDirection { FromSc, ToSc };
 	bool isVcvPrototypeProcessBlock(const PyrSlot* slot) const noexcept;
-	bool copyFloatArray(const PyrSlot& inSlot, const char* context, const char* extraContext, float* outArray, int size) noexcept;
+	bool copyFloatArray(const PyrSlot& inSlot, const char* context, const char* extraContext, float* array, int size, CopyDirection direction = FromSc) noexcept;
 	template <typename Array>
-	bool copyArrayOfFloatArrays(const PyrSlot& inSlot, const char* context, Array& array, int size) noexcept;
+	bool copyArrayOfFloatArrays(const PyrSlot& inSlot, const char* context, Array& array, int size, CopyDirection direction = FromSc) noexcept;
 
-	SuperColliderEngine* _engine;
-	PyrSymbol* _vcvPrototypeProcessBlockSym;
+	SuperColliderHost* _host;
+	// module being loaded, written, or read, which fail() stops
+	SC_VcvPrototypeModule* _current = nullptr;
+	PyrSymbol* _vcvPrototypeProcessBlockSym = nullptr;
+	PyrSymbol* _vcvProcessAllSym = nullptr;
 	bool _ok = true;
+	std::string _error;
 };
 
 const char * SC_VcvPrototypeClient::compileTestVariableName = "~vcv_secretTestCompileSentinel";
 
-class SuperColliderEngine final : public ScriptEngine {
+// Owns the VM on its own thread and evaluates the blocks submitted by every module.
+class SuperColliderHost {
 public:
-	~SuperColliderEngine() noexcept {
-		// Only join if client was started in the first place.
-		if (_clientThread.joinable())
-			_clientThread.join();
-		engineRunning = false;
+	SuperColliderHost() {
+		_thread = std::thread([this]() {
+			rack::system::setThreadName("Prototype SuperCollider");
+			run();
+		});
 	}
 
-	std::string getEngineName() override { return "SuperCollider"; }
+	~SuperColliderHost() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_running = false;
+		}
+		_cv.notify_one();
+		_thread.join();
+	}
 
-	int run(const std::string& path, const std::string& script) override {
-		if (engineRunning) {
-			display("Only one SuperCollider engine may run at once");
-			return 1;
+	// Returns the host shared by every SuperCollider engine, starting it if needed.
+	static std::shared_ptr<SuperColliderHost> get() {
+		static std::mutex mutex;
+		static std::weak_ptr<SuperColliderHost> instance;
+		std::lock_guard<std::mutex> lock(mutex);
+		std::shared_ptr<SuperColliderHost> host = instance.lock();
+		if (!host) {
+			host = std::make_shared<SuperColliderHost>();
+			instance = host;
 		}
+		return host;
+	}
 
-		engineRunning = true;
-
-		if (!_clientThread.joinable()) {
-			_clientThread = std::thread([this, script]() {
-				_client.reset(new SC_VcvPrototypeClient(this));
-				_client->setNumRows();
-				_client->interpretScript(script);
-				setFrameDivider(_client->getFrameDivider());
-				setBufferSize(_client->getBufferSize());
-				finishClientLoading();
-			});
+	std::shared_ptr<SC_VcvPrototypeModule> addModule(const std::string& script) {
+		auto module = std::make_shared<SC_VcvPrototypeModule>();
+		module->script = script;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			// Ids index the classvar arrays in the VM, so the lowest free id is reused
+			int id = 0;
+			while (std::any_of(_modules.begin(), _modules.end(), [&](const std::shared_ptr<SC_VcvPrototypeModule>& m) { return m->id == id; }))
+				id++;
+			module->id = id;
+			_modules.push_back(module);
 		}
+		_cv.notify_one();
+		return module;
+	}
 
-		return 0;
+	// The module's environment is released by the host thread.
+	void removeModule(SC_VcvPrototypeModule* module) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			module->removed = true;
+		}
+		_cv.notify_one();
 	}
 
-	int process() override {
-		if (waitingOnClient())
-			return 0;
+	// Shows the script's latest message and exchanges the module's block for the result of its previous block.
+	void process(SC_VcvPrototypeModule* module, ScriptEngine* engine, ProcessBlock* block) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (module->messageChanged) {
+			engine->display(module->message);
+			module->messageChanged = false;
+		}
+		if (module->failed)
+			return;
+		if (module->hasResult) {
+			ProcessBlock* result = module->result.get();
+			int n = std::min(block->bufferSize, result->bufferSize);
+			for (int i = 0; i < NUM_ROWS; i++) {
+				std::memcpy(block->outputs[i], result->outputs[i], sizeof(float) * n);
+				std::memcpy(block->lights[i], result->lights[i], sizeof(block->lights[i]));
+				std::memcpy(block->switchLights[i], result->switchLights[i], sizeof(block->switchLights[i]));
+				// A knob the user is turning would jump back to its value a block ago
+				if (result->knobs[i] != module->evaluatedKnobs[i])
+					block->knobs[i] = result->knobs[i];
+			}
+			module->hasResult = false;
+		}
 
-		if (clientHasError())
-			return 1;
+		// The submitted block is replaced if the host has not evaluated it yet
+		ProcessBlock* submitted = module->submitted.get();
+		submitted->sampleRate = block->sampleRate;
+		submitted->sampleTime = block->sampleTime;
+		submitted->bufferSize = block->bufferSize;
+		for (int i = 0; i < NUM_ROWS; i++) {
+			std::memcpy(submitted->inputs[i], block->inputs[i], sizeof(float) * block->bufferSize);
+			std::memcpy(submitted->outputs[i], block->outputs[i], sizeof(float) * block->bufferSize);
+		}
+		std::memcpy(submitted->knobs, block->knobs, sizeof(block->knobs));
+		std::memcpy(submitted->switches, block->switches, sizeof(block->switches));
+		std::memcpy(submitted->lights, block->lights, sizeof(block->lights));
+		std::memcpy(submitted->switchLights, block->switchLights, sizeof(block->switchLights));
+		module->pending = true;
 
-		_client->evaluateProcessBlock(getProcessBlock());
-		return clientHasError() ? 1 : 0;
+		_cv.notify_one();
 	}
 
 private:
-	// Used to limit the number of running SC instances to 1.
-	static bool engineRunning;
+	// Returns whether a module that is running has submitted a block.
+	bool anyPending() {
+		return std::any_of(_modules.begin(), _modules.end(), [](const std::shared_ptr<SC_VcvPrototypeModule>& module) {
+			return module->pending && !module->failed && !module->removed;
+		});
+	}
 
-	bool waitingOnClient() const noexcept { return !_clientRunning; }
-	bool clientHasError() const noexcept { return !_client->isOk(); }
-	void finishClientLoading() noexcept { _clientRunning = true; }
+	// Returns whether every module that is running has submitted a block.
+	bool allPending() {
+		return std::all_of(_modules.begin(), _modules.end(), [](const std::shared_ptr<SC_VcvPrototypeModule>& module) {
+			return module->pending || !module->loaded || module->failed || module->removed;
+		});
+	}
+
+	// Returns whether a module must be loaded or released.
+	bool needsUpdate() {
+		return std::any_of(_modules.begin(), _modules.end(), [](const std::shared_ptr<SC_VcvPrototypeModule>& module) {
+			return module->removed || !module->loaded;
+		});
+	}
+
+	void run() {
+		// sclang has global state, so a new host waits for the previous one to shut down its VM
+		static std::mutex vmMutex;
+		std::lock_guard<std::mutex> vmLock(vmMutex);
+		_client.reset(new SC_VcvPrototypeClient(this));
+		_client->setNumRows();
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (true) {
+			_cv.wait(lock, [&]() { return !_running || needsUpdate() || anyPending(); });
+			if (!_running)
+				break;
+
+			// Release removed modules and load new ones.
+			// Interpreting may take a while, so the mutex is released meanwhile.
+			for (size_t i = 0; i < _modules.size();) {
+				std::shared_ptr<SC_VcvPrototypeModule> module = _modules[i];
+				if (module->removed) {
+					_modules.erase(_modules.begin() + i);
+					if (_client->isOk()) {
+						lock.unlock();
+						_client->removeModule(module->id);
+						lock.lock();
+					}
+					continue;
+				}
+				if (!module->loaded) {
+					if (_client->isOk()) {
+						lock.unlock();
+						_client->loadModule(module.get());
+						lock.lock();
+					}
+					else {
+						module->setMessage(_client->getError());
+						module->failed = true;
+					}
+					module->loaded = true;
+				}
+				i++;
+			}
+
+			// Give the other running modules a moment to submit their blocks so they share one VM entry,
+			// but not so long that the first one misses its next block
+			if (anyPending() && !allPending()) {
+				float timeout = 0.001f;
+				for (const auto& module : _modules) {
+					if (module->pending)
+						timeout = std::min(timeout, module->submitted->bufferSize * module->submitted->sampleTime / 4);
+				}
+				_cv.wait_for(lock, std::chrono::duration<float>(timeout), [&]() { return !_running || allPending(); });
+			}
+
+			// Evaluate every submitted block in one VM entry.
+			// Copying between blocks and SC arrays is quick, so it is done with the mutex held.
+			std::vector<std::shared_ptr<SC_VcvPrototypeModule>> due;
+			for (const auto& module : _modules) {
+				if (module->pending && !module->failed && !module->removed) {
+					_client->writeProcessBlock(module.get());
+					std::memcpy(module->evaluatedKnobs, module->submitted->knobs, sizeof(module->evaluatedKnobs));
+					module->pending = false;
+					due.push_back(module);
+				}
+			}
+			if (!due.empty()) {
+				lock.unlock();
+				_client->evaluateProcessBlocks();
+				lock.lock();
+				for (const auto& module : due) {
+					if (module->failed || module->removed)
+						continue;
+					_client->readProcessBlock(module.get());
+					module->hasResult = true;
+				}
+			}
+		}
+		lock.unlock();
+
+		_client.reset();
+	}
+
+	friend class SC_VcvPrototypeClient;
+	// Returns the module with the given id for routing posted text, or NULL.
+	std::shared_ptr<SC_VcvPrototypeModule> findModule(int id) {
+		for (const auto& module : _modules) {
+			if (module->id == id)
+				return module;
+		}
+		return nullptr;
+	}
 
 	std::unique_ptr<SC_VcvPrototypeClient> _client;
-	std::thread _clientThread; // used only to start up client
-	std::atomic_bool _clientRunning{false}; // set to true when client is ready to process data
+	std::vector<std::shared_ptr<SC_VcvPrototypeModule>> _modules;
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::thread _thread;
+	bool _running = true;
 };
 
-bool SuperColliderEngine::engineRunning = false;
+class SuperColliderEngine final : public ScriptEngine {
+public:
+	~SuperColliderEngine() noexcept {
+		if (_module)
+			_host->removeModule(_module.get());
+	}
+
+	std::string getEngineName() override { return "SuperCollider"; }
+
+	int run(const std::string& path, const std::string& script) override {
+		_host = SuperColliderHost::get();
+		_module = _host->addModule(script);
+		return 0;
+	}
+
+	int process() override {
+		if (!_module->loaded)
+			return 0;
+
+		if (!_configured) {
+			// Set here rather than on the host thread, which must not touch the module
+			setConfigIfChanged("frameDivider", _module->frameDivider);
+			setConfigIfChanged("bufferSize", _module->bufferSize);
+			_configured = true;
+		}
+
+		_host->process(_module.get(), this, getProcessBlock());
+		return _module->failed ? 1 : 0;
+	}
+
+	int getBlockLatency() override { return 1; }
+
+private:
+	std::shared_ptr<SuperColliderHost> _host;
+	std::shared_ptr<SC_VcvPrototypeModule> _module;
+	bool _configured = false;
+};
 
-SC_VcvPrototypeClient::SC_VcvPrototypeClient(SuperColliderEngine* engine)
+SC_VcvPrototypeClient::SC_VcvPrototypeClient(SuperColliderHost* host)
 	: SC_LanguageClient("SC VCV-Prototype client")
-	, _engine(engine)
+	, _host(host)
 {
 	using Path = SC_LanguageConfig::Path;
 	Path sc_lib_root = rack::asset::plugin(pluginInstance, "dep/supercollider/SCClassLibrary");
@@ -183,6 +450,12 @@ SC_VcvPrototypeClient::SC_VcvPrototypeClient(SuperColliderEngine* engine)
 		fail("Error while compiling class library");
 
 	_vcvPrototypeProcessBlockSym = getsym("VcvPrototypeProcessBlock");
+	_vcvProcessAllSym = getsym("vcvProcessAll");
+	if (!_vcvPrototypeProcessBlockSym->u.classobj)
+		fail("VcvPrototypeProcessBlock class not found");
+	// The compiler's output is only kept to explain a failure
+	if (_ok)
+		_error.clear();
 }
 
 SC_VcvPrototypeClient::~SC_VcvPrototypeClient() {
@@ -195,6 +468,64 @@ void SC_VcvPrototypeClient::interpret(const char* text) noexcept {
 	interpretCmdLine();
 }
 
+void SC_VcvPrototypeClient::loadModule(SC_VcvPrototypeModule* module) noexcept {
+	_current = module;
+	auto id = std::to_string(module->id);
+	interpret(("VcvPrototypeProcessBlock.vcvBeginModule(" + id + ")").c_str());
+	interpretScript(module->script);
+	int frameDivider = getFrameDivider();
+	int bufferSize = getBufferSize();
+	if (!module->failed) {
+		// The module clamps its buffer size, so the arrays are created with the clamped size
+		bufferSize = rack::math::clamp(bufferSize, 1, MAX_BUFFER_SIZE);
+		interpret(("^VcvPrototypeProcessBlock.vcvEndModule(" + id + ", " + std::to_string(bufferSize) + ")").c_str());
+		if (!isVcvPrototypeProcessBlock(&scGlobals()->result))
+			fail("Could not create process block");
+	}
+	// Scripts of other modules must not see this module's environment
+	interpret("VcvPrototypeProcessBlock.vcvRestoreEnvironment");
+	if (module->failed) {
+		removeModule(module->id);
+	}
+	else {
+		std::lock_guard<std::mutex> lock(_host->_mutex);
+		module->frameDivider = frameDivider;
+		module->bufferSize = bufferSize;
+	}
+	_current = nullptr;
+}
+
+void SC_VcvPrototypeClient::removeModule(int id) noexcept {
+	interpret(("VcvPrototypeProcessBlock.vcvRemoveModule(" + std::to_string(id) + ")").c_str());
+}
+
+PyrSlot* SC_VcvPrototypeClient::getClassVar(ClassVarIndex index) noexcept {
+	PyrClass* klass = _vcvPrototypeProcessBlockSym->u.classobj;
+	return &scGlobals()->classvars->slots[slotRawInt(&klass->classVarIndex) + index];
+}
+
+PyrSlot* SC_VcvPrototypeClient::getModuleSlot(ClassVarIndex index, int id) noexcept {
+	PyrSlot* arraySlot = getClassVar(index);
+	if (!isKindOfSlot(arraySlot, class_array) || id >= slotRawObject(arraySlot)->size)
+		return nullptr;
+	return &slotRawObject(arraySlot)->slots[id];
+}
+
+void SC_VcvPrototypeClient::writeProcessBlock(SC_VcvPrototypeModule* module) noexcept {
+	_current = module;
+	PyrSlot* blockSlot = getModuleSlot(BlocksClassVar, module->id);
+	PyrSlot* dueSlot = getModuleSlot(DueClassVar, module->id);
+	if (!blockSlot || !dueSlot || !isVcvPrototypeProcessBlock(blockSlot)) {
+		fail("Process block was not created");
+	}
+	else {
+		writeScProcessBlock(blockSlot, module->submitted.get());
+		// Booleans are not objects, so they can be stored without a GC write barrier
+		SetBool(dueSlot, !module->failed);
+	}
+	_current = nullptr;
+}
+
 #ifdef SC_VCV_ENGINE_TIMING
 static long long int gmax = 0;
 static constexpr unsigned int nTimes = 1024;
@@ -202,13 +533,23 @@ static long long int times[nTimes] = {};
 static unsigned int timesIndex = 0;
 #endif
 
-void SC_VcvPrototypeClient::evaluateProcessBlock(ProcessBlock* block) noexcept {
+void SC_VcvPrototypeClient::evaluateProcessBlocks() noexcept {
 #ifdef SC_VCV_ENGINE_TIMING
 	auto start = std::chrono::high_resolution_clock::now();
 #endif
-	auto* buf = buildScProcessBlockString(block);
-	interpret(buf);
-	readScProcessBlockResult(block);
+	// Same calling sequence as runLibrary(), with the class as receiver
+	VMGlobals* g = scGlobals();
+	g->canCallOS = true;
+	try {
+		++g->sp;
+		SetObject(g->sp, _vcvPrototypeProcessBlockSym->u.classobj);
+		runInterpreter(g, _vcvProcessAllSym, 1);
+	} catch (const std::exception& ex) {
+		fail(std::string("~vcv_process failed: ") + ex.what());
+	} catch (...) {
+		fail("~vcv_process failed");
+	}
+	g->canCallOS = false;
 #ifdef SC_VCV_ENGINE_TIMING
 	auto end = std::chrono::high_resolution_clock::now();
 	auto ticks = (end - start).count();
@@ -228,81 +569,99 @@ void SC_VcvPrototypeClient::evaluateProcessBlock(ProcessBlock* block) noexcept {
 #endif
 }
 
+void SC_VcvPrototypeClient::readProcessBlock(SC_VcvPrototypeModule* module) noexcept {
+	_current = module;
+	PyrSlot* resultSlot = getModuleSlot(ResultsClassVar, module->id);
+	if (!resultSlot) {
+		fail("Process block was not evaluated");
+	}
+	else if (isKindOfSlot(resultSlot, class_string)) {
+		// vcvProcessAll stores the message of an error thrown by ~vcv_process
+		auto* errorString = reinterpret_cast<PyrString*>(slotRawObject(resultSlot));
+		fail(std::string(errorString->s, errorString->size));
+	}
+	else {
+		ProcessBlock* result = module->result.get();
+		result->bufferSize = module->submitted->bufferSize;
+		readScProcessBlockResult(resultSlot, result);
+	}
+	_current = nullptr;
+}
+
 void SC_VcvPrototypeClient::postText(const char* str, size_t len) {
+	// Text posted while the class library compiles, or after it failed to compile, has no module to go to
+	if (!isLibraryCompiled() || !_vcvPrototypeProcessBlockSym || !_vcvPrototypeProcessBlockSym->u.classobj) {
+		if (_ok)
+			_error = std::string(str, len);
+		return;
+	}
+	// Text is posted by the module being loaded or processed
+	PyrSlot* currentSlot = getClassVar(CurrentModuleClassVar);
+	if (!IsInt(currentSlot))
+		return;
+	std::lock_guard<std::mutex> lock(_host->_mutex);
+	auto module = _host->findModule(slotRawInt(currentSlot));
 	// Ensure the last message logged (presumably an error) stays onscreen.
-	if (_ok)
-		_engine->display(std::string(str, len));
+	if (module && !module->failed)
+		module->setMessage(std::string(str, len));
 }
 
+// The host holds its mutex while blocks are copied, and modules do not read their message before they are loaded,
+// so the current module is not locked here.
 void SC_VcvPrototypeClient::fail(const std::string& msg) noexcept {
-	// Ensure the last messaged logged in a previous failure stays onscreen.
+	if (_current) {
+		// Ensure the last messaged logged in a previous failure stays onscreen.
+		if (!_current->failed)
+			_current->setMessage(msg);
+		_current->failed = true;
+		return;
+	}
+	// Keep the text posted before the failure, such as the class library's compile error
 	if (_ok)
-		_engine->display(msg);
+		_error = _error.empty() ? msg : msg + ": " + _error;
 	_ok = false;
 }
 
-// This should be well above what we ever need to represent a process block.
-// Currently comes out to around 500 KB.
-constexpr unsigned buildPbOverhead = 1024;
-constexpr unsigned buildPbFloatSize = 10;
-constexpr unsigned buildPbInsOutsSize = MAX_BUFFER_SIZE * NUM_ROWS * 2 * buildPbFloatSize;
-constexpr unsigned buildPbOtherArraysSize = buildPbFloatSize * NUM_ROWS * 8;
-constexpr unsigned buildPbBufferSize = buildPbOverhead + buildPbInsOutsSize + buildPbOtherArraysSize;
-
-// Don't write initial string every time
-#define BUILD_PB_BEGIN_STRING "^~vcv_process.(VcvPrototypeProcessBlock.new("
-static char buildPbStringScratchBuf[buildPbBufferSize] = BUILD_PB_BEGIN_STRING;
-constexpr unsigned buildPbBeginStringOffset = sizeof(BUILD_PB_BEGIN_STRING);
-#undef BUILD_PB_BEGIN_STRING
-
-const char* SC_VcvPrototypeClient::buildScProcessBlockString(const ProcessBlock* block) const noexcept {
-	auto* buf = buildPbStringScratchBuf + buildPbBeginStringOffset - 1;
-
-	// Perhaps imprudently assuming snprintf never returns a negative code
-	buf += std::sprintf(buf, "%.6f,%.6f,%d,", block->sampleRate, block->sampleTime, block->bufferSize);
-
-	auto&& appendInOutArray = [&buf](const int bufferSize, const float (&data)[NUM_ROWS][MAX_BUFFER_SIZE]) {
-		buf += std::sprintf(buf, "[");
-		for (int i = 0; i < NUM_ROWS; ++i) {
-			buf += std::sprintf(buf, "Signal[");
-			for (int j = 0; j < bufferSize; ++j) {
-				buf += std::sprintf(buf, "%g%c", data[i][j], j == bufferSize - 1 ? ' ' : ',');
-			}
-			buf += std::sprintf(buf, "]%c", i == NUM_ROWS - 1 ? ' ' : ',');
-		}
-		buf += std::sprintf(buf, "],");
-	};
-
-	appendInOutArray(block->bufferSize, block->inputs);
-	appendInOutArray(block->bufferSize, block->outputs);
-
-	// knobs
-	buf += std::sprintf(buf, "FloatArray[");
-	for (int i = 0; i < NUM_ROWS; ++i)
-		buf += std::sprintf(buf, "%g%c", block->knobs[i], i == NUM_ROWS - 1 ? ' ' : ',');
+void SC_VcvPrototypeClient::writeScProcessBlock(PyrSlot* blockSlot, ProcessBlock* block) noexcept {
+	PyrObject* object = slotRawObject(blockSlot);
+	auto* rawSlots = static_cast<PyrSlot*>(object->slots);
 
-	// switches
-	buf += std::sprintf(buf, "],[");
-	for (int i = 0; i < NUM_ROWS; ++i)
-		buf += std::sprintf(buf, "%s%c", block->switches[i] ? "true" : "false", i == NUM_ROWS - 1 ? ' ' : ',');
-	buf += std::sprintf(buf, "]");
-
-	// lights, switchlights
-	auto&& appendLightsArray = [&buf](const float (&array)[NUM_ROWS][3]) {
-		buf += std::sprintf(buf, ",[");
-		for (int i = 0; i < NUM_ROWS; ++i) {
-			buf += std::sprintf(buf, "FloatArray[%g,%g,%g]%c", array[i][0], array[i][1], array[i][2],
-				i == NUM_ROWS - 1 ? ' ' : ',');
-		}
-		buf += std::sprintf(buf, "]");
-	};
+	// See .sc object definition
+	constexpr unsigned sampleRateSlotIndex = 0;
+	constexpr unsigned sampleTimeSlotIndex = 1;
+	constexpr unsigned bufferSizeSlotIndex = 2;
+	constexpr unsigned inputsSlotIndex = 3;
+	constexpr unsigned outputsSlotIndex = 4;
+	constexpr unsigned knobsSlotIndex = 5;
+	constexpr unsigned switchesSlotIndex = 6;
+	constexpr unsigned lightsSlotIndex = 7;
+	constexpr unsigned switchLightsSlotIndex = 8;
 
-	appendLightsArray(block->lights);
-	appendLightsArray(block->switchLights);
+	// Numbers and booleans are not objects, so they can be stored without a GC write barrier
+	SetFloat(&rawSlots[sampleRateSlotIndex], block->sampleRate);
+	SetFloat(&rawSlots[sampleTimeSlotIndex], block->sampleTime);
+	SetInt(&rawSlots[bufferSizeSlotIndex], block->bufferSize);
 
-	buf += std::sprintf(buf, "));");
+	// ~vcv_process may replace the arrays, so they are looked up and checked every block
+	if (!copyArrayOfFloatArrays(rawSlots[inputsSlotIndex], "inputs", block->inputs, block->bufferSize, ToSc))
+		return;
+	if (!copyArrayOfFloatArrays(rawSlots[outputsSlotIndex], "outputs", block->outputs, block->bufferSize, ToSc))
+		return;
+	if (!copyFloatArray(rawSlots[knobsSlotIndex], "", "knobs", block->knobs, NUM_ROWS, ToSc))
+		return;
+	if (!copyArrayOfFloatArrays(rawSlots[lightsSlotIndex], "lights", block->lights, 3, ToSc))
+		return;
+	if (!copyArrayOfFloatArrays(rawSlots[switchLightsSlotIndex], "switchLights", block->switchLights, 3, ToSc))
+		return;
 
-	return buildPbStringScratchBuf;
+	PyrSlot* switchesSlot = &rawSlots[switchesSlotIndex];
+	if (!isKindOfSlot(switchesSlot, class_array) || slotRawObject(switchesSlot)->size != NUM_ROWS) {
+		fail("switches must be an Array of size " + std::to_string(NUM_ROWS));
+		return;
+	}
+	auto* switches = slotRawObject(switchesSlot)->slots;
+	for (int i = 0; i < NUM_ROWS; ++i)
+		SetBool(&switches[i], block->switches[i]);
 }
 
 int SC_VcvPrototypeClient::getEnvVarAsPositiveInt(const char* envVarName, const char* errorMsg) noexcept {
@@ -325,8 +684,7 @@ int SC_VcvPrototypeClient::getEnvVarAsPositiveInt(const char* envVarName, const
 }
 
 
-void SC_VcvPrototypeClient::readScProcessBlockResult(ProcessBlock* block) noexcept {
-	auto* resultSlot = &scGlobals()->result;
+void SC_VcvPrototypeClient::readScProcessBlockResult(PyrSlot* resultSlot, ProcessBlock* block) noexcept {
 	if (!isVcvPrototypeProcessBlock(resultSlot)) {
 		fail("Result of ~vcv_process must be an instance of VcvPrototypeProcessBlock");
 		return;
@@ -362,7 +720,7 @@ bool SC_VcvPrototypeClient::isVcvPrototypeProcessBlock(const PyrSlot* slot) cons
 
 // It's somewhat bad design that we pass two const char*s here, but this avoids an allocation while also providing
 // good context for errors.
-bool SC_VcvPrototypeClient::copyFloatArray(const PyrSlot& inSlot, const char* context, const char* extraContext, float* outArray, int size) noexcept
+bool SC_VcvPrototypeClient::copyFloatArray(const PyrSlot& inSlot, const char* context, const char* extraContext, float* array, int size, CopyDirection direction) noexcept
 {
 	if (!isKindOfSlot(const_cast<PyrSlot*>(&inSlot), class_floatarray)) {
 		fail(std::string(context) + extraContext + " must be a FloatArray");
@@ -374,14 +732,17 @@ bool SC_VcvPrototypeClient::copyFloatArray(const PyrSlot& inSlot, const char* co
 		return false;
 	}
 
-	auto* floatArray = reinterpret_cast<const PyrFloatArray*>(floatArrayObj);
-	auto* rawArray = static_cast<const float*>(floatArray->f);
-	std::memcpy(outArray, rawArray, size * sizeof(float));
+	auto* floatArray = reinterpret_cast<PyrFloatArray*>(floatArrayObj);
+	auto* rawArray = static_cast<float*>(floatArray->f);
+	if (direction == ToSc)
+		std::memcpy(rawArray, array, size * sizeof(float));
+	else
+		std::memcpy(array, rawArray, size * sizeof(float));
 	return true;
 }
 
 template <typename Array>
-bool SC_VcvPrototypeClient::copyArrayOfFloatArrays(const PyrSlot& inSlot, const char* context, Array& outArray, int size) noexcept
+bool SC_VcvPrototypeClient::copyArrayOfFloatArrays(const PyrSlot& inSlot, const char* context, Array& array, int size, CopyDirection direction) noexcept
 {
 	// OUTPUTS
 	if (!isKindOfSlot(const_cast<PyrSlot*>(&inSlot), class_array)) {
@@ -395,7 +756,7 @@ bool SC_VcvPrototypeClient::copyArrayOfFloatArrays(const PyrSlot& inSlot, const
 	}
 
 	for (int i = 0; i < NUM_ROWS; ++i) {
-		if (!copyFloatArray(inObj->slots[i], "subarray of ", context, outArray[i], size)) {
+		if (!copyFloatArray(inObj->slots[i], "subarray of ", context, array[i], size, direction)) {
 			return false;
 		}
 	}
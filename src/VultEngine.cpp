@@ -1,12 +1,26 @@
 #include "ScriptEngine.hpp"
+#include "Cache.hpp"
 #include "vultc.h"
 #include <quickjs/quickjs.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <fstream>
+#include <sstream>
+
+using namespace rack;
 
 /* The Vult engine relies on both QuickJS and LuaJIT.
  *
  * The compiler is written in OCaml but converted to JavaScript. The JavaScript
  * code is embedded as a string and executed by the QuickJs engine. The Vult
  * compiler generates Lua code that is executed by the LuaJIT engine.
+ *
+ * The compiler is loaded once, on a thread shared by every Vult module, and
+ * the generated Lua code is cached in memory and on disk by the hash of the
+ * Vult source.
  */
 
 // Special version of createScriptEngine that only creates Lua engines
@@ -17,80 +31,77 @@ ScriptEngine* createLuaEngine() {
 	return it->second->createScriptEngine();
 }
 
-struct VultEngine : ScriptEngine {
 
-	// used to run the lua generated code
-	ScriptEngine* luaEngine;
+/** 64-bit FNV-1a */
+static uint64_t hashBytes(const unsigned char* data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL) {
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
 
-	// used to run the Vult compiler
+/** Generated Lua code, or an error message if `error` is set */
+struct VultOutput {
+	std::string lua;
+	std::string error;
+};
+
+
+/** QuickJS runtime with the Vult compiler loaded */
+struct VultRuntime {
 	JSRuntime* rt = NULL;
 	JSContext* ctx = NULL;
+	bool loaded = false;
 
-	VultEngine() {
+	VultRuntime() {
 		rt = JS_NewRuntime();
 		// Create QuickJS context
 		ctx = JS_NewContext(rt);
-		if (!ctx) {
-			display("Could not create QuickJS context");
+		if (!ctx)
 			return;
-		}
-
-		JSValue global_obj = JS_GetGlobalObject(ctx);
 
 		// Load the Vult compiler code
-		JSValue val =
-		  JS_Eval(ctx, (const char*)vultc_h, vultc_h_size, "vultc.js", 0);
-		if (JS_IsException(val)) {
-			display("Error loading the Vult compiler");
-			JS_FreeValue(ctx, val);
-			JS_FreeValue(ctx, global_obj);
-			return;
-		}
+		JSValue val = JS_Eval(ctx, (const char*) vultc_h, vultc_h_size, "vultc.js", 0);
+		loaded = !JS_IsException(val);
+		JS_FreeValue(ctx, val);
 	}
 
-	~VultEngine() {
-		if (ctx) {
+	~VultRuntime() {
+		if (ctx)
 			JS_FreeContext(ctx);
-		}
-		if (rt) {
+		if (rt)
 			JS_FreeRuntime(rt);
-		}
 	}
 
-	std::string getEngineName() override {
-		return "Vult";
-	}
-
-	int run(const std::string& path, const std::string& script) override {
-		display("Loading...");
+	VultOutput compile(const std::string& path, const std::string& script) {
+		VultOutput output;
+		if (!loaded) {
+			output.error = "Error loading the Vult compiler";
+			return output;
+		}
 
 		JSValue global_obj = JS_GetGlobalObject(ctx);
 
 		// Put the script text in the 'code' variable
-		JSValue code = JS_NewString(ctx, script.c_str());
-		JS_SetPropertyStr(ctx, global_obj, "code", code);
-
+		JS_SetPropertyStr(ctx, global_obj, "code", JS_NewStringLen(ctx, script.data(), script.size()));
 		// Put the script path in 'file' variable
-		JSValue file = JS_NewString(ctx, path.c_str());
-		JS_SetPropertyStr(ctx, global_obj, "file", file);
+		JS_SetPropertyStr(ctx, global_obj, "file", JS_NewString(ctx, path.c_str()));
 
-		display("Compiling...");
 		// Call the Vult compiler to generate Lua code
 		static const std::string testVult = R"(
     var result = vult.generateLua([{ file:file, code:code}],{ output:'Engine', template:'vcv-prototype'});)";
 
-		JSValue compile =
-		  JS_Eval(ctx, testVult.c_str(), testVult.size(), "Compile", 0);
-
-		JS_FreeValue(ctx, code);
-		JS_FreeValue(ctx, file);
-
+		JSValue compile = JS_Eval(ctx, testVult.c_str(), testVult.size(), "Compile", 0);
 		// If there are any internal errors, the execution could fail
 		if (JS_IsException(compile)) {
-			display("Fatal error in the Vult compiler");
+			output.error = "Fatal error in the Vult compiler";
+			JS_FreeValue(ctx, JS_GetException(ctx));
 			JS_FreeValue(ctx, global_obj);
-			return -1;
+			return output;
 		}
+		JS_FreeValue(ctx, compile);
 
 		// Retrive the variable 'result'
 		JSValue result = JS_GetPropertyStr(ctx, global_obj, "result");
@@ -98,28 +109,188 @@ struct VultEngine : ScriptEngine {
 		JSValue first = JS_GetPropertyUint32(ctx, result, 0);
 		// Try to get the 'msg' field which is only present in error messages
 		JSValue msg = JS_GetPropertyStr(ctx, first, "msg");
-		// Display the error if any
 		if (!JS_IsUndefined(msg)) {
-			const char* text = JS_ToCString(ctx, msg);
-			const char* row =
-			  JS_ToCString(ctx, JS_GetPropertyStr(ctx, first, "line"));
-			const char* col = JS_ToCString(ctx, JS_GetPropertyStr(ctx, first, "col"));
 			// Compose the error message
-			std::stringstream error;
-			error << "line:" << row << ":" << col << ": " << text;
-			WARN("Vult Error: %s", error.str().c_str());
-			display(error.str().c_str());
-
-			JS_FreeValue(ctx, result);
-			JS_FreeValue(ctx, first);
-			JS_FreeValue(ctx, msg);
-			return -1;
+			output.error = "line:" + getString(first, "line") + ":" + getString(first, "col") + ": " + getString(first, "msg");
+		}
+		else {
+			// In case of no error, retrieve the generated code
+			output.lua = getString(first, "code");
+		}
+
+		JS_FreeValue(ctx, msg);
+		JS_FreeValue(ctx, first);
+		JS_FreeValue(ctx, result);
+		JS_FreeValue(ctx, global_obj);
+		return output;
+	}
+
+	std::string getString(JSValue obj, const char* name) {
+		JSValue val = JS_GetPropertyStr(ctx, obj, name);
+		const char* s = JS_ToCString(ctx, val);
+		std::string str = s ? s : "";
+		JS_FreeCString(ctx, s);
+		JS_FreeValue(ctx, val);
+		return str;
+	}
+};
+
+
+/** Compiles Vult scripts on a background thread shared by every Vult module.
+The compiler is loaded when the first script that is not cached is compiled.
+*/
+struct VultCompiler {
+	struct Job {
+		std::string path;
+		std::string script;
+		uint64_t hash;
+		std::string cachePath;
+		std::promise<VultOutput> promise;
+	};
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<Job> queue;
+	/** Generated Lua code by hash of the Vult source */
+	std::map<uint64_t, std::string> cache;
+	std::thread thread;
+	bool running = true;
+	std::string cacheDir;
+	/** Hash of the compiler's code, since the generated code depends on it */
+	uint64_t compilerHash;
+
+	VultCompiler() {
+		cacheDir = getCacheDir();
+		compilerHash = hashBytes((const unsigned char*) vultc_h, vultc_h_size);
+		thread = std::thread([this]() {
+			system::setThreadName("Prototype Vult Compiler");
+			run();
+		});
+	}
+
+	~VultCompiler() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		cv.notify_one();
+		thread.join();
+	}
+
+	/** Returns the Lua code of the script, compiling it if it is not cached. Blocks until it is compiled. */
+	VultOutput compile(const std::string& path, const std::string& script) {
+		uint64_t hash = hashBytes((const unsigned char*) script.data(), script.size(), compilerHash);
+		std::string cachePath = string::f("%s/vult-%016llx.lua", cacheDir.c_str(), (unsigned long long) hash);
+		VultOutput output;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = cache.find(hash);
+			if (it != cache.end()) {
+				output.lua = it->second;
+				return output;
+			}
+		}
+
+		// Read the disk cache
+		std::ifstream file(cachePath, std::ios::binary);
+		if (file.good()) {
+			std::stringstream buffer;
+			buffer << file.rdbuf();
+			output.lua = buffer.str();
+			touchCacheFile(cachePath);
+			std::lock_guard<std::mutex> lock(mutex);
+			cache[hash] = output.lua;
+			return output;
 		}
-		// In case of no error, retrieve the generated code
-		JSValue luacode = JS_GetPropertyStr(ctx, first, "code");
-		std::string luacode_str(JS_ToCString(ctx, luacode));
 
-		//WARN("Generated Code: %s", luacode_str.c_str());
+		// The compiler thread caches the output
+		std::future<VultOutput> future;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(Job());
+			queue.back().path = path;
+			queue.back().script = script;
+			queue.back().hash = hash;
+			queue.back().cachePath = cachePath;
+			future = queue.back().promise.get_future();
+		}
+		cv.notify_one();
+		return future.get();
+	}
+
+	/** Called by the compiler thread after the module has its output. */
+	void writeCacheFile(const std::string& cachePath, const std::string& lua) {
+		system::createDirectory(cacheDir);
+		// Rename a uniquely named file, so that another process writing the same script never interleaves with this one, and a partially written file is never read
+		std::string tmpPath = string::f("%s.%08x.tmp", cachePath.c_str(), random::u32());
+		{
+			std::ofstream out(tmpPath, std::ios::binary);
+			out << lua;
+		}
+		std::rename(tmpPath.c_str(), cachePath.c_str());
+		trimCache();
+	}
+
+	void run() {
+		VultRuntime* runtime = NULL;
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&]() {return !running || !queue.empty();});
+				if (!running)
+					break;
+				job = std::move(queue.front());
+				queue.pop_front();
+			}
+			if (!runtime)
+				runtime = new VultRuntime;
+			VultOutput output = runtime->compile(job.path, job.script);
+			if (!output.error.empty()) {
+				job.promise.set_value(output);
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				cache[job.hash] = output.lua;
+			}
+			job.promise.set_value(output);
+			writeCacheFile(job.cachePath, output.lua);
+		}
+		delete runtime;
+	}
+};
+
+
+static VultOutput compileVult(const std::string& path, const std::string& script) {
+	static VultCompiler compiler;
+	return compiler.compile(path, script);
+}
+
+
+struct VultEngine : ScriptEngine {
+
+	// used to run the lua generated code
+	ScriptEngine* luaEngine = NULL;
+
+	~VultEngine() {
+		// The block is owned by this engine
+		if (luaEngine)
+			luaEngine->workerBlock = NULL;
+		delete luaEngine;
+	}
+
+	std::string getEngineName() override {
+		return "Vult";
+	}
+
+	int run(const std::string& path, const std::string& script) override {
+		VultOutput output = compileVult(path, script);
+		if (!output.error.empty()) {
+			WARN("Vult Error: %s", output.error.c_str());
+			display(output.error);
+			return -1;
+		}
 
 		luaEngine = createLuaEngine();
 
@@ -128,24 +299,56 @@ struct VultEngine : ScriptEngine {
 			return -1;
 		}
 
-		luaEngine->module = this->module;
+		// The Lua engine runs on this engine's block and reports its block settings through it
+		luaEngine->module = module;
+		luaEngine->workerBlock = workerBlock;
+		luaEngine->workerIndex = workerIndex;
+		luaEngine->parent = this;
 
-		display("Running...");
-
-		JS_FreeValue(ctx, luacode);
-		JS_FreeValue(ctx, first);
-		JS_FreeValue(ctx, msg);
-		JS_FreeValue(ctx, msg);
-		JS_FreeValue(ctx, global_obj);
-
-		return luaEngine->run(path, luacode_str);
+		return luaEngine->run(path, output.lua);
 	}
 
 	int process() override {
 		if (!luaEngine)
-      return -1;
+			return -1;
+		// Set on workers after run()
+		luaEngine->worker = worker;
 		return luaEngine->process();
 	}
+
+	int processControl() override {
+		if (!luaEngine)
+			return -1;
+		luaEngine->worker = worker;
+		return luaEngine->processControl();
+	}
+
+	std::vector<std::string> getStats() override {
+		if (!luaEngine)
+			return {};
+		return luaEngine->getStats();
+	}
+
+	int getBlockLatency() override {
+		if (!luaEngine)
+			return 0;
+		return luaEngine->getBlockLatency();
+	}
+
+	void startBuses() override {
+		if (luaEngine)
+			luaEngine->startBuses();
+	}
+
+	void publishBuses() override {
+		if (luaEngine)
+			luaEngine->publishBuses();
+	}
+
+	bool checkBlockConfig(ScriptEngine* engine, const std::string& name, int value) override {
+		// Checked by the chain running this engine as a stage
+		return !parent || parent->checkBlockConfig(this, name, value);
+	}
 };
 
 __attribute__((constructor(1000)))
@@ -0,0 +1,158 @@
+#include "Wav.hpp"
+
+
+using namespace rack;
+
+
+static uint32_t readU32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t readU16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static void writeU32(uint8_t* p, uint32_t x) {
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+}
+
+static void writeU16(uint8_t* p, uint16_t x) {
+	p[0] = x;
+	p[1] = x >> 8;
+}
+
+/** Reads one sample as a float in [-1, 1]. */
+static float readSample(const uint8_t* p, int bits, bool isFloat) {
+	if (isFloat) {
+		if (bits == 64) {
+			double d;
+			std::memcpy(&d, p, sizeof(d));
+			return d;
+		}
+		float f;
+		std::memcpy(&f, p, sizeof(f));
+		return f;
+	}
+	switch (bits) {
+		case 8: return (p[0] - 128) / 128.f;
+		case 16: return (int16_t) readU16(p) / 32768.f;
+		// Shift into the top bytes to sign-extend
+		case 24: return (int32_t) ((p[0] << 8) | (p[1] << 16) | ((uint32_t) p[2] << 24)) / 2147483648.f;
+		case 32: return (int32_t) readU32(p) / 2147483648.f;
+		default: return 0.f;
+	}
+}
+
+
+bool readWavHeader(FILE* file, const std::string& path, WavFormat* format) {
+	uint8_t header[12];
+	if (std::fread(header, 1, 12, file) != 12 || std::memcmp(header, "RIFF", 4) || std::memcmp(header + 8, "WAVE", 4)) {
+		WARN("%s is not a WAV file", path.c_str());
+		return false;
+	}
+
+	*format = WavFormat();
+	// Walk chunks until the data chunk
+	uint8_t chunkHeader[8];
+	while (std::fread(chunkHeader, 1, 8, file) == 8) {
+		uint32_t chunkSize = readU32(chunkHeader + 4);
+		if (!std::memcmp(chunkHeader, "fmt ", 4)) {
+			uint8_t fmt[40] = {};
+			size_t fmtSize = std::min(chunkSize, (uint32_t) sizeof(fmt));
+			if (std::fread(fmt, 1, fmtSize, file) != fmtSize)
+				break;
+			format->format = readU16(fmt);
+			format->channels = readU16(fmt + 2);
+			format->sampleRate = readU32(fmt + 4);
+			format->bits = readU16(fmt + 14);
+			// WAVE_FORMAT_EXTENSIBLE stores the format in the subformat GUID
+			if (format->format == 0xfffe && fmtSize >= 26)
+				format->format = readU16(fmt + 24);
+			std::fseek(file, chunkSize - fmtSize, SEEK_CUR);
+		}
+		else if (!std::memcmp(chunkHeader, "data", 4)) {
+			// Streaming writers leave the size at 0xFFFFFFFF, and truncated files are shorter than their header says
+			long start = std::ftell(file);
+			std::fseek(file, 0, SEEK_END);
+			long end = std::ftell(file);
+			std::fseek(file, start, SEEK_SET);
+			format->dataSize = std::min((int64_t) chunkSize, (int64_t) std::max(end - start, 0L));
+			break;
+		}
+		else {
+			std::fseek(file, chunkSize, SEEK_CUR);
+		}
+		// Chunks are padded to even sizes
+		if (chunkSize & 1)
+			std::fseek(file, 1, SEEK_CUR);
+	}
+
+	bool isFloat = (format->format == 3);
+	bool supported = (format->format == 1 && (format->bits == 8 || format->bits == 16 || format->bits == 24 || format->bits == 32)) || (isFloat && (format->bits == 32 || format->bits == 64));
+	if (!supported || format->channels <= 0 || format->sampleRate <= 0.f) {
+		WARN("Unsupported WAV format in %s (format %d, %d bits, %d channels)", path.c_str(), format->format, format->bits, format->channels);
+		return false;
+	}
+	return true;
+}
+
+
+void decodeWavSamples(const uint8_t* data, float* out, int count, const WavFormat& format) {
+	int bytesPerSample = format.bits / 8;
+	bool isFloat = (format.format == 3);
+	for (int i = 0; i < count; i++)
+		out[i] = readSample(&data[i * bytesPerSample], format.bits, isFloat);
+}
+
+
+void writeWavHeader(FILE* file, int channels, float sampleRate, int64_t frames) {
+	uint32_t dataSize = std::min(frames * channels * 4, (int64_t) UINT32_MAX - 36);
+	uint8_t header[44];
+	std::memcpy(header, "RIFF", 4);
+	writeU32(header + 4, 36 + dataSize);
+	std::memcpy(header + 8, "WAVEfmt ", 8);
+	writeU32(header + 16, 16);
+	writeU16(header + 20, 3);
+	writeU16(header + 22, channels);
+	writeU32(header + 24, sampleRate);
+	writeU32(header + 28, sampleRate * channels * 4);
+	writeU16(header + 32, channels * 4);
+	writeU16(header + 34, 32);
+	std::memcpy(header + 36, "data", 4);
+	writeU32(header + 40, dataSize);
+	std::fwrite(header, 1, sizeof(header), file);
+}
+
+
+bool loadWav(const std::string& path, AudioData* audio) {
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if (!file) {
+		WARN("Could not open WAV file %s", path.c_str());
+		return false;
+	}
+	DEFER({
+		std::fclose(file);
+	});
+
+	WavFormat format;
+	if (!readWavHeader(file, path, &format))
+		return false;
+	std::vector<uint8_t> data(format.dataSize);
+	data.resize(std::fread(data.data(), 1, data.size(), file));
+
+	audio->channels = format.channels;
+	audio->frames = data.size() / format.getFrameSize();
+	audio->sampleRate = format.sampleRate;
+	audio->samples.resize(format.channels * audio->frames);
+	// Decode interleaved frames, then split them into channels
+	std::vector<float> frame(format.channels);
+	for (int i = 0; i < audio->frames; i++) {
+		decodeWavSamples(&data[i * format.getFrameSize()], frame.data(), format.channels, format);
+		for (int c = 0; c < format.channels; c++)
+			audio->samples[c * audio->frames + i] = frame[c];
+	}
+	return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <rack.hpp>
+
+
+/** Audio decoded from a file, with channels stored one after another */
+struct AudioData {
+	int channels = 0;
+	int frames = 0;
+	float sampleRate = 44100.f;
+	/** `channels * frames` samples. Channel `c` starts at `c * frames`. */
+	std::vector<float> samples;
+
+	float* getChannel(int c) {
+		return &samples[c * frames];
+	}
+};
+
+
+/** Sample format of a WAV file */
+struct WavFormat {
+	/** 1 = integer PCM, 3 = IEEE float */
+	int format = 0;
+	int channels = 0;
+	int bits = 0;
+	float sampleRate = 0.f;
+	/** Size of the data chunk in bytes */
+	int64_t dataSize = 0;
+
+	int getFrameSize() const {
+		return channels * bits / 8;
+	}
+};
+
+
+/** Decodes a RIFF WAVE file with 8, 16, 24, or 32-bit integer or 32/64-bit float samples.
+Returns false and logs a warning if the file cannot be read.
+*/
+bool loadWav(const std::string& path, AudioData* audio);
+
+/** Reads the header of a WAV file, leaving the file at the start of the sample data.
+Returns false and logs a warning if the format is not supported.
+*/
+bool readWavHeader(FILE* file, const std::string& path, WavFormat* format);
+/** Converts `count` interleaved samples from the file's format to floats. */
+void decodeWavSamples(const uint8_t* data, float* out, int count, const WavFormat& format);
+/** Writes the header of a 32-bit float WAV file with `frames` frames.
+Write it again with the final frame count once all samples are written.
+*/
+void writeWavHeader(FILE* file, int channels, float sampleRate, int64_t frames);
@@ -0,0 +1,236 @@
+#include "Workers.hpp"
+#include <thread>
+
+
+using namespace rack;
+
+
+Worker::~Worker() {
+	delete engine;
+}
+
+
+/** Threads shared by the workers of every module, one fewer than the number of cores. */
+struct WorkerPool {
+	std::mutex mutex;
+	std::condition_variable cv;
+	/** Ring buffer of queued workers, preallocated so push() does not allocate on the audio thread */
+	Worker* queue[MAX_QUEUED_WORKERS];
+	int queueStart = 0;
+	int queueSize = 0;
+	std::vector<std::thread> threads;
+	bool running = true;
+
+	WorkerPool() {
+		int count = clamp((int) std::thread::hardware_concurrency() - 1, 1, MAX_WORKERS);
+		for (int i = 0; i < count; i++) {
+			threads.emplace_back([this]() {
+				system::setThreadName("Prototype Worker");
+				run();
+			});
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		cv.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	/** Returns false if the queue is full. */
+	bool push(Worker* worker) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (queueSize >= MAX_QUEUED_WORKERS)
+				return false;
+			queue[(queueStart + queueSize) % MAX_QUEUED_WORKERS] = worker;
+			queueSize++;
+		}
+		cv.notify_one();
+		return true;
+	}
+
+	void run() {
+		while (true) {
+			Worker* worker;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&]() {return !running || queueSize > 0;});
+				if (!running)
+					return;
+				worker = queue[queueStart];
+				queueStart = (queueStart + 1) % MAX_QUEUED_WORKERS;
+				queueSize--;
+			}
+			worker->group->runWorker(worker);
+		}
+	}
+};
+
+
+static WorkerPool& getWorkerPool() {
+	static WorkerPool workerPool;
+	return workerPool;
+}
+
+
+WorkerGroup::~WorkerGroup() {
+	for (Worker* worker : workers)
+		delete worker;
+}
+
+void WorkerGroup::release() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		released = true;
+		// Queued and running workers still reference their engines, so the last one to finish deletes the group
+		for (Worker* worker : workers) {
+			if (worker->busy)
+				return;
+		}
+	}
+	delete this;
+}
+
+int WorkerGroup::fork(const ProcessBlock* block) {
+	forkId++;
+	forked = true;
+	// Spectral frames are 2 floats longer than bufferSize
+	rowSize = std::min(block->bufferSize + 2, MAX_BUFFER_SIZE);
+
+	int started = 0;
+	for (Worker* worker : workers) {
+		if (worker->failed)
+			continue;
+		if (worker->busy) {
+			// Count the late run once, whether join() or this fork found it first
+			if (worker->missedFork != worker->startedFork) {
+				worker->missedFork = worker->startedFork;
+				missed++;
+			}
+			continue;
+		}
+		ProcessBlock* b = worker->engine->getProcessBlock();
+		b->sampleRate = block->sampleRate;
+		b->sampleTime = block->sampleTime;
+		b->bufferSize = block->bufferSize;
+		b->frame = block->frame;
+		std::memcpy(b->knobs, block->knobs, sizeof(b->knobs));
+		std::memcpy(b->switches, block->switches, sizeof(b->switches));
+		std::memcpy(b->rowBufferSizes, block->rowBufferSizes, sizeof(b->rowBufferSizes));
+		std::memcpy(b->inputEventCounts, block->inputEventCounts, sizeof(b->inputEventCounts));
+		for (int i = 0; i < NUM_ROWS; i++) {
+			std::memcpy(b->inputs[i], block->inputs[i], sizeof(float) * rowSize);
+			std::memcpy(b->knobBuffers[i], block->knobBuffers[i], sizeof(float) * rowSize);
+			std::memcpy(b->switchBuffers[i], block->switchBuffers[i], sizeof(bool) * rowSize);
+			std::memcpy(b->inputEventOffsets[i], block->inputEventOffsets[i], sizeof(int) * block->inputEventCounts[i]);
+			std::memcpy(b->inputEventTypes[i], block->inputEventTypes[i], sizeof(uint8_t) * block->inputEventCounts[i]);
+			std::memset(b->outputs[i], 0, sizeof(float) * rowSize);
+		}
+		int64_t previousFork = worker->startedFork;
+		worker->startedFork = forkId;
+		worker->busy = true;
+		if (!getWorkerPool().push(worker)) {
+			// join() does not wait for a worker that was not queued
+			worker->startedFork = previousFork;
+			worker->busy = false;
+			missed++;
+			continue;
+		}
+		started++;
+	}
+	return started;
+}
+
+int WorkerGroup::join(ProcessBlock* block, double timeout) {
+	if (!forked)
+		return 0;
+	forked = false;
+
+	auto finished = [&]() {
+		for (Worker* worker : workers) {
+			if (worker->startedFork == forkId && worker->finishedFork != forkId && !worker->failed)
+				return false;
+		}
+		return true;
+	};
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(std::max(timeout, 0.0));
+		cv.wait_until(lock, deadline, finished);
+	}
+
+	int joined = 0;
+	for (Worker* worker : workers) {
+		if (worker->startedFork != forkId)
+			continue;
+		if (worker->finishedFork != forkId) {
+			if (!worker->failed && worker->missedFork != forkId) {
+				worker->missedFork = forkId;
+				missed++;
+			}
+			continue;
+		}
+		ProcessBlock* b = worker->engine->getProcessBlock();
+		for (int i = 0; i < NUM_ROWS; i++) {
+			for (int j = 0; j < rowSize; j++)
+				block->outputs[i][j] += b->outputs[i][j];
+		}
+		joined++;
+	}
+	return joined;
+}
+
+void WorkerGroup::runWorker(Worker* worker) {
+	bool skip;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		skip = released;
+	}
+	if (!skip && worker->engine->process()) {
+		WARN("Worker %d process() failed. Stopped worker.", (int) (std::find(workers.begin(), workers.end(), worker) - workers.begin()));
+		worker->failed = true;
+	}
+	bool last = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!worker->failed)
+			worker->finishedFork = worker->startedFork;
+		worker->busy = false;
+		if (released) {
+			last = true;
+			for (Worker* w : workers) {
+				if (w->busy)
+					last = false;
+			}
+		}
+		// Notify before unlocking, since release() may delete the group as soon as the mutex is free
+		if (!last)
+			cv.notify_all();
+	}
+	if (last)
+		delete this;
+}
+
+void WorkerGroup::setMessage(Worker* worker, const std::string& message) {
+	std::lock_guard<std::mutex> lock(mutex);
+	worker->message = message;
+	worker->hasMessage = true;
+}
+
+bool WorkerGroup::takeMessage(std::string* message) {
+	std::lock_guard<std::mutex> lock(mutex);
+	bool found = false;
+	for (Worker* worker : workers) {
+		if (!worker->hasMessage)
+			continue;
+		message->swap(worker->message);
+		worker->hasMessage = false;
+		found = true;
+	}
+	return found;
+}
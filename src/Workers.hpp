@@ -0,0 +1,76 @@
+#pragma once
+#include "ScriptEngine.hpp"
+#include <mutex>
+#include <condition_variable>
+
+
+static const int MAX_WORKERS = 16;
+/** Maximum number of workers of all modules waiting for a pool thread */
+static const int MAX_QUEUED_WORKERS = 1024;
+
+
+struct WorkerGroup;
+
+
+/** A second context of the main script's engine, running a worker script on the shared worker thread pool.
+It has its own ProcessBlock, which the host fills from the main block when the group is forked.
+*/
+struct Worker {
+	WorkerGroup* group = NULL;
+	ScriptEngine* engine = NULL;
+	/** Set by the audio thread when the worker is queued, and cleared by the pool thread when it finishes */
+	std::atomic<bool> busy{false};
+	/** The fork that the worker was queued by, and the last fork it finished */
+	int64_t startedFork = -1;
+	std::atomic<int64_t> finishedFork{-1};
+	/** The last fork whose run was counted in WorkerGroup::missed, so a late run is counted once */
+	int64_t missedFork = -1;
+	/** Set if the worker script's process() fails, after which it is not run again */
+	std::atomic<bool> failed{false};
+	/** Last message displayed by the worker script from the pool, shown by the main script's thread. Guarded by the group's mutex. */
+	std::string message;
+	bool hasMessage = false;
+
+	~Worker();
+};
+
+
+/** Workers spawned by one call to ScriptEngine::addWorkers().
+fork() and join() are called by the thread running the main script.
+*/
+struct WorkerGroup {
+	std::vector<Worker*> workers;
+	int64_t forkId = 0;
+	bool forked = false;
+	/** Number of floats of each row copied into and out of the worker blocks by the current fork */
+	int rowSize = 0;
+	/** Total number of worker runs that were late for their join or still busy at a later fork, or could not be queued */
+	int64_t missed = 0;
+	/** Set by release(), after which queued workers are skipped and the last running worker deletes the group */
+	bool released = false;
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	/** Deletes the workers. Use release() instead while workers may be running. */
+	~WorkerGroup();
+	/** Deletes the group now if no worker is queued or running, or hands its deletion to the pool thread that finishes the last one.
+	Does not wait, so it can be called on the audio thread.
+	*/
+	void release();
+	/** Copies the block's inputs, params, and events to every idle worker and queues their process() calls.
+	Workers still running from an earlier fork are skipped.
+	Returns the number of workers started.
+	*/
+	int fork(const ProcessBlock* block);
+	/** Waits up to `timeout` seconds for the workers started by fork(), and adds the outputs of those that finished to the block's outputs.
+	Late workers keep running, and their outputs are dropped.
+	Returns the number of workers whose outputs were added.
+	*/
+	int join(ProcessBlock* block, double timeout);
+	/** Called by the pool thread. */
+	void runWorker(Worker* worker);
+	/** Called by the worker's engine from the pool thread instead of setting the module's message. */
+	void setMessage(Worker* worker, const std::string& message);
+	/** Moves the last message displayed by a worker since the previous call into `message`, and returns whether there was one. */
+	bool takeMessage(std::string* message);
+};
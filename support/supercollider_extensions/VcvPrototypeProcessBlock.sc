@@ -5,7 +5,15 @@
 // Original author: Brian Heim
 
 VcvPrototypeProcessBlock {
-	classvar <>numRows; // Set internally, do not modify
+	// Set internally, do not modify.
+	// Code in SuperColliderEngine.cpp relies on the ordering of classvars.
+	classvar <>numRows;
+	classvar <vcvCurrentModule; // Id of the module whose script is being loaded or processed, or nil
+	classvar <vcvEnvironments; // Environment of each module, by id
+	classvar <vcvFunctions; // ~vcv_process of each module, evaluated in its Environment
+	classvar <vcvBlocks; // The instance passed to each module's ~vcv_process
+	classvar <vcvDue; // true for the modules that the next vcvProcessAll evaluates
+	classvar <vcvResults; // Result of each module's last ~vcv_process, or the message of its error
 
 	// Code in SuperColliderEngine.cpp relies on ordering.
 	var <sampleRate; // Float
@@ -20,4 +28,65 @@ VcvPrototypeProcessBlock {
 
 	// TODO not needed?
 	*new { |... args| ^super.newCopyArgs(*args); }
+
+	*initClass {
+		vcvEnvironments = [];
+		vcvFunctions = [];
+		vcvBlocks = [];
+		vcvDue = [];
+		vcvResults = [];
+	}
+
+	// Makes a new Environment current for interpreting a module's script
+	*vcvBeginModule { |id|
+		if (id >= vcvDue.size) {
+			vcvEnvironments = vcvEnvironments.extend(id + 1, nil);
+			vcvFunctions = vcvFunctions.extend(id + 1, nil);
+			vcvBlocks = vcvBlocks.extend(id + 1, nil);
+			vcvDue = vcvDue.extend(id + 1, false);
+			vcvResults = vcvResults.extend(id + 1, nil);
+		};
+		vcvCurrentModule = id;
+		vcvEnvironments[id] = Environment.new;
+		currentEnvironment = vcvEnvironments[id];
+	}
+
+	// Creates the block passed to the module's ~vcv_process, once its script has set ~vcv_bufferSize
+	*vcvEndModule { |id, size|
+		var environment = vcvEnvironments[id];
+		vcvFunctions[id] = environment[\vcv_process].inEnvir(environment);
+		vcvBlocks[id] = this.new(0.0, 0.0, size,
+			Array.fill(numRows, { Signal.newClear(size) }),
+			Array.fill(numRows, { Signal.newClear(size) }),
+			FloatArray.newClear(numRows),
+			Array.fill(numRows, false),
+			Array.fill(numRows, { FloatArray.newClear(3) }),
+			Array.fill(numRows, { FloatArray.newClear(3) }));
+		^vcvBlocks[id]
+	}
+
+	*vcvRestoreEnvironment {
+		currentEnvironment = topEnvironment;
+		vcvCurrentModule = nil;
+	}
+
+	*vcvRemoveModule { |id|
+		vcvEnvironments[id] = nil;
+		vcvFunctions[id] = nil;
+		vcvBlocks[id] = nil;
+		vcvDue[id] = false;
+		vcvResults[id] = nil;
+	}
+
+	// Evaluates the due modules' blocks. An error only stops the module that threw it.
+	*vcvProcessAll {
+		vcvDue.do { |due, id|
+			if (due) {
+				vcvCurrentModule = id;
+				vcvResults[id] = { vcvFunctions[id].value(vcvBlocks[id]) }.try { |error| error.errorString };
+				vcvDue[id] = false;
+			};
+		};
+		vcvCurrentModule = nil;
+	}
 }